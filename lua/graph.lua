@@ -508,6 +508,42 @@ psv_node = {
 ["2"] = 64
 }
 
+--the keys each of the functions below look at. objects with none of them come out the same as
+--objects without any tags (other than keeping the tags they had) so they dont need to be
+--handed to lua at all. keep these up to date when changing what the functions look at, which
+--includes the few outputs (ie truck_forward) that are read before they are set and any tag
+--the parser reads that the functions can leave as it was (ie toll_booth)
+node_keys = {
+"access", "impassable", "emergency", "service", "foot", "wheelchair", "bicycle", "hgv", "motorcar",
+"motor_vehicle", "bus", "psv", "highway", "barrier", "bollard", "railway", "footway", "cycleway",
+"pedestrian", "crossing", "payment:coins", "payment:notes", "toll", "toll:hgv", "toll:bicycle",
+"toll:hov", "toll:motorcar", "toll:motor_vehicle", "toll:bus", "toll:motorcycle", "payment:cash",
+"fee", "payment:e_zpass", "payment:e_zpass:name", "payment:pikepass", "payment:via_verde",
+"amenity", "shop", "service:bicycle:rental", "traffic_signals:direction",
+--passed through to the parser when the functions dont set them, so they count too
+"forward_signal", "backward_signal", "gate", "toll_booth", "border_control", "access_mask",
+"exit_to", "ref", "name"
+}
+
+way_keys = {
+"highway", "route", "access", "emergency", "service", "impassable", "motorcar", "motor_vehicle",
+"hgv", "bus", "psv", "lanes:psv:forward", "foot", "pedestrian", "bicycle", "cycleway",
+"bicycle_road", "cyclestreet", "oneway", "oneway:bicycle", "bicycle:backward", "cycleway:left",
+"cycleway:right", "oneway:bus", "bus:backward", "busway", "busway:left", "busway:right",
+"lanes:psv:backward", "junction", "cycleway:both", "lanes:bus", "area", "railway", "footway",
+"name", "name:en", "alt_name", "official_name", "ref", "int_ref", "unsigned_ref", "maxspeed",
+"maxspeed:backward", "maxspeed:forward", "wheelchair", "tracktype", "lanes", "lanes:forward",
+"lanes:backward", "bridge", "seasonal", "hov", "hov:lanes", "hov:minimum", "tunnel", "toll",
+"maxheight", "maxheight:physical", "maxwidth", "maxwidth:physical", "maxlength", "maxweight",
+"maxaxleload", "hazmat", "hazmat:water", "hazmat:A", "hazmat:B", "hazmat:C", "hazmat:D",
+"hazmat:E", "maxspeed:hgv", "hgv:national_network", "hgv:state_network", "ncn_ref", "rcn_ref",
+"lcn_ref", "ncn", "rcn", "lcn", "mtb", "truck_forward", "bike_backward", "bus_backward"
+}
+
+relation_keys = {
+"type", "restriction", "day_on", "day_off", "route", "network"
+}
+
 function round(val, n)
   if (n) then
     return math.floor( (val * 10^n) + 0.5) / (10^n)
@@ -0,0 +1,109 @@
+#include "mjolnir/densenodes.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// how many coordinates to decode at a time on the stack before converting them to degrees
+constexpr size_t kChunkSize = 512;
+
+// converts absolute values in nanodegrees (scaled by granularity) to degrees
+void to_degrees(const int64_t* values, const size_t count, const int64_t offset,
+                const int64_t granularity, double* degrees) {
+  for (size_t i = 0; i < count; ++i)
+    degrees[i] = 0.000000001 * (offset + granularity * values[i]);
+}
+
+// decodes one coordinate column a chunk at a time and appends it in degrees
+void decode_coordinates(const int64_t* deltas, const size_t count, const int64_t offset,
+                        const int64_t granularity, std::vector<double>& degrees) {
+  size_t first = degrees.size();
+  degrees.resize(first + count);
+  int64_t values[kChunkSize];
+  int64_t last = 0;
+  for (size_t i = 0; i < count; i += kChunkSize) {
+    size_t n = std::min(kChunkSize, count - i);
+    last = OSMPBF::delta_decode(deltas + i, n, last, values);
+    to_degrees(values, n, offset, granularity, degrees.data() + first + i);
+  }
+}
+
+}
+
+// extend the protobuf osmpbf namespace
+namespace OSMPBF {
+
+int64_t delta_decode_scalar(const int64_t* deltas, const size_t count, const int64_t start, int64_t* values) {
+  int64_t value = start;
+  for (size_t i = 0; i < count; ++i) {
+    value += deltas[i];
+    values[i] = value;
+  }
+  return value;
+}
+
+int64_t delta_decode(const int64_t* deltas, const size_t count, const int64_t start, int64_t* values) {
+  size_t i = 0;
+  int64_t last = start;
+#if defined(__AVX2__)
+  //4 at a time: sum within each 128 bit lane, carry the low lane into the high lane
+  //then carry the running total from the previous 4
+  __m256i carry = _mm256_set1_epi64x(start);
+  for (; i + 4 <= count; i += 4) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(deltas + i));
+    x = _mm256_add_epi64(x, _mm256_slli_si256(x, 8));
+    x = _mm256_add_epi64(x, _mm256_blend_epi32(_mm256_setzero_si256(),
+        _mm256_permute4x64_epi64(x, _MM_SHUFFLE(1, 1, 0, 0)), 0xF0));
+    x = _mm256_add_epi64(x, carry);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(values + i), x);
+    carry = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+  if (i > 0)
+    last = values[i - 1];
+#elif defined(__SSE2__)
+  //2 at a time: sum the pair then carry the running total from the previous pair
+  __m128i carry = _mm_set_epi64x(start, start);
+  for (; i + 2 <= count; i += 2) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(deltas + i));
+    x = _mm_add_epi64(x, _mm_slli_si128(x, 8));
+    x = _mm_add_epi64(x, carry);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(values + i), x);
+    carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 2, 3, 2));
+  }
+  if (i > 0)
+    last = values[i - 1];
+#endif
+  //whatever is left over
+  return delta_decode_scalar(deltas + i, count - i, last, values + i);
+}
+
+void decode_dense_nodes(const DenseNodes& dense, const int64_t lat_offset, const int64_t lon_offset,
+                        const int32_t granularity, std::vector<uint64_t>& ids,
+                        std::vector<double>& lngs, std::vector<double>& lats) {
+  if (dense.lat_size() != dense.id_size() || dense.lon_size() != dense.id_size())
+    throw std::runtime_error("Dense nodes have mismatched id and coordinate counts");
+  decode_dense_nodes(dense.id().data(), dense.lat().data(), dense.lon().data(), dense.id_size(),
+                     lat_offset, lon_offset, granularity, ids, lngs, lats);
+}
+
+void decode_dense_nodes(const int64_t* ids, const int64_t* lats, const int64_t* lons, const size_t count,
+                        const int64_t lat_offset, const int64_t lon_offset, const int32_t granularity,
+                        std::vector<uint64_t>& out_ids, std::vector<double>& lngs, std::vector<double>& lats_out) {
+  //ids are decoded right into the output
+  size_t first = out_ids.size();
+  out_ids.resize(first + count);
+  delta_decode(ids, count, 0, reinterpret_cast<int64_t*>(out_ids.data() + first));
+
+  //coordinates go through a small buffer on their way to degrees
+  decode_coordinates(lons, count, lon_offset, granularity, lngs);
+  decode_coordinates(lats, count, lat_offset, granularity, lats_out);
+}
+
+}
@@ -4,6 +4,7 @@
 #include "mjolnir/node_expander.h"
 #include "mjolnir/ferry_connections.h"
 #include "mjolnir/linkclassification.h"
+#include "mjolnir/sortfile.h"
 
 #include <future>
 #include <utility>
@@ -49,18 +50,17 @@ constexpr double kMinimumInterval = 10.0f;
 std::map<GraphId, size_t> SortGraph(const std::string& nodes_file,
                                     const std::string& edges_file,
                                     const TileHierarchy& tile_hierarchy,
-                                    const uint8_t level) {
+                                    const uint8_t level,
+                                    const unsigned int threads,
+                                    const size_t sort_memory) {
   LOG_INFO("Sorting graph...");
 
   // Sort nodes by graphid then by osmid, so its basically a set of tiles
-  sequence<Node> nodes(nodes_file, false);
-  nodes.sort(
-    [&tile_hierarchy, &level](const Node& a, const Node& b) {
-      if(a.graph_id == b.graph_id)
-        return a.node.osmid < b.node.osmid;
-      return a.graph_id < b.graph_id;
-    }
+  SortFileByKey<Node>(nodes_file, threads, sort_memory,
+    [](const Node& a) { return a.graph_id.value; },
+    [](const Node& a) { return a.node.osmid; }
   );
+  sequence<Node> nodes(nodes_file, false);
   //run through the sorted nodes, going back to the edges they reference and updating each edge
   //to point to the first (out of the duplicates) nodes index. at the end of this there will be
   //tons of nodes that no edges reference, but we need them because they are the means by which
@@ -579,10 +579,10 @@ void BuildTileSet(const std::string& ways_file, const std::string& way_nodes_fil
 
           // Check for updated ref from relations.
           std::string ref;
-          auto iter = osmdata.way_ref.find(w.way_id());
-          if (iter != osmdata.way_ref.end()) {
-            if (w.ref_index() != 0)
-              ref = GraphBuilder::GetRef(osmdata.ref_offset_map.name(w.ref_index()),iter->second);
+          if (w.ref_index() != 0) {
+            auto relation_ref = osmdata.way_ref.get(w.way_id());
+            if (!relation_ref.empty())
+              ref = GraphBuilder::GetRef(osmdata.ref_offset_map.view(w.ref_index()),relation_ref);
           }
 
           // Get the shape for the edge and compute its length
@@ -859,7 +859,8 @@ void GraphBuilder::Build(const boost::property_tree::ptree& pt, const OSMData& o
   );
 
   // Line up the nodes and then re-map the edges that the edges to them
-  auto tiles = SortGraph(nodes_file, edges_file, tile_hierarchy, level);
+  auto tiles = SortGraph(nodes_file, edges_file, tile_hierarchy, level, threads,
+                         pt.get<size_t>("mjolnir.sort_memory", kSortMemory));
 
   // Reclassify links (ramps). Cannot do this when building tiles since the
   // edge list needs to be modified
@@ -895,7 +896,7 @@ void GraphBuilder::Build(const boost::property_tree::ptree& pt, const OSMData& o
 
 
 // Get highway refs from relations
-std::string GraphBuilder::GetRef(const std::string& way_ref, const std::string& relation_ref) {
+std::string GraphBuilder::GetRef(const boost::string_ref& way_ref, const std::string& relation_ref) {
   bool found = false;
   std::string refs;
   std::vector<std::string> way_refs = GetTagTokens(way_ref); // US 51;I 57
@@ -939,7 +940,7 @@ std::vector<SignInfo> GraphBuilder::CreateExitSignInfoList(
             osmdata.ref_offset_map.name(way.junction_ref_index()));
   }  else if (node.ref() && !fork) {
     exit_list.emplace_back(Sign::Type::kExitNumber,
-            osmdata.node_ref.find(node.osmid)->second);
+            osmdata.node_ref.get(node.osmid));
   }
 
   ////////////////////////////////////////////////////////////////////////////
@@ -951,7 +952,7 @@ std::vector<SignInfo> GraphBuilder::CreateExitSignInfoList(
   if (way.destination_ref_index() != 0) {
     has_branch = true;
     std::vector<std::string> branch_refs = GetTagTokens(
-        osmdata.ref_offset_map.name(way.destination_ref_index()));
+        osmdata.ref_offset_map.view(way.destination_ref_index()));
     for (auto& branch_ref : branch_refs) {
       exit_list.emplace_back(Sign::Type::kExitBranch, branch_ref);
     }
@@ -961,7 +962,7 @@ std::vector<SignInfo> GraphBuilder::CreateExitSignInfoList(
   if (way.destination_street_index() != 0) {
     has_branch = true;
     std::vector<std::string> branch_streets = GetTagTokens(
-        osmdata.name_offset_map.name(way.destination_street_index()));
+        osmdata.name_offset_map.view(way.destination_street_index()));
     for (auto& branch_street : branch_streets) {
       exit_list.emplace_back(Sign::Type::kExitBranch, branch_street);
     }
@@ -976,7 +977,7 @@ std::vector<SignInfo> GraphBuilder::CreateExitSignInfoList(
   if (way.destination_ref_to_index() != 0) {
     has_toward = true;
     std::vector<std::string> toward_refs = GetTagTokens(
-        osmdata.ref_offset_map.name(way.destination_ref_to_index()));
+        osmdata.ref_offset_map.view(way.destination_ref_to_index()));
     for (auto& toward_ref : toward_refs) {
       exit_list.emplace_back(Sign::Type::kExitToward, toward_ref);
     }
@@ -986,7 +987,7 @@ std::vector<SignInfo> GraphBuilder::CreateExitSignInfoList(
   if (way.destination_street_to_index() != 0) {
     has_toward = true;
     std::vector<std::string> toward_streets = GetTagTokens(
-        osmdata.name_offset_map.name(way.destination_street_to_index()));
+        osmdata.name_offset_map.view(way.destination_street_to_index()));
     for (auto& toward_street : toward_streets) {
       exit_list.emplace_back(Sign::Type::kExitToward, toward_street);
     }
@@ -996,7 +997,7 @@ std::vector<SignInfo> GraphBuilder::CreateExitSignInfoList(
   if (way.destination_index() != 0) {
     has_toward = true;
     std::vector<std::string> toward_names = GetTagTokens(
-        osmdata.name_offset_map.name(way.destination_index()));
+        osmdata.name_offset_map.view(way.destination_index()));
     for (auto& toward_name : toward_names) {
       exit_list.emplace_back(Sign::Type::kExitToward, toward_name);
     }
@@ -1009,7 +1010,7 @@ std::vector<SignInfo> GraphBuilder::CreateExitSignInfoList(
       std::string tmp;
       std::size_t pos;
       std::vector<std::string> exit_tos = GetTagTokens(
-          osmdata.node_exit_to.find(node.osmid)->second);
+          osmdata.node_exit_to.get(node.osmid));
       for (auto& exit_to : exit_tos) {
 
         tmp = exit_to;
@@ -1065,7 +1066,7 @@ std::vector<SignInfo> GraphBuilder::CreateExitSignInfoList(
   // Exit sign name
   if (node.name() && !fork) {
     std::vector<std::string> names = GetTagTokens(
-            osmdata.node_name.find(node.osmid)->second);
+            osmdata.node_name.get(node.osmid));
     for (auto& name : names) {
       exit_list.emplace_back(Sign::Type::kExitName, name);
     }
@@ -0,0 +1,1228 @@
+#include "mjolnir/graphtagtransform.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <boost/format.hpp>
+#include <valhalla/midgard/logging.h>
+
+using namespace valhalla::mjolnir;
+
+// This is a line for line port of lua/graph.lua, if you change one change the other. The
+// test/graphtagtransform test runs both over the test data to make sure they agree. Lua
+// values are nil, strings or numbers so in here nil is nullptr (or kNil for the tables of
+// numbers) and numbers are turned into strings the same way lua does when they are stored
+namespace {
+
+using StringTable = std::unordered_map<std::string, const char*>;
+using NumberTable = std::unordered_map<std::string, int>;
+
+// Lookups of things that arent in a table of numbers
+constexpr int kNil = -1;
+
+const char* T = "true";
+const char* F = "false";
+
+//the modes a highway type allows
+struct Modes {
+  const char* auto_forward;
+  const char* truck_forward;
+  const char* bus_forward;
+  const char* pedestrian;
+  const char* bike_forward;
+};
+
+const std::unordered_map<std::string, Modes> highway = {
+  {"motorway",         {T, T, T, F, F}},
+  {"motorway_link",    {T, T, T, F, F}},
+  {"trunk",            {T, T, T, T, T}},
+  {"trunk_link",       {T, T, T, T, T}},
+  {"primary",          {T, T, T, T, T}},
+  {"primary_link",     {T, T, T, T, T}},
+  {"secondary",        {T, T, T, T, T}},
+  {"secondary_link",   {T, T, T, T, T}},
+  {"residential",      {T, T, T, T, T}},
+  {"residential_link", {T, T, T, T, T}},
+  {"service",          {T, T, T, T, T}},
+  {"tertiary",         {T, T, T, T, T}},
+  {"tertiary_link",    {T, T, T, T, T}},
+  {"road",             {T, T, T, T, T}},
+  {"track",            {T, T, T, T, T}},
+  {"unclassified",     {T, T, T, T, T}},
+  {"undefined",        {F, F, F, F, F}},
+  {"unknown",          {F, F, F, F, F}},
+  {"living_street",    {T, T, T, T, T}},
+  {"footway",          {F, F, F, T, F}},
+  {"pedestrian",       {F, F, F, T, F}},
+  {"steps",            {F, F, F, T, T}},
+  {"bridleway",        {F, F, F, F, F}},
+  {"construction",     {F, F, F, F, F}},
+  {"cycleway",         {F, F, F, F, T}},
+  {"path",             {F, F, F, T, T}},
+  {"bus_guideway",     {F, F, T, F, F}},
+};
+
+const NumberTable road_class = {
+  {"motorway", 0}, {"motorway_link", 0}, {"trunk", 1}, {"trunk_link", 1}, {"primary", 2},
+  {"primary_link", 2}, {"secondary", 3}, {"secondary_link", 3}, {"tertiary", 4},
+  {"tertiary_link", 4}, {"unclassified", 5}, {"residential", 6}, {"residential_link", 6},
+};
+
+const NumberTable restriction = {
+  {"no_left_turn", 0}, {"no_right_turn", 1}, {"no_straight_on", 2}, {"no_u_turn", 3},
+  {"only_right_turn", 4}, {"only_left_turn", 5}, {"only_straight_on", 6}, {"no_entry", 7},
+  {"no_exit", 8}, {"no_turn", 9},
+};
+
+const NumberTable dow = {
+  {"Sunday", 1}, {"sunday", 1}, {"Sun", 1}, {"sun", 1}, {"Su", 1}, {"su", 1},
+  {"Monday", 2}, {"monday", 2}, {"Mon", 2}, {"mon", 2}, {"Mo", 2}, {"mo", 2},
+  {"Tuesday", 3}, {"tuesday", 3}, {"Tues", 3}, {"tues", 3}, {"Tue", 3}, {"tue", 3}, {"Tu", 3}, {"tu", 3},
+  {"Wednesday", 4}, {"wednesday", 4}, {"Weds", 4}, {"weds", 4}, {"Wed", 4}, {"wed", 4}, {"We", 4}, {"we", 4},
+  {"Thursday", 5}, {"thursday", 5}, {"Thurs", 5}, {"thurs", 5}, {"Thur", 5}, {"thur", 5}, {"Th", 5}, {"th", 5},
+  {"Friday", 6}, {"friday", 6}, {"Fri", 6}, {"fri", 6}, {"Fr", 6}, {"fr", 6},
+  {"Saturday", 7}, {"saturday", 7}, {"Sat", 7}, {"sat", 7}, {"Sa", 7}, {"sa", 7},
+};
+
+//indexed by road class, the default speed for tracks is lowered later
+const int default_speed[] = { 105, 90, 75, 60, 50, 40, 30, 20 };
+
+const StringTable access = {
+  {"yes", T}, {"private", T}, {"no", F}, {"permissive", T}, {"agricultural", F},
+  {"use_sidepath", T}, {"delivery", T}, {"designated", T}, {"dismount", T},
+  {"discouraged", F}, {"forestry", F}, {"destination", T}, {"customers", T},
+  {"official", F}, {"public", T}, {"restricted", T}, {"allowed", T}, {"emergency", F},
+};
+
+const StringTable private_access = {
+  {"private", T}, {"delivery", T},
+};
+
+const StringTable no_thru_traffic = {
+  {"destination", T}, {"customers", T}, {"delivery", T},
+};
+
+const NumberTable use = {
+  {"driveway", 4}, {"alley", 5}, {"parking_aisle", 6}, {"emergency_access", 7}, {"drive-through", 8},
+};
+
+const StringTable motor_vehicle = {
+  {"yes", T}, {"private", T}, {"no", F}, {"permissive", T}, {"agricultural", F},
+  {"delivery", T}, {"designated", T}, {"discouraged", F}, {"forestry", F},
+  {"destination", T}, {"customers", T}, {"official", F}, {"public", T},
+  {"restricted", T}, {"allowed", T},
+};
+
+const StringTable foot = {
+  {"yes", T}, {"private", T}, {"no", F}, {"permissive", T}, {"agricultural", F},
+  {"use_sidepath", T}, {"delivery", T}, {"designated", T}, {"discouraged", F},
+  {"forestry", F}, {"destination", T}, {"customers", T}, {"official", T},
+  {"public", T}, {"restricted", T}, {"crossing", T}, {"sidewalk", T}, {"allowed", T},
+  {"passable", T}, {"footway", T},
+};
+
+const StringTable wheelchair = {
+  {"no", F}, {"yes", T}, {"designated", T}, {"limited", T}, {"official", T},
+  {"destination", T}, {"public", T}, {"permissive", T}, {"only", T}, {"private", T},
+  {"impassable", F}, {"partial", F}, {"bad", F}, {"half", F}, {"assisted", T},
+};
+
+const StringTable bus = {
+  {"no", F}, {"yes", T}, {"designated", T}, {"urban", T}, {"permissive", T},
+  {"restricted", T}, {"destination", T}, {"delivery", F}, {"official", F},
+};
+
+const StringTable psv = {
+  {"bus", T}, {"no", F}, {"yes", T}, {"designated", T}, {"permissive", T}, {"1", T}, {"2", T},
+};
+
+const StringTable truck = {
+  {"designated", T}, {"yes", T}, {"no", F}, {"destination", T}, {"delivery", T},
+  {"local", T}, {"agricultural", F}, {"private", T}, {"discouraged", F},
+  {"permissive", F}, {"unsuitable", F}, {"agricultural;forestry", F}, {"official", F},
+  {"forestry", F}, {"destination;delivery", T},
+};
+
+const StringTable hazmat = {
+  {"designated", T}, {"yes", T}, {"no", F}, {"destination", T}, {"delivery", T},
+};
+
+const StringTable bicycle = {
+  {"yes", T}, {"designated", T}, {"use_sidepath", T}, {"no", F}, {"permissive", T},
+  {"destination", T}, {"dismount", T}, {"lane", T}, {"track", T}, {"shared", T},
+  {"shared_lane", T}, {"sidepath", T}, {"share_busway", T}, {"none", F}, {"allowed", T},
+  {"private", T}, {"official", T},
+};
+
+const StringTable cycleway = {
+  {"yes", T}, {"designated", T}, {"use_sidepath", T}, {"permissive", T},
+  {"destination", T}, {"dismount", T}, {"lane", T}, {"track", T}, {"shared", T},
+  {"shared_lane", T}, {"sidepath", T}, {"share_busway", T}, {"allowed", T},
+  {"private", T}, {"cyclestreet", T},
+};
+
+const StringTable bike_reverse = {
+  {"opposite", T}, {"opposite_lane", T}, {"opposite_track", T},
+};
+
+const StringTable bus_reverse = {
+  {"opposite", T}, {"opposite_lane", T},
+};
+
+const NumberTable shared = {
+  {"shared_lane", 1}, {"share_busway", 1}, {"shared", 1},
+};
+
+const NumberTable dedicated = {
+  {"opposite_track", 2}, {"track", 2},
+};
+
+const NumberTable separated = {
+  {"opposite_lane", 3}, {"lane", 3},
+};
+
+const StringTable oneway = {
+  {"no", F}, {"-1", T}, {"yes", T}, {"true", T}, {"1", T},
+};
+
+const StringTable bridge = {
+  {"yes", T}, {"no", F}, {"1", T},
+};
+
+const StringTable tunnel = {
+  {"yes", T}, {"no", F}, {"1", T}, {"building_passage", T},
+};
+
+const StringTable toll = {
+  {"yes", T}, {"no", F}, {"true", T}, {"false", F}, {"1", T}, {"interval", T}, {"snowmobile", T},
+};
+
+//the same as above but as bits of the access mask for nodes
+const NumberTable motor_vehicle_node = {
+  {"yes", 1}, {"private", 1}, {"no", 0}, {"permissive", 1}, {"agricultural", 0},
+  {"delivery", 1}, {"designated", 1}, {"discouraged", 0}, {"forestry", 0},
+  {"destination", 1}, {"customers", 1}, {"official", 0}, {"public", 1},
+  {"restricted", 1}, {"allowed", 1},
+};
+
+const NumberTable bicycle_node = {
+  {"yes", 4}, {"designated", 4}, {"use_sidepath", 4}, {"no", 0}, {"permissive", 4},
+  {"destination", 4}, {"dismount", 4}, {"lane", 4}, {"track", 4}, {"shared", 4},
+  {"shared_lane", 4}, {"sidepath", 4}, {"share_busway", 4}, {"none", 0}, {"allowed", 4},
+  {"private", 4}, {"official", 4},
+};
+
+const NumberTable foot_node = {
+  {"yes", 2}, {"private", 2}, {"no", 0}, {"permissive", 2}, {"agricultural", 0},
+  {"use_sidepath", 2}, {"delivery", 2}, {"designated", 2}, {"discouraged", 0},
+  {"forestry", 0}, {"destination", 2}, {"customers", 2}, {"official", 2},
+  {"public", 2}, {"restricted", 2}, {"crossing", 2}, {"sidewalk", 2}, {"allowed", 2},
+  {"passable", 2}, {"footway", 2},
+};
+
+const NumberTable wheelchair_node = {
+  {"no", 0}, {"yes", 256}, {"designated", 256}, {"limited", 256}, {"official", 256},
+  {"destination", 256}, {"public", 256}, {"permissive", 256}, {"only", 256},
+  {"private", 256}, {"impassable", 0}, {"partial", 0}, {"bad", 0}, {"half", 0},
+  {"assisted", 256},
+};
+
+const NumberTable bus_node = {
+  {"no", 0}, {"yes", 64}, {"designated", 64}, {"urban", 64}, {"permissive", 64},
+  {"restricted", 64}, {"destination", 64}, {"delivery", 0}, {"official", 0},
+};
+
+const NumberTable truck_node = {
+  {"designated", 8}, {"yes", 8}, {"no", 0}, {"destination", 8}, {"delivery", 8},
+  {"local", 8}, {"agricultural", 0}, {"private", 8}, {"discouraged", 0},
+  {"permissive", 0}, {"unsuitable", 0}, {"agricultural;forestry", 0}, {"official", 0},
+  {"forestry", 0}, {"destination;delivery", 8},
+};
+
+const NumberTable psv_node = {
+  {"bus", 64}, {"no", 0}, {"yes", 64}, {"designated", 64}, {"permissive", 64}, {"1", 64}, {"2", 64},
+};
+
+//the keys each of the procs look at, see lua/graph.lua
+const std::unordered_set<std::string> node_keys = {
+  "access", "impassable", "emergency", "service", "foot", "wheelchair", "bicycle", "hgv", "motorcar",
+  "motor_vehicle", "bus", "psv", "highway", "barrier", "bollard", "railway", "footway", "cycleway",
+  "pedestrian", "crossing", "payment:coins", "payment:notes", "toll", "toll:hgv", "toll:bicycle", "toll:hov",
+  "toll:motorcar", "toll:motor_vehicle", "toll:bus", "toll:motorcycle", "payment:cash", "fee",
+  "payment:e_zpass", "payment:e_zpass:name", "payment:pikepass", "payment:via_verde", "amenity", "shop",
+  "service:bicycle:rental", "traffic_signals:direction",
+  //passed through to the parser when they arent set, so they count too
+  "forward_signal", "backward_signal", "gate", "toll_booth", "border_control", "access_mask",
+  "exit_to", "ref", "name"
+};
+
+const std::unordered_set<std::string> way_keys = {
+  "highway", "route", "access", "emergency", "service", "impassable", "motorcar", "motor_vehicle", "hgv",
+  "bus", "psv", "lanes:psv:forward", "foot", "pedestrian", "bicycle", "cycleway", "bicycle_road",
+  "cyclestreet", "oneway", "oneway:bicycle", "bicycle:backward", "cycleway:left", "cycleway:right",
+  "oneway:bus", "bus:backward", "busway", "busway:left", "busway:right", "lanes:psv:backward", "junction",
+  "cycleway:both", "lanes:bus", "area", "railway", "footway", "name", "name:en", "alt_name", "official_name",
+  "ref", "int_ref", "unsigned_ref", "maxspeed", "maxspeed:backward", "maxspeed:forward", "wheelchair",
+  "tracktype", "lanes", "lanes:forward", "lanes:backward", "bridge", "seasonal", "hov", "hov:lanes",
+  "hov:minimum", "tunnel", "toll", "maxheight", "maxheight:physical", "maxwidth", "maxwidth:physical",
+  "maxlength", "maxweight", "maxaxleload", "hazmat", "hazmat:water", "hazmat:A", "hazmat:B", "hazmat:C",
+  "hazmat:D", "hazmat:E", "maxspeed:hgv", "hgv:national_network", "hgv:state_network", "ncn_ref", "rcn_ref",
+  "lcn_ref", "ncn", "rcn", "lcn", "mtb", "truck_forward", "bike_backward", "bus_backward"
+};
+
+const std::unordered_set<std::string> relation_keys = {
+  "type", "restriction", "day_on", "day_off", "route", "network"
+};
+
+//the tags being transformed, reads and writes behave like they do on a lua table
+class KeyValues {
+ public:
+  KeyValues(Tags& tags): tags_(tags) {}
+
+  //kv[key]
+  const std::string* get(const std::string& key) const {
+    const auto found = tags_.find(key);
+    return found == tags_.end() ? nullptr : &found->second;
+  }
+  const char* operator[](const std::string& key) const {
+    const auto value = get(key);
+    return value ? value->c_str() : nullptr;
+  }
+
+  //kv[key] == value
+  bool is(const std::string& key, const char* value) const {
+    const auto current = get(key);
+    return current && *current == value;
+  }
+
+  //kv[key] = value, nil removes it
+  void set(const std::string& key, const char* value) {
+    if (value == nullptr)
+      tags_.erase(key);
+    else
+      tags_[key] = std::string(value);
+  }
+
+  //numbers are stored how lua turns them into strings
+  void set(const std::string& key, const double value) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.14g", value);
+    tags_[key] = buffer;
+  }
+  void set(const std::string& key, const int value) {
+    if (value == kNil)
+      tags_.erase(key);
+    else
+      set(key, static_cast<double>(value));
+  }
+
+ protected:
+  Tags& tags_;
+};
+
+//table[key] where a nil key is nil
+const char* lookup(const StringTable& table, const std::string* key) {
+  if (key == nullptr)
+    return nullptr;
+  const auto found = table.find(*key);
+  return found == table.end() ? nullptr : found->second;
+}
+int lookup(const NumberTable& table, const std::string* key) {
+  if (key == nullptr)
+    return kNil;
+  const auto found = table.find(*key);
+  return found == table.end() ? kNil : found->second;
+}
+
+//a or b or c...
+const char* any(const char* value) {
+  return value;
+}
+template <class... rest_t>
+const char* any(const char* value, rest_t... rest) {
+  return value ? value : any(rest...);
+}
+int any(const int value) {
+  return value;
+}
+template <class... rest_t>
+int any(const int value, rest_t... rest) {
+  return value != kNil ? value : any(rest...);
+}
+
+const char* tostring(const bool value) {
+  return value ? T : F;
+}
+
+bool ends_with(const std::string& str, const char* suffix) {
+  const size_t size = strlen(suffix);
+  return str.size() >= size && str.compare(str.size() - size, size, suffix) == 0;
+}
+
+//what lua gets when it concatenates or tostrings a number
+std::string number_string(const double value) {
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.14g", value);
+  return buffer;
+}
+
+//tonumber on a string of digits and dots, false if its not a number (ie 1.2.3)
+bool to_number(const std::string& str, double& number) {
+  if (str.empty())
+    return false;
+  char* end = nullptr;
+  number = strtod(str.c_str(), &end);
+  return end == str.c_str() + str.size();
+}
+
+double round(const double value, const int n) {
+  const double scale = pow(10, n);
+  return floor((value * scale) + 0.5) / scale;
+}
+
+//convert the numeric (non negative) number portion at the beginning of the string
+bool numeric_prefix(const std::string* num_str, const bool allow_decimals, double& number) {
+  //not a string
+  if (num_str == nullptr)
+    return false;
+
+  //find where the numbers stop
+  size_t index = 0;
+  for (const char c : *num_str) {
+    if (!isdigit(static_cast<unsigned char>(c))) {
+      if (c == '.') {
+        if (!allow_decimals)
+          break;
+      }
+      else
+        break;
+    }
+    ++index;
+  }
+
+  //there weren't any numbers
+  if (index == 0)
+    return false;
+
+  //convert number portion of string to actual numeric type
+  return to_number(num_str->substr(0, index), number);
+}
+
+//removes all the whitespace like gsub("%s+", "")
+std::string strip_spaces(const std::string& str) {
+  std::string result;
+  for (const char c : str)
+    if (!isspace(static_cast<unsigned char>(c)))
+      result.push_back(c);
+  return result;
+}
+
+//the number of characters before the first digit
+size_t leading_non_digits(const std::string& str) {
+  size_t index = 0;
+  for (const char c : str) {
+    if (isdigit(static_cast<unsigned char>(c)))
+      break;
+    ++index;
+  }
+  return index;
+}
+
+//normalize a speed value
+bool normalize_speed(const std::string* speed, double& number) {
+  //grab the number prefix
+  if (!numeric_prefix(speed, false, number))
+    return false;
+
+  //check if the rest of the string ends in "mph" convert to kph
+  if (ends_with(*speed, "mph"))
+    number = number * 1.609344;
+
+  //if num > 150kph or num < 10kph....toss
+  return !(number > 150 || number < 10);
+}
+
+bool normalize_weight(const std::string* weight, double& number) {
+  if (weight == nullptr)
+    return false;
+
+  const std::string w = strip_spaces(*weight);
+  //grab the number prefix
+  if (!numeric_prefix(&w, true, number))
+    return false;
+  const std::string num = number_string(number);
+
+  if (ends_with(w, "t") || ends_with(w, "tonne") || ends_with(w, "tonnes")) {
+    if (num + "t" == w || num + "tonne" == w || num + "tonnes" == w) {
+      number = round(number, 2);
+      return true;
+    }
+  }
+
+  if (ends_with(w, "ton") || ends_with(w, "tons")) {
+    if (num + "ton" == w || num + "tons" == w) {
+      number = round(number, 2);
+      return true;
+    }
+  }
+
+  if (ends_with(w, "lb") || ends_with(w, "lbs")) {
+    if (num + "lb" == w || num + "lbs" == w) {
+      number = round(number / 2000, 2); // convert to tons
+      return true;
+    }
+  }
+
+  if (ends_with(w, "kg")) {
+    if (num + "kg" == w) {
+      number = round(number / 1000, 2);
+      return true;
+    }
+  }
+
+  number = round(number, 2); //3.5
+  return true;
+}
+
+bool normalize_measurement(const std::string* measurement, double& number) {
+  if (measurement == nullptr)
+    return false;
+
+  std::string m = strip_spaces(*measurement);
+  //7'6" or 7ft6in
+  //7m
+  //7
+  //grab the number prefix
+  if (!numeric_prefix(&m, true, number))
+    return false;
+  const std::string num = number_string(number);
+
+  if (ends_with(m, "m") || ends_with(m, "meter") || ends_with(m, "meters")) {
+    if (num + "m" == m || num + "meter" == m || num + "meters" == m) {
+      number = round(number, 2);
+      return true;
+    }
+  }
+
+  //whatever comes after the feet in the original string, past anything that isnt a digit
+  auto after_feet = [&measurement, &num]() {
+    const std::string rest = num.size() < measurement->size() ? measurement->substr(num.size()) : "";
+    return rest.substr(std::min(leading_non_digits(rest), rest.size()));
+  };
+
+  if (ends_with(m, "in") || ends_with(m, "\"") || ends_with(m, "inches") || ends_with(m, "inch")) {
+    //have to check for inches only
+    if (num + "in" == m || num + "\"" == m || num + "inches" == m || num + "inch" == m) {
+      number = round(number * 0.0254, 2);
+      return true;
+    }
+
+    const double feet = number;
+    m = after_feet();
+    double inches;
+    //lua cant do arithmetic on the missing inches and gives up on the whole object
+    if (!numeric_prefix(&m, true, inches))
+      throw std::runtime_error("attempt to perform arithmetic on local 'inches' (a nil value)");
+    number = round((feet * 0.3048) + (inches * 0.0254), 2);
+  }
+  else if (ends_with(m, "ft") || ends_with(m, "'") || ends_with(m, "feet")) {
+    number = round(number * 0.3048, 2);
+  }
+  else {
+    const double feet = number;
+    const std::string rest = num.size() < measurement->size() ? measurement->substr(num.size()) : "";
+    if (leading_non_digits(rest) != 0) {
+      //crappy data case.  7'6 or 7ft6
+      m = after_feet();
+      double inches;
+      if (numeric_prefix(&m, true, inches))
+        number = round((feet * 0.3048) + (inches * 0.0254), 2);
+      else
+        number = round(feet * 0.3048, 2);
+    }
+  }
+  number = round(number, 2);
+  return true;
+}
+
+//kv[key] = normalized value or nil
+template <class normalize_t>
+void set_normalized(KeyValues& kv, const std::string& key, const normalize_t& normalize, const std::string* value,
+                    const std::string* fallback = nullptr) {
+  double number;
+  if (normalize(value, number) || normalize(fallback, number))
+    kv.set(key, number);
+  else
+    kv.set(key, static_cast<const char*>(nullptr));
+}
+
+//kv[a], kv[b] = kv[b], kv[a]
+void swap(KeyValues& kv, const std::string& a, const std::string& b) {
+  const auto first = kv.get(a);
+  const auto second = kv.get(b);
+  const std::string first_value = first ? *first : "", second_value = second ? *second : "";
+  kv.set(a, second ? second_value.c_str() : nullptr);
+  kv.set(b, first ? first_value.c_str() : nullptr);
+}
+
+//numeric_prefix(kv[key]) capped at 10 lanes
+int lane_count(const KeyValues& kv, const std::string& key) {
+  double lanes;
+  if (!numeric_prefix(kv.get(key), false, lanes))
+    return kNil;
+  return lanes > 10 ? 10 : static_cast<int>(lanes);
+}
+
+//returns 1 if you should filter this way 0 otherwise
+int filter_tags_generic(KeyValues& kv) {
+
+  if (kv.is("highway", "construction") || kv.is("highway", "proposed"))
+    return 1;
+
+  //figure out what basic type of road it is
+  const auto highway_type = kv.get("highway") ? highway.find(*kv.get("highway")) : highway.end();
+  const bool forward = highway_type != highway.end();
+  const bool ferry = kv.is("route", "ferry");
+  const char* access_value = lookup(access, kv.get("access"));
+
+  kv.set("emergency_forward", F);
+  kv.set("emergency_backward", F);
+
+  if (ferry || kv["highway"]) {
+
+    if (kv.is("access", "emergency") || kv.is("emergency", "yes") || kv.is("service", "emergency_access")) {
+      kv.set("emergency_forward", T);
+      kv.set("emergency_tag", T);
+    }
+
+    if (kv.is("emergency", "no"))
+      kv.set("emergency_tag", F);
+  }
+
+  //shuts everything off
+  const bool impassable = kv.is("impassable", "yes") || (access_value && std::string(access_value) == F) ||
+    (kv.is("access", "private") && (kv.is("emergency", "yes") || kv.is("service", "emergency_access")));
+  auto shut_off = [&kv]() {
+    for (const auto key : { "auto_forward", "truck_forward", "bus_forward", "pedestrian", "bike_forward",
+                            "auto_backward", "truck_backward", "bus_backward", "bike_backward" })
+      kv.set(key, F);
+  };
+
+  if (forward) {
+    kv.set("auto_forward", highway_type->second.auto_forward);
+    kv.set("truck_forward", highway_type->second.truck_forward);
+    kv.set("bus_forward", highway_type->second.bus_forward);
+    kv.set("pedestrian", highway_type->second.pedestrian);
+    kv.set("bike_forward", highway_type->second.bike_forward);
+
+    if (impassable)
+      shut_off();
+
+    //check for auto_forward overrides
+    kv.set("auto_forward", any(lookup(motor_vehicle, kv.get("motorcar")), lookup(motor_vehicle, kv.get("motor_vehicle")), kv["auto_forward"]));
+    kv.set("auto_tag", any(lookup(motor_vehicle, kv.get("motorcar")), lookup(motor_vehicle, kv.get("motor_vehicle"))));
+
+    //check for truck_forward override
+    kv.set("truck_forward", any(lookup(truck, kv.get("hgv")), lookup(motor_vehicle, kv.get("motor_vehicle")), kv["truck_forward"]));
+    kv.set("truck_tag", any(lookup(truck, kv.get("hgv")), lookup(motor_vehicle, kv.get("motor_vehicle"))));
+
+    //check for bus_forward overrides
+    kv.set("bus_forward", any(lookup(bus, kv.get("bus")), lookup(psv, kv.get("psv")), lookup(psv, kv.get("lanes:psv:forward")),
+      lookup(motor_vehicle, kv.get("motor_vehicle")), kv["bus_forward"]));
+    kv.set("bus_tag", any(lookup(bus, kv.get("bus")), lookup(psv, kv.get("psv")), lookup(psv, kv.get("lanes:psv:forward")),
+      lookup(motor_vehicle, kv.get("motor_vehicle"))));
+
+    //check for ped overrides
+    kv.set("pedestrian", any(lookup(foot, kv.get("foot")), lookup(foot, kv.get("pedestrian")), kv["pedestrian"]));
+    kv.set("foot_tag", any(lookup(foot, kv.get("foot")), lookup(foot, kv.get("pedestrian"))));
+
+    //check for bike_forward overrides
+    kv.set("bike_forward", any(lookup(bicycle, kv.get("bicycle")), lookup(cycleway, kv.get("cycleway")),
+      lookup(bicycle, kv.get("bicycle_road")), lookup(bicycle, kv.get("cyclestreet")), kv["bike_forward"]));
+    kv.set("bike_tag", any(lookup(bicycle, kv.get("bicycle")), lookup(cycleway, kv.get("cycleway")),
+      lookup(bicycle, kv.get("bicycle_road")), lookup(bicycle, kv.get("cyclestreet"))));
+  }
+  else {
+    //if its a ferry and these tags dont show up we want to set them to true
+    const char* default_val = tostring(ferry);
+
+    if (impassable) {
+      shut_off();
+      default_val = F;
+    }
+
+    //check for auto_forward overrides
+    kv.set("auto_forward", any(lookup(motor_vehicle, kv.get("motorcar")), lookup(motor_vehicle, kv.get("motor_vehicle")), default_val));
+    kv.set("auto_tag", any(lookup(motor_vehicle, kv.get("motorcar")), lookup(motor_vehicle, kv.get("motor_vehicle"))));
+
+    //check for truck_forward override
+    kv.set("truck_forward", any(lookup(truck, kv.get("hgv")), kv["truck_forward"], lookup(motor_vehicle, kv.get("motor_vehicle")), default_val));
+    kv.set("truck_tag", any(lookup(truck, kv.get("hgv")), lookup(motor_vehicle, kv.get("motor_vehicle"))));
+
+    //check for bus_forward overrides
+    kv.set("bus_forward", any(lookup(bus, kv.get("bus")), lookup(psv, kv.get("psv")), lookup(psv, kv.get("lanes:psv:forward")),
+      lookup(motor_vehicle, kv.get("motor_vehicle")), default_val));
+    kv.set("bus_tag", any(lookup(bus, kv.get("bus")), lookup(psv, kv.get("psv")), lookup(psv, kv.get("lanes:psv:forward")),
+      lookup(motor_vehicle, kv.get("motor_vehicle"))));
+
+    //check for ped overrides
+    kv.set("pedestrian", any(lookup(foot, kv.get("foot")), lookup(foot, kv.get("pedestrian")), default_val));
+    kv.set("foot_tag", any(lookup(foot, kv.get("foot")), lookup(foot, kv.get("pedestrian"))));
+
+    //check for bike_forward overrides
+    kv.set("bike_forward", any(lookup(bicycle, kv.get("bicycle")), lookup(cycleway, kv.get("cycleway")),
+      lookup(bicycle, kv.get("bicycle_road")), lookup(bicycle, kv.get("cyclestreet")), default_val));
+    kv.set("bike_tag", any(lookup(bicycle, kv.get("bicycle")), lookup(cycleway, kv.get("cycleway")),
+      lookup(bicycle, kv.get("bicycle_road")), lookup(bicycle, kv.get("cyclestreet"))));
+  }
+
+  //TODO: handle Time conditional restrictions if available for HOVs with oneway = reversible
+  if ((kv.is("access", "permissive") || kv.is("access", "hov")) && kv.is("oneway", "reversible")) {
+    // for now enable only for buses if the tag exists and they are allowed.
+    if (kv.is("bus_forward", T)) {
+      kv.set("auto_forward", F);
+      kv.set("truck_forward", F);
+      kv.set("pedestrian", F);
+      kv.set("bike_forward", F);
+    }
+    else
+      return 1;
+  }
+
+  //service=driveway means all are routable
+  if (kv.is("service", "driveway") && kv["access"] == nullptr) {
+    kv.set("auto_forward", T);
+    kv.set("truck_forward", T);
+    kv.set("bus_forward", T);
+    kv.set("pedestrian", T);
+    kv.set("bike_forward", T);
+  }
+
+  //check the oneway-ness and traversability against the direction of the geom
+  if ((kv.is("oneway", "yes") && kv.is("oneway:bicycle", "no")) || kv.is("bicycle:backward", "yes") || kv.is("bicycle:backward", "no"))
+    kv.set("bike_backward", T);
+
+  if (kv["bike_backward"] == nullptr || kv.is("bike_backward", F)) {
+    kv.set("bike_backward", any(lookup(bike_reverse, kv.get("cycleway")), lookup(bike_reverse, kv.get("cycleway:left")),
+      lookup(bike_reverse, kv.get("cycleway:right")), F));
+  }
+
+  const char* oneway_bike = nullptr;
+  if (kv.is("bike_backward", T)) {
+    oneway_bike = lookup(oneway, kv.get("oneway:bicycle"));
+    if (oneway_bike == F && kv.is("bicycle:backward", "yes"))
+      oneway_bike = T;
+  }
+
+  if ((kv.is("oneway", "yes") && kv.is("oneway:bus", "no")) || kv.is("bus:backward", "yes") || kv.is("bus:backward", "designated"))
+    kv.set("bus_backward", T);
+
+  if (kv["bus_backward"] == nullptr || kv.is("bus_backward", F)) {
+    kv.set("bus_backward", any(lookup(bus_reverse, kv.get("busway")), lookup(bus_reverse, kv.get("busway:left")),
+      lookup(bus_reverse, kv.get("busway:right")), lookup(psv, kv.get("lanes:psv:backward")), F));
+  }
+
+  const char* oneway_bus = nullptr;
+  if (kv.is("bus_backward", T)) {
+    oneway_bus = lookup(oneway, kv.get("oneway:bus"));
+    if (oneway_bus == F && kv.is("bus:backward", "yes"))
+      oneway_bus = T;
+  }
+
+  const std::string oneway_reverse = kv["oneway"] ? kv["oneway"] : "";
+  const char* oneway_norm = lookup(oneway, kv.get("oneway"));
+  if (kv.is("junction", "roundabout")) {
+    oneway_norm = T;
+    kv.set("roundabout", T);
+  }
+  else
+    kv.set("roundabout", F);
+  kv.set("oneway", oneway_norm);
+  if (oneway_norm == T) {
+    kv.set("auto_backward", F);
+    kv.set("truck_backward", F);
+    kv.set("emergency_backward", F);
+
+    if (kv.is("bike_backward", T)) {
+      if (oneway_bike == T) //bike only in reverse on a bike path.
+        kv.set("bike_forward", F);
+      else if (oneway_bike == F) //bike in both directions on a bike path.
+        kv.set("bike_forward", T);
+    }
+    if (kv.is("bus_backward", T)) {
+      if (oneway_bus == T) //bus only in reverse on a bus path.
+        kv.set("bus_forward", F);
+      else if (oneway_bus == F) //bus in both directions on a bus path.
+        kv.set("bus_forward", T);
+    }
+  }
+  else {
+    kv.set("auto_backward", kv["auto_forward"]);
+    kv.set("truck_backward", kv["truck_forward"]);
+    kv.set("emergency_backward", kv["emergency_forward"]);
+
+    //lua compares the lookup with false which a string never is, so only a missing tag counts
+    if (kv.is("bike_backward", F) && kv["oneway:bicycle"] == nullptr)
+      kv.set("bike_backward", kv["bike_forward"]);
+
+    if (kv.is("bus_backward", F) && kv["oneway:bus"] == nullptr)
+      kv.set("bus_backward", kv["bus_forward"]);
+  }
+
+  //Bike forward / backward overrides.
+  auto lane = [&kv](const std::string& key) {
+    return lookup(shared, kv.get(key)) != kNil || lookup(separated, kv.get(key)) != kNil || lookup(dedicated, kv.get(key)) != kNil;
+  };
+  if (lane("cycleway:both") || (lane("cycleway:right") && lane("cycleway:left"))) {
+    kv.set("bike_forward", T);
+    kv.set("bike_backward", T);
+  }
+
+  if (kv.is("busway", "lane") || (kv.is("busway:left", "lane") && kv.is("busway:right", "lane"))) {
+    kv.set("bus_forward", T);
+    kv.set("bus_backward", T);
+  }
+
+  //flip the onewayness
+  if (oneway_reverse == "-1") {
+    swap(kv, "auto_forward", "auto_backward");
+    swap(kv, "truck_forward", "truck_backward");
+    swap(kv, "emergency_forward", "emergency_backward");
+    swap(kv, "bus_forward", "bus_backward");
+    swap(kv, "bike_forward", "bike_backward");
+  }
+
+  if (kv.is("oneway:bicycle", "-1"))
+    swap(kv, "bike_forward", "bike_backward");
+
+  if (kv.is("oneway:bus", "-1"))
+    swap(kv, "bus_forward", "bus_backward");
+
+  // bus only logic
+  if (kv.is("lanes:bus", "1")) {
+    kv.set("bus_forward", T);
+    kv.set("bus_backward", F);
+  }
+  else if (kv.is("lanes:bus", "2")) {
+    kv.set("bus_forward", T);
+    kv.set("bus_backward", T);
+  }
+
+  //if none of the modes were set we are done looking at this
+  bool none = true;
+  for (const auto key : { "auto_forward", "truck_forward", "bus_forward", "bike_forward", "emergency_forward",
+                          "auto_backward", "truck_backward", "bus_backward", "bike_backward", "emergency_backward",
+                          "pedestrian" })
+    none = none && kv.is(key, F);
+  if (none && !kv.is("highway", "bridleway")) //save bridleways for country access logic.
+    return 1;
+
+  //toss actual areas
+  if (kv.is("area", "yes"))
+    return 1;
+
+  for (const auto key : { "FIXME", "note", "source" })
+    kv.set(key, static_cast<const char*>(nullptr));
+
+  //set a few flags
+  int road_class_value = lookup(road_class, kv.get("highway"));
+
+  if (kv["highway"] == nullptr && ferry)
+    road_class_value = 2; //TODO:  can we weight based on ferry types?
+  else if (kv["highway"] == nullptr && kv["railway"])
+    road_class_value = 2; //TODO:  can we weight based on rail types?
+  else if (road_class_value == kNil) //service and other = 7
+    road_class_value = 7;
+
+  kv.set("road_class", road_class_value);
+
+  int speed = default_speed[road_class_value];
+
+  //lower the default speed for driveways
+  if (kv.is("service", "driveway"))
+    speed = static_cast<int>(floor(speed * 0.5));
+  kv.set("default_speed", speed);
+
+  int use_value = lookup(use, kv.get("service"));
+
+  if (kv["highway"]) {
+    if (kv.is("highway", "track"))
+      use_value = 3;
+    else if (kv.is("highway", "cycleway"))
+      use_value = 20;
+    else if (kv.is("pedestrian", F) && kv.is("auto_forward", F) && kv.is("auto_backward", F) &&
+             (kv.is("bike_forward", T) || kv.is("bike_backward", T)))
+      use_value = 20;
+    else if (kv.is("highway", "footway") && kv.is("footway", "sidewalk"))
+      use_value = 24;
+    else if (kv.is("highway", "footway"))
+      use_value = 25;
+    else if (kv.is("highway", "steps"))
+      use_value = 26; //steps/stairs
+    else if (kv.is("highway", "path"))
+      use_value = 27;
+    else if (kv.is("highway", "pedestrian"))
+      use_value = 28;
+    else if (kv.is("pedestrian", T) &&
+             kv.is("auto_forward", F) && kv.is("auto_backward", F) &&
+             kv.is("truck_forward", F) && kv.is("truck_backward", F) &&
+             kv.is("bus_forward", F) && kv.is("bus_backward", F) &&
+             kv.is("bike_forward", F) && kv.is("bike_backward", F))
+      use_value = 28;
+    else if (kv.is("highway", "bridleway"))
+      use_value = 29;
+  }
+
+  if (use_value == kNil && kv["service"])
+    use_value = 40; //other
+  else if (use_value == kNil)
+    use_value = 0; //general road, no special use
+
+  if (kv.is("access", "emergency") || kv.is("emergency", "yes"))
+    use_value = 7;
+
+  kv.set("use", use_value);
+
+  auto cycle_lane_type = [&kv](const std::string& key) {
+    return any(lookup(shared, kv.get(key)), lookup(separated, kv.get(key)), lookup(dedicated, kv.get(key)), 0);
+  };
+  int cycle_lane = cycle_lane_type("cycleway");
+  if (cycle_lane == 0) {
+    cycle_lane = cycle_lane_type("cycleway:right");
+    if (cycle_lane == 0)
+      cycle_lane = cycle_lane_type("cycleway:left");
+  }
+
+  kv.set("cycle_lane", cycle_lane);
+
+  if (kv["highway"] && kv.get("highway")->find("_link") != std::string::npos) //*_link
+    kv.set("link", T);  //do we need to add more?  turnlane?
+
+  kv.set("private", any(lookup(private_access, kv.get("access")), lookup(private_access, kv.get("motor_vehicle")), F));
+  kv.set("no_thru_traffic", any(lookup(no_thru_traffic, kv.get("access")), F));
+  kv.set("ferry", tostring(ferry));
+  kv.set("rail", tostring(kv.is("auto_forward", T) && kv.is("railway", "rail")));
+  set_normalized(kv, "speed", normalize_speed, kv.get("maxspeed"));
+  set_normalized(kv, "backward_speed", normalize_speed, kv.get("maxspeed:backward"));
+  set_normalized(kv, "forward_speed", normalize_speed, kv.get("maxspeed:forward"));
+  kv.set("wheelchair", lookup(wheelchair, kv.get("wheelchair")));
+
+  //lower the default speed for tracks
+  if (kv.is("highway", "track")) {
+    kv.set("default_speed", 5);
+    if (kv.is("tracktype", "grade1"))
+      kv.set("default_speed", 20);
+    else if (kv.is("tracktype", "grade2"))
+      kv.set("default_speed", 15);
+    else if (kv.is("tracktype", "grade3"))
+      kv.set("default_speed", 12);
+    else if (kv.is("tracktype", "grade4"))
+      kv.set("default_speed", 10);
+  }
+
+  //use unsigned_ref if all the conditions are met.
+  if ((kv["name"] == nullptr && kv["name:en"] == nullptr && kv["alt_name"] == nullptr && kv["official_name"] == nullptr &&
+       kv["ref"] == nullptr && kv["int_ref"] == nullptr) &&
+      (kv.is("highway", "motorway") || kv.is("highway", "trunk") || kv.is("highway", "primary")) && kv["unsigned_ref"])
+    kv.set("ref", kv["unsigned_ref"]);
+
+  kv.set("lanes", lane_count(kv, "lanes"));
+  kv.set("forward_lanes", lane_count(kv, "lanes:forward"));
+  kv.set("backward_lanes", lane_count(kv, "lanes:backward"));
+
+  kv.set("bridge", any(lookup(bridge, kv.get("bridge")), F));
+
+  // TODO access:conditional
+  if (kv["seasonal"] && !kv.is("seasonal", "no"))
+    kv.set("seasonal", T);
+
+  // TODO access
+  if ((kv["hov"] && !kv.is("hov", "no")) || kv["hov:lanes"] || kv["hov:minimum"])
+    kv.set("hov", T);
+
+  kv.set("tunnel", any(lookup(tunnel, kv.get("tunnel")), F));
+  kv.set("toll", any(lookup(toll, kv.get("toll")), F));
+
+  //truck goodies
+  set_normalized(kv, "maxheight", normalize_measurement, kv.get("maxheight"), kv.get("maxheight:physical"));
+  set_normalized(kv, "maxwidth", normalize_measurement, kv.get("maxwidth"), kv.get("maxwidth:physical"));
+  set_normalized(kv, "maxlength", normalize_measurement, kv.get("maxlength"));
+
+  set_normalized(kv, "maxweight", normalize_weight, kv.get("maxweight"));
+  set_normalized(kv, "maxaxleload", normalize_weight, kv.get("maxaxleload"));
+
+  //TODO: hazmat really should have subcategories
+  kv.set("hazmat", any(lookup(hazmat, kv.get("hazmat")), lookup(hazmat, kv.get("hazmat:water")), lookup(hazmat, kv.get("hazmat:A")),
+    lookup(hazmat, kv.get("hazmat:B")), lookup(hazmat, kv.get("hazmat:C")), lookup(hazmat, kv.get("hazmat:D")),
+    lookup(hazmat, kv.get("hazmat:E"))));
+  set_normalized(kv, "maxspeed:hgv", normalize_speed, kv.get("maxspeed:hgv"));
+
+  if (kv["hgv:national_network"] || kv["hgv:state_network"] || kv.is("hgv", "local") || kv.is("hgv", "designated"))
+    kv.set("truck_route", T);
+
+  const std::string* nref = kv.get("ncn_ref");
+  const std::string* rref = kv.get("rcn_ref");
+  const std::string* lref = kv.get("lcn_ref");
+  int bike_mask = 0;
+  if (nref || kv.is("ncn", "yes"))
+    bike_mask = 1;
+  if (rref || kv.is("rcn", "yes"))
+    bike_mask |= 2;
+  if (lref || kv.is("lcn", "yes"))
+    bike_mask |= 4;
+  if (kv.is("mtb", "yes"))
+    bike_mask |= 8;
+
+  const std::string national = nref ? *nref : "", regional = rref ? *rref : "", local = lref ? *lref : "";
+  kv.set("bike_national_ref", nref ? national.c_str() : nullptr);
+  kv.set("bike_regional_ref", rref ? regional.c_str() : nullptr);
+  kv.set("bike_local_ref", lref ? local.c_str() : nullptr);
+  kv.set("bike_network_mask", bike_mask);
+
+  return 0;
+}
+
+int nodes_proc(KeyValues& kv) {
+  //normalize a few tags that we care about
+  const char* access_value = any(lookup(access, kv.get("access")), T);
+
+  if (kv.is("impassable", "yes") || (kv.is("access", "private") && (kv.is("emergency", "yes") || kv.is("service", "emergency_access"))))
+    access_value = F;
+
+  int foot_tag = lookup(foot_node, kv.get("foot"));
+  int wheelchair_tag = lookup(wheelchair_node, kv.get("wheelchair"));
+  int bike_tag = lookup(bicycle_node, kv.get("bicycle"));
+  int truck_tag = lookup(truck_node, kv.get("hgv"));
+  int auto_tag = lookup(motor_vehicle_node, kv.get("motorcar"));
+  const int motor_vehicle_tag = lookup(motor_vehicle_node, kv.get("motor_vehicle"));
+  if (auto_tag == kNil)
+    auto_tag = motor_vehicle_tag;
+  int bus_tag = lookup(bus_node, kv.get("bus"));
+  if (bus_tag == kNil)
+    bus_tag = lookup(psv_node, kv.get("psv"));
+  //if bus was not set and car is
+  if (bus_tag == kNil && auto_tag == 1)
+    bus_tag = 64;
+
+  //if wheelchair was not set and foot is
+  if (wheelchair_tag == kNil && foot_tag == 1)
+    wheelchair_tag = 256;
+
+  //if truck was not set and car is
+  if (truck_tag == kNil && auto_tag == 1)
+    truck_tag = 8;
+
+  //must shut these off if motor_vehicle = 0
+  if (motor_vehicle_tag == 0) {
+    bus_tag = 0;
+    truck_tag = 0;
+  }
+
+  int emergency_tag = kNil;
+  if (kv.is("access", "emergency") || kv.is("emergency", "yes") || kv.is("service", "emergency_access"))
+    emergency_tag = 16;
+
+  //do not shut off bike access if there is a highway crossing.
+  if (bike_tag == 0 && kv.is("highway", "crossing"))
+    bike_tag = 4;
+
+  //if tag exists use it, otherwise access allowed for all modes unless access = false.
+  int auto_mask = any(auto_tag, 1);
+  int truck_mask = any(truck_tag, 8);
+  int bus_mask = any(bus_tag, 64);
+  int foot_mask = any(foot_tag, 2);
+  int wheelchair_mask = any(wheelchair_tag, 256);
+  int bike_mask = any(bike_tag, 4);
+  int emergency_mask = any(emergency_tag, 16);
+
+  //if access = false use tag if exists, otherwise no access for that mode.
+  if (access_value == F) {
+    auto_mask = any(auto_tag, 0);
+    truck_mask = any(truck_tag, 0);
+    bus_mask = any(bus_tag, 0);
+    foot_mask = any(foot_tag, 0);
+    wheelchair_mask = any(wheelchair_tag, 0);
+    bike_mask = any(bike_tag, 0);
+    emergency_mask = any(emergency_tag, 0);
+  }
+
+  //check for gates and bollards
+  bool gate = kv.is("barrier", "gate") || kv.is("barrier", "lift_gate");
+  bool bollard = false;
+  if (!gate) {
+    //if there was a bollard cars can't get through it
+    bollard = kv.is("barrier", "bollard") || kv.is("barrier", "block") || kv.is("bollard", "removable");
+
+    //save the following as gates.
+    if (bollard && kv.is("bollard", "rising")) {
+      gate = true;
+      bollard = false;
+    }
+
+    //bollard = true shuts off access unless the tag exists.
+    if (bollard) {
+      auto_mask = any(auto_tag, 0);
+      truck_mask = any(truck_tag, 0);
+      bus_mask = any(bus_tag, 0);
+      foot_mask = any(foot_tag, 2);
+      wheelchair_mask = any(wheelchair_tag, 256);
+      bike_mask = any(bike_tag, 4);
+      emergency_mask = any(emergency_tag, 0);
+    }
+  }
+
+  //the script allows access at crossings when nothing blocks it, but with nothing blocking
+  //and access = true the masks are already the ones it would set so theres nothing to do
+
+  //store the gate and bollard info
+  kv.set("gate", tostring(gate));
+  kv.set("bollard", tostring(bollard));
+
+  if (kv.is("barrier", "border_control"))
+    kv.set("border_control", T);
+  else if (kv.is("barrier", "toll_booth"))
+    kv.set("toll_booth", T);
+
+  const char* coins = any(lookup(toll, kv.get("payment:coins")), F);
+  const char* notes = any(lookup(toll, kv.get("payment:notes")), F);
+
+  //assume cash for toll, toll:*, and fee
+  const char* cash = any(lookup(toll, kv.get("toll")), lookup(toll, kv.get("toll:hgv")), lookup(toll, kv.get("toll:bicycle")),
+    lookup(toll, kv.get("toll:hov")), lookup(toll, kv.get("toll:motorcar")), lookup(toll, kv.get("toll:motor_vehicle")),
+    lookup(toll, kv.get("toll:bus")), lookup(toll, kv.get("toll:motorcycle")), lookup(toll, kv.get("payment:cash")),
+    lookup(toll, kv.get("fee")), F);
+
+  const char* etc = any(lookup(toll, kv.get("payment:e_zpass")), lookup(toll, kv.get("payment:e_zpass:name")),
+    lookup(toll, kv.get("payment:pikepass")), lookup(toll, kv.get("payment:via_verde")), F);
+
+  int cash_payment = 0;
+  if (cash == T || (coins == T && notes == T))
+    cash_payment = 3;
+  else if (coins == T)
+    cash_payment = 1;
+  else if (notes == T)
+    cash_payment = 2;
+
+  int etc_payment = 0;
+  if (etc == T)
+    etc_payment = 4;
+
+  //store a mask denoting payment type
+  kv.set("payment_mask", cash_payment | etc_payment);
+
+  if (kv.is("amenity", "bicycle_rental") || (kv.is("shop", "bicycle") && kv.is("service:bicycle:rental", "yes")))
+    kv.set("bicycle_rental", T);
+
+  if (kv.is("traffic_signals:direction", "forward"))
+    kv.set("forward_signal", T);
+
+  if (kv.is("traffic_signals:direction", "backward"))
+    kv.set("backward_signal", T);
+
+  //store a mask denoting access
+  kv.set("access_mask", auto_mask | emergency_mask | truck_mask | bike_mask | foot_mask | wheelchair_mask | bus_mask);
+
+  return 0;
+}
+
+int ways_proc(KeyValues& kv, const size_t nokeys) {
+  //if there were no tags passed in, ie keyvalues is empty
+  if (nokeys == 0)
+    return 1;
+
+  //does it at least have some interesting tags
+  return filter_tags_generic(kv);
+}
+
+int rels_proc(KeyValues& kv) {
+  if (kv.is("type", "route") || kv.is("type", "restriction")) {
+
+    const int restrict = lookup(restriction, kv.get("restriction"));
+
+    if (kv.is("type", "restriction")) {
+
+      if (restrict != kNil) {
+        kv.set("restriction", restrict);
+
+        if (kv["day_on"] || kv["day_off"]) {
+          kv.set("day_on", any(lookup(dow, kv.get("day_on")), 0));
+          kv.set("day_off", any(lookup(dow, kv.get("day_off")), 0));
+        }
+      }
+      else
+        return 1;
+      return 0;
+    }
+    else if (kv.is("route", "bicycle") || kv.is("route", "mtb")) {
+
+      int bike_mask = 0;
+
+      if (kv.is("network", "mtb") || kv.is("route", "mtb"))
+        bike_mask = 8;
+
+      if (kv.is("network", "ncn"))
+        bike_mask |= 1;
+      else if (kv.is("network", "rcn"))
+        bike_mask |= 2;
+      else if (kv.is("network", "lcn"))
+        bike_mask |= 4;
+
+      kv.set("bike_network_mask", bike_mask);
+
+      kv.set("day_on", kNil);
+      kv.set("day_off", kNil);
+      kv.set("restriction", kNil);
+
+      return 0;
+    }
+    //has a restiction but type is not restriction...ignore
+    else if (restrict != kNil)
+      return 1;
+    else {
+      kv.set("day_on", kNil);
+      kv.set("day_off", kNil);
+      kv.set("restriction", kNil);
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+}
+
+Tags GraphTagTransform::Transform(OSMType type, const Tags& tags) {
+  Tags kv(tags);
+  return Process(type, kv, tags.size());
+}
+
+Tags GraphTagTransform::Transform(OSMType type, const OSMPBF::TagView& tags) {
+  Tags kv = tags.to_tags();
+  return Process(type, kv, tags.size());
+}
+
+const std::unordered_set<std::string>* GraphTagTransform::Keys(OSMType type) const {
+  return type == OSMType::kNode ? &node_keys : (type == OSMType::kWay ? &way_keys : &relation_keys);
+}
+
+Tags GraphTagTransform::Process(OSMType type, Tags& tags, const size_t count) {
+  try {
+    KeyValues kv(tags);
+    int filter = type == OSMType::kNode ? nodes_proc(kv) :
+                 (type == OSMType::kWay ? ways_proc(kv, count) : rels_proc(kv));
+    if (filter)
+      tags.clear();
+    return std::move(tags);
+  }
+  catch(std::exception& e) {
+    LOG_ERROR((boost::format("Exception in graph tag transform: %1%") % e.what()).str());
+  }
+  return {};
+}
@@ -1,13 +1,50 @@
 #include "mjolnir/idtable.h"
+#include <algorithm>
 #include <stdexcept>
 
+namespace {
+
+// Each chunk covers this many bits worth of Ids
+constexpr uint64_t kChunkBits = 16;
+constexpr uint64_t kChunkMask = (static_cast<uint64_t>(1) << kChunkBits) - 1;
+// Words in a chunk once its a bitmap
+constexpr size_t kChunkWords = (static_cast<size_t>(1) << kChunkBits) / 64;
+// Past this many Ids the sorted list is bigger than the bitmap
+constexpr size_t kMaxSparseIds = kChunkWords * 64 / 16;
+
+// The concurrent table has smaller chunks since they are always bitmaps
+constexpr uint64_t kConcurrentChunkBits = 12;
+constexpr uint64_t kConcurrentChunkMask = (static_cast<uint64_t>(1) << kConcurrentChunkBits) - 1;
+constexpr size_t kConcurrentChunkWords = (static_cast<size_t>(1) << kConcurrentChunkBits) / 64;
+// Chunks in a page and pages in the table
+constexpr uint64_t kPageBits = 16;
+constexpr uint64_t kPageMask = (static_cast<uint64_t>(1) << kPageBits) - 1;
+constexpr size_t kPageChunks = static_cast<size_t>(1) << kPageBits;
+constexpr size_t kPages = static_cast<size_t>(1) << 14;
+
+// Gets what a slot points at, making it first if no other thread has yet
+template <class T>
+T* get_or_make(std::atomic<T*>& slot, const size_t count, std::atomic<size_t>& made_count) {
+  T* existing = slot.load(std::memory_order_acquire);
+  if (existing)
+    return existing;
+  T* made = new T[count]();
+  if (slot.compare_exchange_strong(existing, made, std::memory_order_acq_rel)) {
+    ++made_count;
+    return made;
+  }
+  // Someone beat us to it
+  delete[] made;
+  return existing;
+}
+
+}
+
 namespace valhalla {
 namespace mjolnir {
 
 // Constructor to create table of OSM Node IDs being used
-IdTable::IdTable(const uint64_t maxosmid): maxosmid_(maxosmid) {
-  // Create a vector to mark bits. Initialize to 0.
-  bitmarkers_.resize((maxosmid / 64) + 1, 0);
+IdTable::IdTable() {
 }
 
 // Destructor for NodeId table
@@ -15,17 +52,189 @@ IdTable::~IdTable() {
 }
 
 // Set an OSM Id within the node table
-void IdTable::set(const uint64_t id) {
-  // Test if the max is exceeded
-  if (id > maxosmid_) {
-    throw std::runtime_error("NodeIDTable - OSM Id exceeds max specified");
-  }
-  bitmarkers_[id / 64] |= static_cast<uint64_t>(1) << (id % static_cast<uint64_t>(64));
+bool IdTable::set(const uint64_t id) {
+  // Make room for the chunk if we've not seen one this far out
+  const uint64_t chunk = id >> kChunkBits;
+  if (chunk >= chunks_.size())
+    chunks_.resize(chunk + 1);
+  return chunks_[chunk].set(id & kChunkMask);
 }
 
 // Check if an OSM Id is used (in the Node table)
 const bool IdTable::IsUsed(const uint64_t id) const {
-  return bitmarkers_[id / 64] & (static_cast<uint64_t>(1) << (id % static_cast<uint64_t>(64)));
+  const uint64_t chunk = id >> kChunkBits;
+  return chunk < chunks_.size() && chunks_[chunk].IsUsed(id & kChunkMask);
+}
+
+// Check if any OSM Id in a range is used, a chunk at a time
+const bool IdTable::IsUsed(const uint64_t min_id, const uint64_t max_id) const {
+  // Nothing is set past the last chunk
+  if (min_id > max_id || chunks_.empty())
+    return false;
+  const uint64_t first = min_id >> kChunkBits;
+  const uint64_t last = std::min(max_id >> kChunkBits, static_cast<uint64_t>(chunks_.size() - 1));
+  for (uint64_t i = first; i <= last; ++i) {
+    // Only the chunks on the ends are partially in the range
+    const uint16_t lo = i == first ? min_id & kChunkMask : 0;
+    const uint16_t hi = i == (max_id >> kChunkBits) ? max_id & kChunkMask : kChunkMask;
+    if (chunks_[i].IsUsed(lo, hi))
+      return true;
+  }
+  return false;
+}
+
+// How much memory the chunks have allocated
+size_t IdTable::memory() const {
+  size_t bytes = chunks_.capacity() * sizeof(Chunk);
+  for (const auto& chunk : chunks_) {
+    bytes += chunk.ids.capacity() * sizeof(uint16_t);
+    if (chunk.bits)
+      bytes += kChunkWords * sizeof(uint64_t);
+  }
+  return bytes;
+}
+
+// Set an Id within the chunk, switching to a bitmap once the list gets too big
+bool IdTable::Chunk::set(const uint16_t id) {
+  if (!bits) {
+    auto pos = std::lower_bound(ids.begin(), ids.end(), id);
+    if (pos != ids.end() && *pos == id)
+      return true;
+    if (ids.size() < kMaxSparseIds) {
+      ids.insert(pos, id);
+      return false;
+    }
+    bits.reset(new uint64_t[kChunkWords]());
+    for (const auto i : ids)
+      bits[i / 64] |= static_cast<uint64_t>(1) << (i % 64);
+    std::vector<uint16_t>().swap(ids);
+  }
+  const uint64_t bit = static_cast<uint64_t>(1) << (id % 64);
+  const bool was_set = bits[id / 64] & bit;
+  bits[id / 64] |= bit;
+  return was_set;
+}
+
+// Check if an Id is used within the chunk
+bool IdTable::Chunk::IsUsed(const uint16_t id) const {
+  if (bits)
+    return bits[id / 64] & (static_cast<uint64_t>(1) << (id % 64));
+  return std::binary_search(ids.begin(), ids.end(), id);
+}
+
+// Check if any Id in a range is used within the chunk, a word at a time
+bool IdTable::Chunk::IsUsed(const uint16_t min_id, const uint16_t max_id) const {
+  // The first listed id that isn't below the range has to be in it
+  if (!bits) {
+    auto pos = std::lower_bound(ids.begin(), ids.end(), min_id);
+    return pos != ids.end() && *pos <= max_id;
+  }
+
+  // Mask off the bits before the first id and after the last id
+  const size_t first = min_id / 64;
+  const size_t last = max_id / 64;
+  const uint64_t first_mask = ~static_cast<uint64_t>(0) << (min_id % 64);
+  const uint64_t last_mask = ~static_cast<uint64_t>(0) >> (63 - (max_id % 64));
+  if (first == last)
+    return bits[first] & first_mask & last_mask;
+
+  // Check the partial words on the ends and the whole words in between
+  if ((bits[first] & first_mask) || (bits[last] & last_mask))
+    return true;
+  for (size_t i = first + 1; i < last; ++i) {
+    if (bits[i])
+      return true;
+  }
+  return false;
+}
+
+// Constructor to create table of OSM Node IDs being used, from any thread
+ConcurrentIdTable::ConcurrentIdTable()
+  : pages_(new std::atomic<ChunkPtr*>[kPages]()), page_count_(0), chunk_count_(0) {
+}
+
+// Destructor for the concurrent table
+ConcurrentIdTable::~ConcurrentIdTable() {
+  for (size_t i = 0; i < kPages; ++i) {
+    ChunkPtr* page = pages_[i].load();
+    if (!page)
+      continue;
+    for (size_t j = 0; j < kPageChunks; ++j)
+      delete[] page[j].load();
+    delete[] page;
+  }
+}
+
+// Set an OSM Id and say whether it already was
+bool ConcurrentIdTable::set(const uint64_t id) {
+  const uint64_t page = id >> (kConcurrentChunkBits + kPageBits);
+  if (page >= kPages)
+    throw std::runtime_error("ConcurrentIdTable - OSM Id exceeds max supported");
+
+  // Make the page and chunk if no one has yet
+  ChunkPtr* chunks = get_or_make(pages_[page], kPageChunks, page_count_);
+  Word* words = get_or_make(chunks[(id >> kConcurrentChunkBits) & kPageMask], kConcurrentChunkWords, chunk_count_);
+
+  // Only the order of the bits within a word matters, which fetch_or keeps
+  const uint64_t bit = id & kConcurrentChunkMask;
+  const uint64_t mask = static_cast<uint64_t>(1) << (bit % 64);
+  return words[bit / 64].fetch_or(mask, std::memory_order_relaxed) & mask;
+}
+
+// Check if an OSM Id is used
+const bool ConcurrentIdTable::IsUsed(const uint64_t id) const {
+  const Word* words = chunk(id);
+  const uint64_t bit = id & kConcurrentChunkMask;
+  return words && (words[bit / 64].load(std::memory_order_relaxed) & (static_cast<uint64_t>(1) << (bit % 64)));
+}
+
+// Check if any OSM Id in a range is used, a chunk at a time
+const bool ConcurrentIdTable::IsUsed(const uint64_t min_id, const uint64_t max_id) const {
+  if (min_id > max_id)
+    return false;
+  const uint64_t end = std::min(max_id >> kConcurrentChunkBits, static_cast<uint64_t>(kPages * kPageChunks - 1));
+  for (uint64_t i = min_id >> kConcurrentChunkBits; i <= end; ++i) {
+    // Skip the whole page if it was never made
+    const ChunkPtr* page = pages_[i >> kPageBits].load(std::memory_order_acquire);
+    if (!page) {
+      i |= kPageMask;
+      continue;
+    }
+    const Word* words = page[i & kPageMask].load(std::memory_order_acquire);
+    if (!words)
+      continue;
+
+    // Mask off the bits before the first id and after the last id
+    const uint64_t lo = i == (min_id >> kConcurrentChunkBits) ? min_id & kConcurrentChunkMask : 0;
+    const uint64_t hi = i == (max_id >> kConcurrentChunkBits) ? max_id & kConcurrentChunkMask : kConcurrentChunkMask;
+    for (uint64_t w = lo / 64; w <= hi / 64; ++w) {
+      uint64_t word = words[w].load(std::memory_order_relaxed);
+      if (w == lo / 64)
+        word &= ~static_cast<uint64_t>(0) << (lo % 64);
+      if (w == hi / 64)
+        word &= ~static_cast<uint64_t>(0) >> (63 - (hi % 64));
+      if (word)
+        return true;
+    }
+  }
+  return false;
+}
+
+// How much memory the pages and chunks have allocated
+size_t ConcurrentIdTable::memory() const {
+  return kPages * sizeof(std::atomic<ChunkPtr*>) + page_count_ * kPageChunks * sizeof(ChunkPtr) +
+         chunk_count_ * kConcurrentChunkWords * sizeof(Word);
+}
+
+// The chunk an Id is in or nullptr if nothing in it was set
+const ConcurrentIdTable::Word* ConcurrentIdTable::chunk(const uint64_t id) const {
+  const uint64_t page = id >> (kConcurrentChunkBits + kPageBits);
+  if (page >= kPages)
+    return nullptr;
+  const ChunkPtr* chunks = pages_[page].load(std::memory_order_acquire);
+  if (!chunks)
+    return nullptr;
+  return chunks[(id >> kConcurrentChunkBits) & kPageMask].load(std::memory_order_acquire);
 }
 
 }
@@ -1,7 +1,7 @@
 #include "mjolnir/luatagtransform.h"
 
+#include <algorithm>
 #include <stdexcept>
-#include <boost/format.hpp>
 #include <valhalla/midgard/logging.h>
 #include "mjolnir/osmdata.h"
 
@@ -13,13 +13,48 @@ const std::string LUA_NODE_PROC = "nodes_proc";
 const std::string LUA_WAY_PROC = "ways_proc";
 const std::string LUA_REL_PROC = "rels_proc";
 
+const std::string LUA_NODE_KEYS = "node_keys";
+const std::string LUA_WAY_KEYS = "way_keys";
+const std::string LUA_REL_KEYS = "relation_keys";
+
+// How many tags the reused input table has room for up front, graph.lua has
+// some 40 tags in its output and it writes them into the input table
+constexpr int kInputTableSize = 64;
+
+// How many distinct keys we keep in the registry, there are lots of keys out
+// there but most objects only use a few hundred of them
+constexpr size_t kMaxInternedKeys = 4096;
+
+//whether the values of the key are close to unique per object (names, refs, addresses etc).
+//tags with these are not worth caching, we'd likely never see the same set again
+bool Unique(const OSMPBF::StringView& key) {
+  static const std::vector<std::string> prefixes{"name", "addr:", "destination", "wiki", "source", "note"};
+  static const std::vector<std::string> suffixes{"name", "ref", "exit_to"};
+  static const std::vector<std::string> contains{"ref:", "name:", "_name", "_ref"};
+  for (const auto& prefix : prefixes)
+    if (key.starts_with(prefix))
+      return true;
+  for (const auto& suffix : suffixes)
+    if (key.ends_with(suffix))
+      return true;
+  for (const auto& part : contains)
+    if (key.find(part) != OSMPBF::StringView::npos)
+      return true;
+  return false;
+}
+
+//the name of the lua function to call for the type of osm object
+const std::string& get_func(OSMType type) {
+  return type == OSMType::kNode ? LUA_NODE_PROC :
+         (type == OSMType::kWay ? LUA_WAY_PROC : LUA_REL_PROC);
+}
+
 void CheckLuaFuncExists(lua_State* state, const std::string &func_name) {
 
   lua_getglobal(state, func_name.c_str());
 
   if (!lua_isfunction (state, -1)) {
-    throw std::runtime_error((boost::format("Lua script does not contain a function %1%.")
-    % func_name).str());
+    throw std::runtime_error("Lua script does not contain a function " + func_name + ".");
   }
   lua_pop(state,1);
 }
@@ -55,17 +90,50 @@ void stackdump_g(lua_State* l)
 
 }
 
-LuaTagTransform::LuaTagTransform(const std::string& lua)
+LuaTagTransform::LuaTagTransform(const std::string& lua, const size_t cache_size)
+  : cache_size_(cache_size), cache_hits_(0), cache_misses_(0)
 {
   //create a new lua state
   state_ = luaL_newstate();
   luaL_openlibs(state_);
+
+  //luajit is lua 5.1 which calls bit32 bit, the functions the scripts use are the same
+  lua_getglobal(state_, "bit32");
+  if (lua_isnil(state_, -1)) {
+    lua_getglobal(state_, "bit");
+    lua_setglobal(state_, "bit32");
+  }
+  lua_pop(state_, 1);
+
   luaL_dostring(state_, lua.c_str());
 
-  //check that various functions exist
-  CheckLuaFuncExists(state_, LUA_NODE_PROC);
-  CheckLuaFuncExists(state_, LUA_WAY_PROC);
-  CheckLuaFuncExists(state_, LUA_REL_PROC);
+  //check that various functions exist and hang on to them
+  for (const auto type : { OSMType::kNode, OSMType::kWay, OSMType::kRelation }) {
+    CheckLuaFuncExists(state_, get_func(type));
+    lua_getglobal(state_, get_func(type).c_str());
+    funcs_[static_cast<int>(type)] = luaL_ref(state_, LUA_REGISTRYINDEX);
+  }
+
+  //the keys it looks at if it tells us
+  for (const auto type : { OSMType::kNode, OSMType::kWay, OSMType::kRelation }) {
+    const auto& keys = type == OSMType::kNode ? LUA_NODE_KEYS :
+                       (type == OSMType::kWay ? LUA_WAY_KEYS : LUA_REL_KEYS);
+    lua_getglobal(state_, keys.c_str());
+    if (lua_istable(state_, -1)) {
+      read_keys_[static_cast<int>(type)].reset(new std::unordered_set<std::string>());
+      lua_pushnil(state_);
+      while (lua_next(state_, -2) != 0) {
+        if (lua_type(state_, -1) == LUA_TSTRING)
+          read_keys_[static_cast<int>(type)]->emplace(lua_tostring(state_, -1));
+        lua_pop(state_, 1);
+      }
+    }
+    lua_pop(state_, 1);
+  }
+
+  //the table we hand the tags to lua in
+  lua_createtable(state_, 0, kInputTableSize);
+  input_ = luaL_ref(state_, LUA_REGISTRYINDEX);
 }
 
 LuaTagTransform::~LuaTagTransform(){
@@ -75,75 +143,192 @@ LuaTagTransform::~LuaTagTransform(){
 
 Tags LuaTagTransform::Transform(OSMType type, const Tags &maptags) {
 
-  //grab the proper function out of the lua code
-  Tags result;
-  const std::string& lua_func = type == OSMType::kNode ? LUA_NODE_PROC :
-                                (type == OSMType::kWay ? LUA_WAY_PROC : LUA_REL_PROC);
+  //set up the lua table (map)
+  Prepare(type);
+  for (const auto& tag : maptags) {
+    PushKey(tag.first.data(), tag.first.size());
+    lua_pushlstring(state_, tag.second.data(), tag.second.size());
+    lua_rawset(state_, -3);
+  }
 
-  try {
-    //grab the function
-    lua_getglobal(state_, lua_func.c_str());
-
-    //set up the lua table (map)
-    int count = 0;
-    lua_newtable(state_);
-    for (const auto& tag : maptags) {
-      lua_pushstring(state_, tag.first.c_str());
-      lua_pushstring(state_, tag.second.c_str());
-      lua_rawset(state_, -3);
-      count++;
-    }
+  //tell lua how many items are in the map
+  lua_pushinteger(state_, maptags.size());
+  return Call(type);
+}
+
+Tags LuaTagTransform::Transform(OSMType type, const OSMPBF::TagView& tags) {
+  //no cache or tags that we probably wont see again go straight to lua
+  if (cache_size_ == 0 || !CacheKey(type, tags))
+    return Call(type, tags);
+
+  //we've done these exact tags before
+  const auto cached = cache_.find(key_);
+  if (cached != cache_.end()) {
+    ++cache_hits_;
+    return cached->second;
+  }
+
+  //do them and remember them, when its full we start over so it follows what the data looks like now
+  ++cache_misses_;
+  Tags result = Call(type, tags);
+  if (cache_.size() >= cache_size_)
+    cache_.clear();
+  cache_.emplace(key_, result);
+  return result;
+}
+
+const std::unordered_set<std::string>* LuaTagTransform::Keys(OSMType type) const {
+  return read_keys_[static_cast<int>(type)].get();
+}
+
+uint64_t LuaTagTransform::CacheHits() const {
+  return cache_hits_;
+}
+
+uint64_t LuaTagTransform::CacheMisses() const {
+  return cache_misses_;
+}
+
+void LuaTagTransform::ClearCacheStats() {
+  cache_hits_ = cache_misses_ = 0;
+}
+
+bool LuaTagTransform::CacheKey(OSMType type, const OSMPBF::TagView& tags) {
+  //sorted by key so the same tags in a different order are the same set
+  order_.resize(tags.size());
+  for (size_t i = 0; i < tags.size(); ++i) {
+    if (Unique(tags.key(i)))
+      return false;
+    order_[i] = i;
+  }
+  std::sort(order_.begin(), order_.end(), [&tags](const size_t a, const size_t b) {
+    return tags.key(a) < tags.key(b);
+  });
+
+  //the type and then each key and value, nulls cant show up in either
+  key_.assign(1, static_cast<char>(type));
+  for (const auto i : order_) {
+    const auto key = tags.key(i);
+    const auto value = tags.value(i);
+    key_.append(key.data(), key.size());
+    key_.push_back('\0');
+    key_.append(value.data(), value.size());
+    key_.push_back('\0');
+  }
+  return true;
+}
+
+Tags LuaTagTransform::Call(OSMType type, const OSMPBF::TagView& tags) {
+
+  //set up the lua table (map) straight from the string table of the block
+  Prepare(type);
+  for (size_t i = 0; i < tags.size(); ++i) {
+    const auto key = tags.key(i);
+    const auto value = tags.value(i);
+    PushKey(key.data(), key.size());
+    lua_pushlstring(state_, value.data(), value.size());
+    lua_rawset(state_, -3);
+  }
+
+  //tell lua how many items are in the map
+  lua_pushinteger(state_, tags.size());
+  return Call(type);
+}
+
+void LuaTagTransform::Prepare(OSMType type) {
+  lua_rawgeti(state_, LUA_REGISTRYINDEX, funcs_[static_cast<int>(type)]);
+  lua_rawgeti(state_, LUA_REGISTRYINDEX, input_);
+
+  //clear out what the last call left in it, clearing fields while traversing is allowed
+  lua_pushnil(state_);
+  while (lua_next(state_, -2) != 0) {
+    lua_pop(state_, 1);
+    lua_pushvalue(state_, -1);
+    lua_pushnil(state_);
+    lua_rawset(state_, -4);
+  }
+}
+
+void LuaTagTransform::PushKey(const char* key, const size_t size) {
+  //we've had this one before
+  scratch_.assign(key, size);
+  const auto interned = keys_.find(scratch_);
+  if (interned != keys_.end()) {
+    lua_rawgeti(state_, LUA_REGISTRYINDEX, interned->second);
+    return;
+  }
 
-    //tell lua how many items are in the map
-    lua_pushinteger(state_, count);
+  //remember it if theres still room
+  lua_pushlstring(state_, key, size);
+  if (keys_.size() < kMaxInternedKeys) {
+    lua_pushvalue(state_, -1);
+    keys_.emplace(scratch_, luaL_ref(state_, LUA_REGISTRYINDEX));
+  }
+}
 
+Tags LuaTagTransform::Call(OSMType type) {
+
+  const std::string& lua_func = get_func(type);
+  Tags result;
+  try {
     //call lua
     if (lua_pcall(state_, 2, type == OSMType::kWay ? 4 : 2, 0)) {
-      LOG_ERROR("Failed to execute lua function for basic tag processing.");
+      const char* error = lua_tostring(state_, -1);
+      LOG_ERROR("Failed to execute lua function " + lua_func + " for basic tag processing: " + (error ? error : ""));
+      lua_pop(state_, 1);
+      return result;
     }
 
-    //TODO:  if we dont care about it we stop looking.  Look for filter = 1
-    /*if(lua_tonumber(state, 1))
-      return result;*/
-
     //osm2pgsql has extra info for roads and polygons which we dont care about
     if(type == OSMType::kWay) {
       lua_pop(state_,1);
       lua_pop(state_,1);
     }
 
-    //pull out the keys and values into a map
+    //pull out an int which if its 1 means we dont care about this way/node
+    //in which case theres no point in reading the tags
+    if (lua_tointeger(state_, -2)) {
+      lua_pop(state_,2);
+      return result;
+    }
+
+    //pull out the keys and values into the buffer
+    size_t size = 0;
     lua_pushnil(state_);
     while (lua_next(state_,-2) != 0) {
-      const char* key = lua_tostring(state_,-2);
+      size_t key_size, value_size;
+      const char* key = lua_tolstring(state_,-2, &key_size);
       if (key == nullptr) {
-        LOG_ERROR((boost::format("Invalid key in Lua function: %1%.") % lua_func).str());
+        LOG_ERROR("Invalid key in Lua function: " + lua_func + ".");
+        lua_pop(state_,2);
         break;
       }
-      const char* value = lua_tostring(state_,-1);
+      const char* value = lua_tolstring(state_,-1, &value_size);
       if (value == nullptr) {
-        LOG_ERROR((boost::format("Invalid value in Lua function: %1%.") % lua_func).str());
+        LOG_ERROR("Invalid value in Lua function: " + lua_func + ".");
+        lua_pop(state_,2);
         break;
       }
-      result[key] = value;
+      if (size == output_.size())
+        output_.emplace_back();
+      output_[size].first.assign(key, key_size);
+      output_[size].second.assign(value, value_size);
+      ++size;
       lua_pop(state_,1);
     }
-
-    //pull out an int which if its 1 means we dont care about this way/node
-    int filter = lua_tointeger(state_, -2);
     lua_pop(state_,2);
 
-    if (filter)
-      result.clear();
+    //and from there into the map which we can size right up front
+    result.reserve(size);
+    result.insert(output_.begin(), output_.begin() + size);
   }
   catch(std::exception& e) {
     // ..gets sent back to the main thread
-    LOG_ERROR((boost::format("Exception in Lua function: %1%: %2%") % lua_func % e.what()).str());
+    LOG_ERROR("Exception in Lua function: " + lua_func + ": " + e.what());
   }
   catch(...){
-    LOG_ERROR((boost::format("Unknown exception in Lua function: %1%.") % lua_func).str());
+    LOG_ERROR("Unknown exception in Lua function: " + lua_func + ".");
   }
 
   return result;
 }
-
@@ -0,0 +1,95 @@
+#include "mjolnir/osmdata.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+#include <valhalla/midgard/logging.h>
+
+namespace valhalla {
+namespace mjolnir {
+
+// Set the string for an Id, there is nowhere to put it once spilled
+void OSMStringMap::set(const uint64_t id, const std::string& value) {
+  if (spilled_)
+    throw std::runtime_error("OSMStringMap - cannot set strings once spilled to a file");
+  strings_[id] = value;
+}
+
+// Get the number of strings from the map or the file
+size_t OSMStringMap::size() const {
+  return spilled_ ? spilled_count_ : strings_.size();
+}
+
+// Write the number of strings, their Ids in order, where each of their strings
+// start and then the strings to a file and read them out of it from then on
+void OSMStringMap::Spill(const std::string& file_name) {
+  if (spilled_)
+    return;
+  using value_type = std::unordered_map<uint64_t, std::string>::value_type;
+  std::vector<const value_type*> sorted;
+  sorted.reserve(strings_.size());
+  for (const auto& item : strings_)
+    sorted.push_back(&item);
+  std::sort(sorted.begin(), sorted.end(),
+    [](const value_type* a, const value_type* b) { return a->first < b->first; });
+
+  const uint64_t count = sorted.size();
+  uint64_t offset = 0;
+  {
+    std::ofstream file(file_name, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    for (const auto* item : sorted)
+      file.write(reinterpret_cast<const char*>(&item->first), sizeof(item->first));
+    for (const auto* item : sorted) {
+      file.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+      offset += item->second.size();
+    }
+    file.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+    for (const auto* item : sorted)
+      file.write(item->second.data(), item->second.size());
+    if (!file)
+      throw std::runtime_error("OSMStringMap - failed to write " + file_name);
+  }
+
+  // The mapping outlives the file so it can be removed right away
+  const size_t header = (count * 2 + 2) * sizeof(uint64_t);
+  spilled_.reset(new midgard::mem_map<char>());
+  spilled_->map(file_name, header + offset);
+  std::remove(file_name.c_str());
+  spilled_count_ = count;
+  spilled_ids_ = reinterpret_cast<const uint64_t*>(spilled_->get()) + 1;
+  spilled_offsets_ = spilled_ids_ + count;
+  spilled_strings_ = spilled_->get() + header;
+
+  // Let go of the memory rather than just emptying it
+  std::unordered_map<uint64_t, std::string>().swap(strings_);
+}
+
+// Get the string for an Id, searching the sorted Ids if they were spilled
+std::string OSMStringMap::get(const uint64_t id) const {
+  if (spilled_) {
+    const uint64_t* found = std::lower_bound(spilled_ids_, spilled_ids_ + spilled_count_, id);
+    if (found == spilled_ids_ + spilled_count_ || *found != id)
+      return "";
+    const size_t i = found - spilled_ids_;
+    return std::string(spilled_strings_ + spilled_offsets_[i], spilled_offsets_[i + 1] - spilled_offsets_[i]);
+  }
+  auto found = strings_.find(id);
+  return found == strings_.end() ? "" : found->second;
+}
+
+// Spill all of the string maps and names
+void OSMData::SpillStrings(const std::string& prefix) {
+  node_ref.Spill(prefix + "node_ref.bin");
+  node_exit_to.Spill(prefix + "node_exit_to.bin");
+  node_name.Spill(prefix + "node_name.bin");
+  way_ref.Spill(prefix + "way_ref.bin");
+  ref_offset_map.Spill(prefix + "refs.bin");
+  name_offset_map.Spill(prefix + "names.bin");
+  LOG_INFO("Moved names and refs out to memory mapped files");
+}
+
+}
+}
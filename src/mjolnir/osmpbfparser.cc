@@ -29,11 +29,38 @@
 // there have been some minor changes for our own purposes but its largely the same
 #include <cstdint>
 #include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
 #include <zlib.h>
 #include <vector>
+#include <deque>
+#include <list>
+#include <limits>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
 #include <unordered_map>
 
+#include "config.h"
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
 #include "mjolnir/osmpbfparser.h"
+#include "mjolnir/densenodes.h"
+#include "mjolnir/wiredecoder.h"
 #include <valhalla/midgard/logging.h>
 
 using namespace OSMPBF;
@@ -73,75 +100,1188 @@ BlobHeader read_header(char* buffer, std::ifstream& file, bool& finished) {
   return result;
 }
 
-int32_t read_blob(char* buffer, char* unpack_buffer, std::ifstream& file, const BlobHeader & header) {
-  Blob blob;
-
+int32_t read_blob(std::vector<char>& buffer, std::ifstream& file, const BlobHeader & header) {
   //is the size of the following blob sane
   int32_t sz = header.datasize();
-  if (sz > MAX_UNCOMPRESSED_BLOB_SIZE)
+  if (sz < 0 || sz > MAX_UNCOMPRESSED_BLOB_SIZE)
     throw std::runtime_error("blob-size is bigger than allowed");
 
   //pull out the bytes
-  if (!file.read(buffer, sz))
+  if (buffer.size() < static_cast<size_t>(sz))
+    buffer.resize(sz);
+  if (!file.read(buffer.data(), sz))
     throw std::runtime_error("unable to read blob from file");
+  return sz;
+}
+
+#ifdef HAVE_ZSTD
+//one decompression context per thread so we dont make a new one for every blob
+ZSTD_DCtx* zstd_context() {
+  thread_local std::unique_ptr<ZSTD_DCtx, size_t(*)(ZSTD_DCtx*)> context(ZSTD_createDCtx(), ZSTD_freeDCtx);
+  if (!context)
+    throw std::runtime_error("failed to init zstd context");
+  return context.get();
+}
+#endif
+
+int32_t unpack_blob(const char* buffer, int32_t sz, std::vector<char>& unpack_buffer) {
+  //find the data without copying it out
+  BlobData blob = decode_blob(buffer, sz);
 
-  //turn it into a protobuf object
-  if (!blob.ParseFromArray(buffer, sz))
-    throw std::runtime_error("unable to parse blob");
+  //everything compressed needs to say how big it will be when its not
+  if (blob.compression != BlobData::RAW) {
+    if (blob.raw_size < 0 || blob.raw_size > MAX_UNCOMPRESSED_BLOB_SIZE)
+      throw std::runtime_error("uncompressed blob-size is bigger than allowed");
+    if (unpack_buffer.size() < static_cast<size_t>(blob.raw_size))
+      unpack_buffer.resize(blob.raw_size);
+  }
 
   //if the blob was uncompressed
-  if (blob.has_raw()) {
+  if (blob.compression == BlobData::RAW) {
     //check that raw_size is set correctly and move it to the final buffer
-    sz = blob.raw().size();
-    if (sz != blob.raw_size())
-      LOG_WARN("blob reports wrong raw_size: " + std::to_string(blob.raw_size()) + " bytes");
-    memcpy(unpack_buffer, buffer, sz);
+    sz = blob.size;
+    if (blob.raw_size != -1 && sz != blob.raw_size)
+      LOG_WARN("blob reports wrong raw_size: " + std::to_string(blob.raw_size) + " bytes");
+    if (unpack_buffer.size() < static_cast<size_t>(sz))
+      unpack_buffer.resize(sz);
+    memcpy(unpack_buffer.data(), blob.data, sz);
     return sz;
   }//if the blob was zlib compressed
-  else if (blob.has_zlib_data()) {
-    sz = blob.zlib_data().size();
+  else if (blob.compression == BlobData::ZLIB) {
     z_stream z;
-    z.next_in = (unsigned char*) blob.zlib_data().c_str();
-    z.avail_in = sz;
-    z.next_out = (unsigned char*) unpack_buffer;
-    z.avail_out = blob.raw_size();
+    z.next_in = (unsigned char*) blob.data;
+    z.avail_in = blob.size;
+    z.next_out = (unsigned char*) unpack_buffer.data();
+    z.avail_out = blob.raw_size;
     z.zalloc = Z_NULL;
     z.zfree = Z_NULL;
     z.opaque = Z_NULL;
     if (inflateInit(&z) != Z_OK)
       throw std::runtime_error("failed to init zlib stream");
-    if (inflate(&z, Z_FINISH) != Z_STREAM_END)
+    if (inflate(&z, Z_FINISH) != Z_STREAM_END) {
+      inflateEnd(&z);
       throw std::runtime_error("failed to inflate zlib stream");
+    }
     if (inflateEnd(&z) != Z_OK)
       throw std::runtime_error("failed to deinit zlib stream");
     return z.total_out;
+  }//if the blob was zstd compressed
+  else if (blob.compression == BlobData::ZSTD) {
+#ifdef HAVE_ZSTD
+    size_t size = ZSTD_decompressDCtx(zstd_context(), unpack_buffer.data(), blob.raw_size, blob.data, blob.size);
+    if (ZSTD_isError(size))
+      throw std::runtime_error(std::string("failed to decompress zstd blob: ") + ZSTD_getErrorName(size));
+    return size;
+#else
+    throw std::runtime_error("zstd-decompression is not supported");
+#endif
+  }//if the blob was lz4 compressed
+  else if (blob.compression == BlobData::LZ4) {
+#ifdef HAVE_LZ4
+    int size = LZ4_decompress_safe(blob.data, unpack_buffer.data(), blob.size, blob.raw_size);
+    if (size < 0)
+      throw std::runtime_error("failed to decompress lz4 blob");
+    return size;
+#else
+    throw std::runtime_error("lz4-decompression is not supported");
+#endif
   }
 
   //if the blob was lzma compressed
-  //if (blob.has_lzma_data())
-  //  throw std::runtime_error("lzma-decompression is not supported");
+  if (blob.compression == BlobData::LZMA)
+    throw std::runtime_error("lzma-decompression is not supported");
 
   throw std::runtime_error("Unsupported blob data format");
 }
 
-template <class T>
-OSMPBF::Tags get_tags(const T& object, const OSMPBF::PrimitiveBlock &primblock) {
-  OSMPBF::Tags result(object.keys_size());
-  for (int i = 0; i < object.keys_size(); ++i) {
-    uint64_t key = object.keys(i);
-    uint64_t val = object.vals(i);
-    std::string key_string = primblock.stringtable().s(key);
-    std::string val_string = primblock.stringtable().s(val);
-    result[key_string] = val_string;
+//appends a varint to the bytes
+void add_varint(std::string& bytes, uint64_t value) {
+  while (value >= 0x80) {
+    bytes.push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
   }
-  return result;
+  bytes.push_back(static_cast<char>(value));
+}
+
+//compresses the raw bytes and lays them out as a blob. we do this by hand rather than
+//with a Blob message because the proto we build against predates the lz4 and zstd fields
+std::string pack_blob(const std::string& raw, const Compression compression) {
+  if (raw.size() > MAX_UNCOMPRESSED_BLOB_SIZE)
+    throw std::runtime_error("uncompressed blob-size is bigger than allowed");
+
+  //the field numbers from fileformat.proto
+  uint32_t field;
+  std::string data;
+  switch (compression) {
+    case UNCOMPRESSED: {
+      field = 1;
+      data = raw;
+      break;
+    }
+    case ZLIB: {
+      field = 3;
+      uLongf size = compressBound(raw.size());
+      data.resize(size);
+      if (compress(reinterpret_cast<Bytef*>(&data[0]), &size, reinterpret_cast<const Bytef*>(raw.data()), raw.size()) != Z_OK)
+        throw std::runtime_error("failed to deflate blob");
+      data.resize(size);
+      break;
+    }
+    case LZ4: {
+#ifdef HAVE_LZ4
+      field = 6;
+      data.resize(LZ4_compressBound(raw.size()));
+      int size = LZ4_compress_default(raw.data(), &data[0], raw.size(), data.size());
+      if (size <= 0)
+        throw std::runtime_error("failed to lz4 compress blob");
+      data.resize(size);
+      break;
+#else
+      throw std::runtime_error("lz4-compression is not supported");
+#endif
+    }
+    case ZSTD: {
+#ifdef HAVE_ZSTD
+      field = 7;
+      data.resize(ZSTD_compressBound(raw.size()));
+      //the default level, higher ones take a lot longer and barely change how fast it inflates
+      size_t size = ZSTD_compress(&data[0], data.size(), raw.data(), raw.size(), 3);
+      if (ZSTD_isError(size))
+        throw std::runtime_error(std::string("failed to zstd compress blob: ") + ZSTD_getErrorName(size));
+      data.resize(size);
+      break;
+#else
+      throw std::runtime_error("zstd-compression is not supported");
+#endif
+    }
+    default:
+      throw std::runtime_error("Unsupported blob data format");
+  }
+
+  std::string blob;
+  if (compression != UNCOMPRESSED) {
+    add_varint(blob, 2 << 3);
+    add_varint(blob, raw.size());
+  }
+  add_varint(blob, (field << 3) | 2);
+  add_varint(blob, data.size());
+  blob += data;
+  return blob;
+}
+
+//writes the blob to the file with a header saying what it is and how big
+void write_blob(std::ostream& file, const std::string& type, const std::string& blob) {
+  BlobHeader header;
+  header.set_type(type);
+  header.set_datasize(blob.size());
+  std::string header_bytes = header.SerializeAsString();
+
+  //the size of the header goes first in network byte-order
+  int32_t sz = htonl(header_bytes.size());
+  file.write(static_cast<const char*>(static_cast<const void*>(&sz)), 4);
+  file << header_bytes << blob;
+  if (!file)
+    throw std::runtime_error("unable to write blob to file");
+}
+
+//compresses the message and writes it to the file as a blob of the given type
+void write_blob(std::ostream& file, const std::string& type, const google::protobuf::MessageLite& message, const Compression compression) {
+  write_blob(file, type, pack_blob(message.SerializeAsString(), compression));
+}
+
+//which kinds of primitives are in this block and what range of node ids it covers
+void summarize_block(const PrimitiveBlock& primblock, BlobInfo& info) {
+  info.kinds = NONE;
+  info.min_node_id = std::numeric_limits<uint64_t>::max();
+  info.max_node_id = 0;
+  for (int i = 0, l = primblock.primitivegroup_size(); i < l; i++) {
+    const PrimitiveGroup& primitive_group = primblock.primitivegroup(i);
+    if (primitive_group.nodes_size() > 0 || primitive_group.has_dense())
+      info.kinds |= NODES;
+    if (primitive_group.ways_size() > 0)
+      info.kinds |= WAYS;
+    if (primitive_group.relations_size() > 0)
+      info.kinds |= RELATIONS;
+
+    //simple nodes
+    for (int j = 0; j < primitive_group.nodes_size(); ++j) {
+      uint64_t id = primitive_group.nodes(j).id();
+      info.min_node_id = std::min(info.min_node_id, id);
+      info.max_node_id = std::max(info.max_node_id, id);
+    }
+
+    //dense nodes are delta encoded
+    if (primitive_group.has_dense()) {
+      const DenseNodes& dn = primitive_group.dense();
+      uint64_t id = 0;
+      for (int j = 0; j < dn.id_size(); ++j) {
+        id += dn.id(j);
+        info.min_node_id = std::min(info.min_node_id, id);
+        info.max_node_id = std::max(info.max_node_id, id);
+      }
+    }
+  }
+
+  //no nodes no range
+  if (info.min_node_id > info.max_node_id)
+    info.min_node_id = info.max_node_id = 0;
 }
 
-void parse_primitiveblock(char* unpack_buffer, int32_t sz, const Interest interest, Callback& callback) {
-  //turn the blob bytes into a protobuf object
+// pulls the data blobs out of the file in order. if we have a list of blobs we want
+// we jump straight to them, otherwise we scan through the whole file and keep track
+// of where each blob was. when the file is memory mapped the blobs are never copied
+class blob_reader {
+ public:
+  blob_reader(std::ifstream* file, const MappedFile* map, const bool indexed, const BlobIndex& blobs):
+    file_(file), map_(map), indexed_(indexed), blobs_(blobs), current_(0), position_(0),
+    header_buffer_(MAX_BLOB_HEADER_SIZE) {
+    //start from the top
+    if (file_) {
+      file_->clear();
+      file_->seekg(0, std::ios::beg);
+    }
+  }
+
+  //get the next data blob, returns false when there are no more. bytes points either
+  //into the buffer or into the memory map
+  bool next(std::vector<char>& buffer, const char*& bytes, int32_t& size, BlobInfo& info) {
+    //jump to the next blob that has something we care about
+    if (indexed_) {
+      if (current_ == blobs_.size())
+        return false;
+      info = blobs_[current_++];
+      size = info.size;
+      if (map_) {
+        if (info.offset + info.size > map_->size())
+          throw std::runtime_error("indexed blob is past the end of the file");
+        bytes = map_->data() + info.offset;
+        map_->will_need(info.offset, info.size);
+        return true;
+      }
+      if (buffer.size() < info.size)
+        buffer.resize(info.size);
+      file_->clear();
+      file_->seekg(info.offset, std::ios::beg);
+      if (!file_->read(buffer.data(), info.size))
+        throw std::runtime_error("unable to read indexed blob from file");
+      bytes = buffer.data();
+      return true;
+    }
+
+    //scan for the next data blob
+    while (true) {
+      //grab the blob header
+      bool finished = false;
+      BlobHeader header = map_ ? map_header(finished) : read_header(header_buffer_.data(), *file_, finished);
+      if (finished)
+        break;
+
+      //grab the blob that goes with it
+      uint64_t offset;
+      if (map_) {
+        offset = position_;
+        size = map_blob(header);
+        bytes = map_->data() + offset;
+      }
+      else {
+        offset = file_->tellg();
+        size = read_blob(buffer, *file_, header);
+        bytes = buffer.data();
+      }
+      if (header.type() == "OSMData") {
+        info = {offset, static_cast<uint32_t>(size), NONE, 0, 0};
+        return true;
+      }//if its something other than a header
+      else if (header.type() != "OSMHeader")
+        LOG_WARN("Unknown blob type: " + header.type());
+    }
+    return false;
+  }
+
+  //whether or not the reader is building the index as it goes
+  bool indexing() const {
+    return !indexed_;
+  }
+
+ protected:
+  //same as read_header but out of the memory map
+  BlobHeader map_header(bool& finished) {
+    BlobHeader result;
+    finished = position_ + 4 > map_->size();
+    if (finished)
+      return result;
+
+    //the size is in network byte-order
+    int32_t sz;
+    memcpy(&sz, map_->data() + position_, 4);
+    sz = ntohl(sz);
+    if (sz < 0 || sz > MAX_BLOB_HEADER_SIZE)
+      throw std::runtime_error("blob-header-size is bigger than allowed " + std::to_string(sz) + " > " + std::to_string(MAX_BLOB_HEADER_SIZE));
+    position_ += 4;
+    if (position_ + sz > map_->size())
+      throw std::runtime_error("unable to read blob-header from file");
+
+    //turn the bytes into a protobuf object
+    map_->will_need(position_, sz);
+    if (!result.ParseFromArray(map_->data() + position_, sz))
+      throw std::runtime_error("unable to parse blob header");
+    position_ += sz;
+    return result;
+  }
+
+  //same as read_blob but just moves past it in the memory map
+  int32_t map_blob(const BlobHeader& header) {
+    int32_t sz = header.datasize();
+    if (sz < 0 || sz > MAX_UNCOMPRESSED_BLOB_SIZE)
+      throw std::runtime_error("blob-size is bigger than allowed");
+    if (position_ + sz > map_->size())
+      throw std::runtime_error("unable to read blob from file");
+    map_->will_need(position_, sz);
+    position_ += sz;
+    return sz;
+  }
+
+  std::ifstream* file_;
+  const MappedFile* map_;
+  const bool indexed_;
+  const BlobIndex& blobs_;
+  size_t current_;
+  uint64_t position_;
+  std::vector<char> header_buffer_;
+};
+
+// the maximum number of blobs the reader can get ahead of the callbacks
+#define MAX_BLOBS_IN_FLIGHT_PER_THREAD 4
+
+// a blob on its way from the file to the callbacks
+struct blob_work {
+  blob_work(): decoded(false) { }
+  std::vector<char> data;
+  const char* bytes;
+  int32_t size;
+  BlobInfo info;
+  std::vector<char> inflated;
   PrimitiveBlock primblock;
-  if (!primblock.ParseFromArray(unpack_buffer, sz))
-    throw std::runtime_error("unable to parse primitive block");
+  Block block;
+  bool decoded;
+  std::exception_ptr error;
+};
+
+// inflates a blob and lays it out into a block with whichever decoder was asked for
+class block_decoder {
+ public:
+  block_decoder(const Decoder decoder, const MappedFile* map): decoder_(decoder), map_(map) { }
+
+  //the block points into the primitive block or the inflated bytes so they stay with the work
+  void decode(blob_work& work, const Interest interest, const bool summarize) {
+    decode(work, interest, summarize, map_);
+  }
+
+  //same as above but for a blob out of some other memory map
+  void decode(blob_work& work, const Interest interest, const bool summarize, const MappedFile* map) {
+    int32_t sz = unpack_blob(work.bytes, work.size, work.inflated);
+    //once its inflated we wont need those pages again
+    if (map)
+      map->done_with(work.info.offset, work.size);
+    if (decoder_ == WIRE) {
+      wire_.decode(work.inflated.data(), sz, interest, work.block, summarize ? &work.info : nullptr);
+      return;
+    }
+    if (!work.primblock.ParseFromArray(work.inflated.data(), sz))
+      throw std::runtime_error("unable to parse primitive block");
+    if (summarize)
+      summarize_block(work.primblock, work.info);
+    work.block.fill(work.primblock, interest);
+  }
+
+ protected:
+  const Decoder decoder_;
+  const MappedFile* map_;
+  WireDecoder wire_;
+};
+
+// one thread reads blobs from the file in order, a pool of threads inflates, parses and lays
+// them out into blocks and the calling thread hands them to the callback in file order
+class decode_pipeline {
+ public:
+  decode_pipeline(blob_reader& reader, const size_t threads, const Decoder decoder, const MappedFile* map):
+    reader_(reader), threads_(threads), decoder_(decoder), map_(map), max_in_flight_(threads * MAX_BLOBS_IN_FLIGHT_PER_THREAD),
+    interest_(NONE), reading_(true), cancelled_(false) {
+  }
+
+  ~decode_pipeline() {
+    stop();
+  }
+
+  //start up the reader and the workers
+  void start(const Interest interest) {
+    interest_ = interest;
+    reader_thread_ = std::thread(&decode_pipeline::read, this);
+    for (size_t i = 0; i < threads_; ++i)
+      workers_.emplace_back(&decode_pipeline::decode, this);
+  }
+
+  //stop everything and wait for everyone to finish up
+  void stop() {
+    if (!reader_thread_.joinable())
+      return;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cancelled_ = true;
+      condition_.notify_all();
+    }
+    reader_thread_.join();
+    for (auto& worker : workers_)
+      worker.join();
+    workers_.clear();
+  }
+
+  //gets the next blob in file order once its been decoded, null when there are no more
+  std::shared_ptr<blob_work> next() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait(lock, [this]() {
+      return (!in_order_.empty() && in_order_.front()->decoded) || (in_order_.empty() && !reading_);
+    });
+    //nothing left, if the reader had trouble we do too
+    if (in_order_.empty()) {
+      if (reader_error_)
+        std::rethrow_exception(reader_error_);
+      return nullptr;
+    }
+    std::shared_ptr<blob_work> work = in_order_.front();
+    in_order_.pop_front();
+    condition_.notify_all();
+    //if the worker had trouble we do too
+    if (work->error)
+      std::rethrow_exception(work->error);
+    return work;
+  }
+
+  //returns true if we made it all the way through the blobs
+  bool run(const Interest interest, BlockCallback& callback, BlobIndex& index) {
+    start(interest);
+
+    //consume the blobs in the order they were read
+    std::exception_ptr error;
+    bool complete = true;
+    try {
+      std::shared_ptr<blob_work> work;
+      while ((work = next())) {
+        if (reader_.indexing())
+          index.push_back(work->info);
+        callback.block_callback(work->block);
+        //the callback has what it needs
+        if (callback.done()) {
+          complete = false;
+          break;
+        }
+      }
+    }//either we or the reader had a problem
+    catch (...) {
+      error = std::current_exception();
+      complete = false;
+    }
+
+    stop();
+    if (error)
+      std::rethrow_exception(error);
+    return complete;
+  }
+
+ protected:
+  //the reader thread, pulls blobs off of the file in order
+  void read() {
+    try {
+      while (true) {
+        //grab the blob bytes
+        std::shared_ptr<blob_work> work(new blob_work);
+        if (!reader_.next(work->data, work->bytes, work->size, work->info))
+          break;
+
+        //wait for room and hand it off to both the workers and the consumer
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [this]() { return cancelled_ || in_order_.size() < max_in_flight_; });
+        if (cancelled_)
+          break;
+        in_order_.push_back(work);
+        to_decode_.push_back(work);
+        condition_.notify_all();
+      }
+    }
+    catch (...) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      reader_error_ = std::current_exception();
+    }
+
+    //let everyone know there is no more coming
+    std::unique_lock<std::mutex> lock(mutex_);
+    reading_ = false;
+    condition_.notify_all();
+  }
+
+  //the worker threads, inflate and parse blobs into blocks
+  void decode() {
+    block_decoder decoder(decoder_, map_);
+    while (true) {
+      //wait for something to do
+      std::shared_ptr<blob_work> work;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [this]() { return cancelled_ || !to_decode_.empty() || !reading_; });
+        if (cancelled_ || to_decode_.empty())
+          return;
+        work = to_decode_.front();
+        to_decode_.pop_front();
+      }
+
+      //do the expensive bits outside the lock
+      try {
+        decoder.decode(*work, interest_, reader_.indexing());
+      }
+      catch (...) {
+        work->error = std::current_exception();
+      }
+      work->data.clear();
+      work->data.shrink_to_fit();
+
+      //let the consumer know
+      std::unique_lock<std::mutex> lock(mutex_);
+      work->decoded = true;
+      condition_.notify_all();
+    }
+  }
+
+  blob_reader& reader_;
+  const size_t threads_;
+  const Decoder decoder_;
+  const MappedFile* map_;
+  const size_t max_in_flight_;
+  Interest interest_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::deque<std::shared_ptr<blob_work> > in_order_;
+  std::deque<std::shared_ptr<blob_work> > to_decode_;
+  bool reading_;
+  bool cancelled_;
+  std::exception_ptr reader_error_;
+  std::thread reader_thread_;
+  std::vector<std::thread> workers_;
+};
+
+//pick out the blobs in the index that have what we want and that the callback doesnt want to skip
+BlobIndex select_blobs(const BlobIndex& index, const Interest interest, BlockCallback& callback) {
+  BlobIndex blobs;
+  for (const auto& info : index) {
+    if ((info.kinds & interest) == NONE)
+      continue;
+    if ((info.kinds & interest) == NODES && callback.skip_nodes(info.min_node_id, info.max_node_id))
+      continue;
+    blobs.push_back(info);
+  }
+  return blobs;
+}
+
+//reads the blobs out of either the file or the memory map and hands them to the callback
+void parse_blobs(std::ifstream* file, const MappedFile* map, const Interest interest, BlockCallback& callback,
+                 BlobIndex& index, const size_t threads, const Decoder decoder) {
+  //if we have an index pick out the blobs that have what we want and that the callback doesnt want to skip
+  bool indexed = !index.empty();
+  BlobIndex blobs = select_blobs(index, interest, callback);
+
+  //if we dont have an index yet we'll make one as we go, only keep it if we make it all the way through
+  blob_reader reader(file, map, indexed, blobs);
+  BlobIndex new_index;
+  bool complete = true;
+
+  //hand off to the pipeline if we were asked to use more than one thread
+  if (threads > 1) {
+    decode_pipeline pipeline(reader, threads, decoder, map);
+    complete = pipeline.run(interest, callback, new_index);
+  }
+  else {
+    block_decoder block_decoder(decoder, map);
+    blob_work work;
+
+    //while there is more to read
+    while (reader.next(work.data, work.bytes, work.size, work.info)) {
+      block_decoder.decode(work, interest, reader.indexing());
+      if (reader.indexing())
+        new_index.push_back(work.info);
+      callback.block_callback(work.block);
+      //the callback has what it needs
+      if (callback.done()) {
+        complete = false;
+        break;
+      }
+    }
+  }
+
+  //keep the index for next time
+  if (reader.indexing() && complete)
+    index = std::move(new_index);
+}
+
+
+
+// the number of objects to gather up before handing a merged block to the callback
+#define MERGED_BLOCK_SIZE 8000
+
+// the position of an object in a block, pbf files are sorted by kind then by id
+enum merge_kind : uint8_t { MERGE_NODE = 0, MERGE_WAY = 1, MERGE_RELATION = 2, MERGE_DONE = 3 };
+
+//copies the key/values in [begin, end) of one block onto the end of another, the
+//strings are copied as views so the block they came from has to stay around
+void copy_tags(const Block& from, const uint32_t begin, const uint32_t end, Block& to) {
+  for (uint32_t i = begin; i < end; ++i) {
+    to.keys.push_back(to.strings.size());
+    to.strings.push_back(from.strings[from.keys[i]]);
+    to.vals.push_back(to.strings.size());
+    to.strings.push_back(from.strings[from.vals[i]]);
+  }
+}
+
+// the blobs of one of several files being merged, read and decoded by the threads of the merge pool
+struct merge_queue {
+  merge_queue(const MappedFile& map, const BlobIndex& index, const Interest interest, BlockCallback& callback):
+    map(map), blobs(select_blobs(index, interest, callback)), reader(nullptr, &map, !index.empty(), blobs),
+    reading(false), read_all(false) {
+  }
+
+  const MappedFile& map;
+  BlobIndex blobs;
+  blob_reader reader;
+  //the blobs read off of the file in order, waiting to be decoded and merged
+  std::deque<std::shared_ptr<blob_work> > in_order;
+  //whether a thread is reading the next blob and whether there are no more to read
+  bool reading;
+  bool read_all;
+  std::exception_ptr error;
+};
+
+// one pool of threads reads and decodes the blobs of all of the files being merged, so merging
+// lots of files uses no more threads than parsing one. each file gets an even share of the blobs
+// that can be in flight but always at least one, which the merge needs to make any progress
+class merge_pool {
+ public:
+  merge_pool(const std::vector<merge_queue*>& queues, const size_t threads, const Decoder decoder, const Interest interest):
+    queues_(queues), threads_(std::max(static_cast<size_t>(1), threads)), decoder_(decoder), interest_(interest),
+    max_in_flight_(std::max(static_cast<size_t>(1), threads_ * MAX_BLOBS_IN_FLIGHT_PER_THREAD / std::max(static_cast<size_t>(1), queues.size()))),
+    cancelled_(false) {
+  }
+
+  ~merge_pool() {
+    stop();
+  }
+
+  //start up the workers
+  void start() {
+    for (size_t i = 0; i < threads_; ++i)
+      workers_.emplace_back(&merge_pool::work, this);
+  }
+
+  //stop everything and wait for everyone to finish up
+  void stop() {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cancelled_ = true;
+      condition_.notify_all();
+    }
+    for (auto& worker : workers_)
+      worker.join();
+    workers_.clear();
+  }
+
+  //gets the next blob of the file in file order once its been decoded, null when there are no more
+  std::shared_ptr<blob_work> next(merge_queue& queue) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait(lock, [&queue]() {
+      return (!queue.in_order.empty() && queue.in_order.front()->decoded) || (queue.in_order.empty() && queue.read_all);
+    });
+    //nothing left, if reading it had trouble we do too
+    if (queue.in_order.empty()) {
+      if (queue.error)
+        std::rethrow_exception(queue.error);
+      return nullptr;
+    }
+    std::shared_ptr<blob_work> work = queue.in_order.front();
+    queue.in_order.pop_front();
+    condition_.notify_all();
+    //if the worker had trouble we do too
+    if (work->error)
+      std::rethrow_exception(work->error);
+    return work;
+  }
+
+ protected:
+  //the file with room for another blob that has the fewest in flight, null if none of them do
+  merge_queue* pick() const {
+    merge_queue* picked = nullptr;
+    for (auto* queue : queues_) {
+      if (queue->reading || queue->read_all || queue->in_order.size() >= max_in_flight_)
+        continue;
+      if (!picked || queue->in_order.size() < picked->in_order.size())
+        picked = queue;
+    }
+    return picked;
+  }
+
+  //whether every file has been read to the end
+  bool read_all() const {
+    for (const auto* queue : queues_) {
+      if (!queue->read_all)
+        return false;
+    }
+    return true;
+  }
+
+  //the worker threads, read the next blob of a file then inflate and parse it into a block
+  void work() {
+    block_decoder decoder(decoder_, nullptr);
+    while (true) {
+      //wait for a file with room for another blob, only one thread reads a file at a time
+      merge_queue* queue = nullptr;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [this, &queue]() { return cancelled_ || (queue = pick()) || read_all(); });
+        if (cancelled_ || !queue)
+          return;
+        queue->reading = true;
+      }
+
+      //grab the blob bytes, the file is memory mapped so this is quick
+      std::shared_ptr<blob_work> work(new blob_work);
+      bool more = false;
+      std::exception_ptr error;
+      try {
+        more = queue->reader.next(work->data, work->bytes, work->size, work->info);
+      }
+      catch (...) {
+        error = std::current_exception();
+      }
+
+      //hand it off to the consumer in the order it was read
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        queue->reading = false;
+        if (!more) {
+          queue->read_all = true;
+          queue->error = error;
+          condition_.notify_all();
+          continue;
+        }
+        queue->in_order.push_back(work);
+        condition_.notify_all();
+      }
+
+      //do the expensive bits outside the lock
+      try {
+        decoder.decode(*work, interest_, queue->reader.indexing(), &queue->map);
+      }
+      catch (...) {
+        work->error = std::current_exception();
+      }
+
+      //let the consumer know
+      std::unique_lock<std::mutex> lock(mutex_);
+      work->decoded = true;
+      condition_.notify_all();
+    }
+  }
+
+  const std::vector<merge_queue*> queues_;
+  const size_t threads_;
+  const Decoder decoder_;
+  const Interest interest_;
+  const size_t max_in_flight_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  bool cancelled_;
+  std::vector<std::thread> workers_;
+};
+
+// one of several files being merged and where the merge is up to in it
+struct merge_source {
+  merge_source(const MappedFile& map, const BlobIndex& index, const Interest interest, BlockCallback& callback):
+    queue(map, index, interest, callback), kind(MERGE_NODE), position(0), id(0) {
+  }
+
+  //move past the current object to the next one, getting the next block if need be
+  void advance(merge_pool& pool, std::vector<std::shared_ptr<blob_work> >& finished) {
+    ++position;
+    settle(pool, finished);
+  }
+
+  //find the next object starting from the current one, moving through kinds and blocks
+  void settle(merge_pool& pool, std::vector<std::shared_ptr<blob_work> >& finished) {
+    while (true) {
+      if (work) {
+        const Block& block = work->block;
+        size_t counts[] = { block.node_count(), block.way_count(), block.relation_count() };
+        while (kind < MERGE_DONE && position >= counts[kind]) {
+          kind = static_cast<merge_kind>(kind + 1);
+          position = 0;
+        }
+        if (kind < MERGE_DONE) {
+          id = kind == MERGE_NODE ? block.node_ids[position] :
+               (kind == MERGE_WAY ? block.way_ids[position] : block.relation_ids[position]);
+          return;
+        }
+        //this block is used up but its strings might still be in a merged block
+        finished.push_back(work);
+      }
+
+      //on to the next block, if there isnt one we are done
+      work = pool.next(queue);
+      if (!work) {
+        kind = MERGE_DONE;
+        return;
+      }
+      if (queue.reader.indexing())
+        new_index.push_back(work->info);
+      kind = MERGE_NODE;
+      position = 0;
+    }
+  }
+
+  //copy the current object onto the end of the merged block, the merged block has every kind
+  //in it so the tags of the first object of a kind start after those of the kinds before it
+  void copy(Block& to) const {
+    const Block& from = work->block;
+    const size_t i = position;
+    switch (kind) {
+      case MERGE_NODE:
+        if (to.node_ids.empty())
+          to.node_tag_offsets.front() = to.keys.size();
+        to.node_ids.push_back(from.node_ids[i]);
+        to.node_lngs.push_back(from.node_lngs[i]);
+        to.node_lats.push_back(from.node_lats[i]);
+        copy_tags(from, from.node_tag_offsets[i], from.node_tag_offsets[i + 1], to);
+        to.node_tag_offsets.push_back(to.keys.size());
+        break;
+      case MERGE_WAY:
+        if (to.way_ids.empty())
+          to.way_tag_offsets.front() = to.keys.size();
+        to.way_ids.push_back(from.way_ids[i]);
+        copy_tags(from, from.way_tag_offsets[i], from.way_tag_offsets[i + 1], to);
+        to.way_tag_offsets.push_back(to.keys.size());
+        to.way_refs.insert(to.way_refs.end(), from.way_refs.begin() + from.way_ref_offsets[i],
+                           from.way_refs.begin() + from.way_ref_offsets[i + 1]);
+        if (!from.way_lngs.empty()) {
+          to.way_lngs.insert(to.way_lngs.end(), from.way_lngs.begin() + from.way_ref_offsets[i],
+                             from.way_lngs.begin() + from.way_ref_offsets[i + 1]);
+          to.way_lats.insert(to.way_lats.end(), from.way_lats.begin() + from.way_ref_offsets[i],
+                             from.way_lats.begin() + from.way_ref_offsets[i + 1]);
+        }
+        to.way_ref_offsets.push_back(to.way_refs.size());
+        break;
+      case MERGE_RELATION:
+        if (to.relation_ids.empty())
+          to.relation_tag_offsets.front() = to.keys.size();
+        to.relation_ids.push_back(from.relation_ids[i]);
+        copy_tags(from, from.relation_tag_offsets[i], from.relation_tag_offsets[i + 1], to);
+        to.relation_tag_offsets.push_back(to.keys.size());
+        for (uint32_t j = from.member_offsets[i]; j < from.member_offsets[i + 1]; ++j) {
+          to.member_types.push_back(from.member_types[j]);
+          to.member_ids.push_back(from.member_ids[j]);
+          to.member_roles.push_back(to.strings.size());
+          to.strings.push_back(from.strings[from.member_roles[j]]);
+        }
+        to.member_offsets.push_back(to.member_ids.size());
+        break;
+      default:
+        break;
+    }
+  }
+
+  merge_queue queue;
+  std::shared_ptr<blob_work> work;
+  merge_kind kind;
+  size_t position;
+  uint64_t id;
+  BlobIndex new_index;
+};
+
+//orders the sources so that the one with the lowest kind and id comes out of the heap first
+struct merge_order {
+  bool operator()(const merge_source* a, const merge_source* b) const {
+    return a->kind > b->kind || (a->kind == b->kind && a->id > b->id);
+  }
+};
+
+//parses several files at once and hands their objects to the callback in kind then id order,
+//objects that show up in more than one file (ie at the borders of extracts) are only handed out once
+void parse_merged(const std::list<MappedFile>& files, const Interest interest, BlockCallback& callback,
+                  std::vector<BlobIndex>& indices, const size_t threads, const Decoder decoder) {
+  //the threads are shared by all of the files however many there are
+  std::list<merge_source> sources;
+  std::vector<merge_queue*> queues;
+  auto index = indices.begin();
+  for (const auto& file : files) {
+    sources.emplace_back(file, *index++, interest, callback);
+    queues.push_back(&sources.back().queue);
+  }
+  merge_pool pool(queues, threads, decoder, interest);
+  pool.start();
+
+  //get the first object from each file
+  std::vector<std::shared_ptr<blob_work> > finished;
+  std::vector<merge_source*> heap;
+  for (auto& source : sources) {
+    source.settle(pool, finished);
+    if (source.kind != MERGE_DONE)
+      heap.push_back(&source);
+  }
+  std::make_heap(heap.begin(), heap.end(), merge_order());
+
+  //keep taking the lowest object until everyone is done
+  Block merged;
+  merged.clear();
+  size_t count = 0;
+  bool complete = true;
+  while (!heap.empty()) {
+    std::pop_heap(heap.begin(), heap.end(), merge_order());
+    merge_source* source = heap.back();
+    merge_kind kind = source->kind;
+    uint64_t id = source->id;
+    source->copy(merged);
+    ++count;
+
+    //move this source along and any others that have the same object
+    do {
+      source->advance(pool, finished);
+      if (source->kind == MERGE_DONE)
+        heap.pop_back();
+      else
+        std::push_heap(heap.begin(), heap.end(), merge_order());
+      if (heap.empty() || heap.front()->kind != kind || heap.front()->id != id)
+        break;
+      std::pop_heap(heap.begin(), heap.end(), merge_order());
+      source = heap.back();
+    } while (true);
+
+    //hand off a full block, after that the blocks it pointed into can go
+    if (count == MERGED_BLOCK_SIZE || heap.empty()) {
+      callback.block_callback(merged);
+      merged.clear();
+      finished.clear();
+      count = 0;
+      //the callback has what it needs
+      if (callback.done()) {
+        complete = heap.empty();
+        break;
+      }
+    }
+  }
+
+  //stop the pool before we keep any of the indices
+  pool.stop();
+  auto source = sources.begin();
+  for (auto& index : indices) {
+    if (source->queue.reader.indexing() && complete)
+      index = std::move(source->new_index);
+    ++source;
+  }
+}
+}
+
+// extend the protobuf osmpbf namespace
+namespace OSMPBF {
+
+Member::Member(const Relation::MemberType type, const uint64_t id, const std::string& role): member_type(type), member_id(id), role(role) {
+}
+
+Member::Member(Member&& other): member_type(other.member_type), member_id(other.member_id), role(std::move(other.role)) {
+}
+
+MappedFile::MappedFile(const std::string& file_name): data_(nullptr), size_(0) {
+  //open it up and see how big it is
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd == -1)
+    throw std::runtime_error(file_name + "(open): " + strerror(errno));
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    throw std::runtime_error(file_name + "(fstat): " + strerror(errno));
+  }
+
+  //map the whole thing, the mapping keeps the file around even if it gets moved or deleted
+  size_ = st.st_size;
+  if (size_ > 0) {
+    void* ptr = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error(file_name + "(mmap): " + strerror(errno));
+    }
+    data_ = static_cast<const char*>(ptr);
+    //we mostly read front to back
+    madvise(ptr, size_, MADV_SEQUENTIAL);
+  }
+  if (close(fd) == -1)
+    throw std::runtime_error(file_name + "(close): " + strerror(errno));
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr)
+    munmap(const_cast<char*>(data_), size_);
+}
+
+const char* MappedFile::data() const {
+  return data_;
+}
+
+size_t MappedFile::size() const {
+  return size_;
+}
+
+void MappedFile::will_need(const uint64_t offset, const size_t size) const {
+  //start at the page the range starts on
+  uint64_t begin = offset - offset % page_size();
+  if (begin < size_)
+    madvise(const_cast<char*>(data_) + begin, std::min<uint64_t>(offset + size, size_) - begin, MADV_WILLNEED);
+}
+
+void MappedFile::done_with(const uint64_t offset, const size_t size) const {
+  //only drop whole pages that are entirely in the range, their neighbours might still be needed
+  uint64_t begin = offset + page_size() - 1;
+  begin -= begin % page_size();
+  uint64_t end = std::min<uint64_t>(offset + size, size_);
+  end -= end % page_size();
+  if (begin < end)
+    madvise(const_cast<char*>(data_) + begin, end - begin, MADV_DONTNEED);
+}
+
+size_t MappedFile::page_size() {
+  static const size_t size = sysconf(_SC_PAGESIZE);
+  return size;
+}
+
+TagView::TagView(const StringView* strings, const uint32_t* keys, const uint32_t* vals, const size_t size, const size_t stride):
+  strings_(strings), keys_(keys), vals_(vals), size_(size), stride_(stride) {
+}
+
+size_t TagView::size() const {
+  return size_;
+}
+
+bool TagView::empty() const {
+  return size_ == 0;
+}
+
+uint32_t TagView::key_id(const size_t i) const {
+  return keys_[i * stride_];
+}
+
+uint32_t TagView::value_id(const size_t i) const {
+  return vals_[i * stride_];
+}
+
+StringView TagView::key(const size_t i) const {
+  return strings_[key_id(i)];
+}
+
+StringView TagView::value(const size_t i) const {
+  return strings_[value_id(i)];
+}
+
+bool TagView::find(const uint32_t key_id, StringView& value) const {
+  for (size_t i = 0; i < size_; ++i) {
+    if (keys_[i * stride_] == key_id) {
+      value = strings_[vals_[i * stride_]];
+      return true;
+    }
+  }
+  return false;
+}
+
+bool TagView::find(const StringView& key, StringView& value) const {
+  for (size_t i = 0; i < size_; ++i) {
+    if (strings_[keys_[i * stride_]] == key) {
+      value = strings_[vals_[i * stride_]];
+      return true;
+    }
+  }
+  return false;
+}
+
+Tags TagView::to_tags() const {
+  Tags result(size_);
+  for (size_t i = 0; i < size_; ++i) {
+    const StringView& key = strings_[keys_[i * stride_]];
+    const StringView& value = strings_[vals_[i * stride_]];
+    result[std::string(key.data(), key.size())] = std::string(value.data(), value.size());
+  }
+  return result;
+}
+
+size_t Block::node_count() const {
+  return node_ids.size();
+}
+
+size_t Block::way_count() const {
+  return way_ids.size();
+}
+
+size_t Block::relation_count() const {
+  return relation_ids.size();
+}
+
+TagView Block::node_tags(const size_t i) const {
+  return TagView(strings.data(), keys.data() + node_tag_offsets[i], vals.data() + node_tag_offsets[i],
+                 node_tag_offsets[i + 1] - node_tag_offsets[i]);
+}
+
+TagView Block::way_tags(const size_t i) const {
+  return TagView(strings.data(), keys.data() + way_tag_offsets[i], vals.data() + way_tag_offsets[i],
+                 way_tag_offsets[i + 1] - way_tag_offsets[i]);
+}
+
+TagView Block::relation_tags(const size_t i) const {
+  return TagView(strings.data(), keys.data() + relation_tag_offsets[i], vals.data() + relation_tag_offsets[i],
+                 relation_tag_offsets[i + 1] - relation_tag_offsets[i]);
+}
+
+void Block::refs(const size_t i, std::vector<uint64_t>& refs) const {
+  refs.assign(way_refs.begin() + way_ref_offsets[i], way_refs.begin() + way_ref_offsets[i + 1]);
+}
+
+void Block::members(const size_t i, std::vector<Member>& members) const {
+  members.clear();
+  members.reserve(member_offsets[i + 1] - member_offsets[i]);
+  for (uint32_t j = member_offsets[i]; j < member_offsets[i + 1]; ++j) {
+    const StringView& role = strings[member_roles[j]];
+    members.emplace_back(member_types[j], member_ids[j], std::string(role.data(), role.size()));
+  }
+}
+
+void Block::clear() {
+  strings.clear();
+  keys.clear();
+  vals.clear();
+  node_ids.clear();
+  node_lngs.clear();
+  node_lats.clear();
+  node_tag_offsets.assign(1, 0);
+  way_ids.clear();
+  way_tag_offsets.assign(1, 0);
+  way_refs.clear();
+  way_ref_offsets.assign(1, 0);
+  way_lngs.clear();
+  way_lats.clear();
+  relation_ids.clear();
+  relation_tag_offsets.assign(1, 0);
+  member_types.clear();
+  member_ids.clear();
+  member_roles.clear();
+  member_offsets.assign(1, 0);
+}
+
+void Block::fill(const PrimitiveBlock& primblock, const Interest interest) {
+  clear();
+
+  //views of the strings in the block so we dont have to copy them for every object
+  strings.reserve(primblock.stringtable().s_size());
+  for (const auto& str : primblock.stringtable().s())
+    strings.emplace_back(str.data(), str.size());
 
   //for each primitive group
   for (int i = 0, l = primblock.primitivegroup_size(); i < l; i++) {
@@ -153,36 +1293,35 @@ void parse_primitiveblock(char* unpack_buffer, int32_t sz, const Interest intere
       for (int i = 0; i < primitive_group.nodes_size(); ++i) {
         const Node& n = primitive_group.nodes(i);
 
-        double lon = 0.000000001 * (primblock.lon_offset() + (primblock.granularity() * n.lon()));
-        double lat = 0.000000001 * (primblock.lat_offset() + (primblock.granularity() * n.lat()));
-        callback.node_callback(n.id(), lon, lat, get_tags<Node>(n, primblock));
+        //the tags of the first of a kind start after those of any other kinds in the block
+        if (node_ids.empty())
+          node_tag_offsets.front() = keys.size();
+        node_ids.push_back(n.id());
+        node_lngs.push_back(0.000000001 * (primblock.lon_offset() + (primblock.granularity() * n.lon())));
+        node_lats.push_back(0.000000001 * (primblock.lat_offset() + (primblock.granularity() * n.lat())));
+        keys.insert(keys.end(), n.keys().begin(), n.keys().end());
+        vals.insert(vals.end(), n.vals().begin(), n.vals().end());
+        node_tag_offsets.push_back(keys.size());
       }
 
       // Dense Nodes
       if (primitive_group.has_dense()) {
         const DenseNodes& dn = primitive_group.dense();
-        uint64_t id = 0;
-        double lon = 0;
-        double lat = 0;
+        if (node_ids.empty())
+          node_tag_offsets.front() = keys.size();
+        decode_dense_nodes(dn, primblock.lat_offset(), primblock.lon_offset(), primblock.granularity(),
+                           node_ids, node_lngs, node_lats);
 
         int current_kv = 0;
         for (int i = 0; i < dn.id_size(); ++i) {
-          id += dn.id(i);
-          lon += 0.000000001 * (primblock.lon_offset() + (primblock.granularity() * dn.lon(i)));
-          lat += 0.000000001 * (primblock.lat_offset() + (primblock.granularity() * dn.lat(i)));
-
-          //can't exactly preallocate because you don't know how many there are
-          Tags tags;
+          //the key/values for this node run until the next 0
           while (current_kv < dn.keys_vals_size() && dn.keys_vals(current_kv) != 0) {
-            uint64_t key = dn.keys_vals(current_kv);
-            uint64_t val = dn.keys_vals(current_kv + 1);
-            std::string key_string = primblock.stringtable().s(key);
-            std::string val_string = primblock.stringtable().s(val);
+            keys.push_back(dn.keys_vals(current_kv));
+            vals.push_back(dn.keys_vals(current_kv + 1));
             current_kv += 2;
-            tags[key_string] = val_string;
           }
           ++current_kv;
-          callback.node_callback(id, lon, lat, tags);
+          node_tag_offsets.push_back(keys.size());
         }
       }
     }
@@ -192,17 +1331,22 @@ void parse_primitiveblock(char* unpack_buffer, int32_t sz, const Interest intere
       for (int i = 0; i < primitive_group.ways_size(); ++i) {
         const Way& w = primitive_group.ways(i);
 
+        if (way_ids.empty())
+          way_tag_offsets.front() = keys.size();
+        way_ids.push_back(w.id());
+        keys.insert(keys.end(), w.keys().begin(), w.keys().end());
+        vals.insert(vals.end(), w.vals().begin(), w.vals().end());
+        way_tag_offsets.push_back(keys.size());
+
         uint64_t node = 0;
-        std::vector<uint64_t> nodes;
-        nodes.reserve(w.refs_size());
+        size_t first = way_refs.size();
         for (int j = 0; j < w.refs_size(); ++j) {
           node += w.refs(j);
           //TODO: skip consecutive duplicates, make this configurable
-          if(nodes.size() == 0 || node != nodes.back())
-            nodes.push_back(node);
+          if(way_refs.size() == first || node != way_refs.back())
+            way_refs.push_back(node);
         }
-        uint64_t id = w.id();
-        callback.way_callback(id, get_tags<Way>(w, primblock), nodes);
+        way_ref_offsets.push_back(way_refs.size());
       }
     }
 
@@ -210,59 +1354,356 @@ void parse_primitiveblock(char* unpack_buffer, int32_t sz, const Interest intere
     if ((interest & RELATIONS) == RELATIONS) {
       for (int i = 0; i < primitive_group.relations_size(); ++i) {
         const Relation& rel = primitive_group.relations(i);
+
+        if (relation_ids.empty())
+          relation_tag_offsets.front() = keys.size();
+        relation_ids.push_back(rel.id());
+        keys.insert(keys.end(), rel.keys().begin(), rel.keys().end());
+        vals.insert(vals.end(), rel.vals().begin(), rel.vals().end());
+        relation_tag_offsets.push_back(keys.size());
+
         uint64_t id = 0;
-        std::vector<Member> members;
-        members.reserve(rel.memids_size());
         for (int l = 0; l < rel.memids_size(); ++l) {
           id += rel.memids(l);
-          members.emplace_back(rel.types(l), id, primblock.stringtable().s(rel.roles_sid(l)));
+          member_types.push_back(rel.types(l));
+          member_ids.push_back(id);
+          member_roles.push_back(rel.roles_sid(l));
         }
-        callback.relation_callback(rel.id(), get_tags<Relation>(rel, primblock), members);
+        member_offsets.push_back(member_ids.size());
       }
     }
   }
 }
 
+// the number of primitives written to each block, the same as osmosis and friends
+#define WRITTEN_BLOCK_SIZE 8000
+
+struct BlockWriter {
+  BlockWriter(const std::string& file_name, const Compression compression): file_name(file_name),
+    file(file_name, std::ios::out | std::ios::binary | std::ios::trunc), compression(compression) {
+    if (!file.is_open())
+      throw std::runtime_error("Failed to open: " + file_name);
+    reset();
+  }
+
+  //index of the string in the string table of the block, adding it if its new
+  uint32_t string(const std::string& str) {
+    auto inserted = strings.emplace(str, strings.size());
+    if (inserted.second)
+      block.mutable_stringtable()->add_s(str);
+    return inserted.first->second;
+  }
+
+  //call after each primitive is added, writes out the block when its full
+  void added() {
+    if (++count == WRITTEN_BLOCK_SIZE)
+      flush();
+  }
+
+  void flush() {
+    if (count > 0) {
+      write_blob(file, "OSMData", block, compression);
+      reset();
+    }
+  }
+
+  //start a new empty block, the empty string is always first because 0 ends a dense node's tags
+  void reset() {
+    block.Clear();
+    strings.clear();
+    string("");
+    group = block.add_primitivegroup();
+    count = 0;
+    last_id = last_lng = last_lat = 0;
+  }
+
+  const std::string file_name;
+  std::ofstream file;
+  const Compression compression;
+  PrimitiveBlock block;
+  PrimitiveGroup* group;
+  std::unordered_map<std::string, uint32_t> strings;
+  size_t count;
+  //ids and coordinates are delta encoded within a block
+  int64_t last_id, last_lng, last_lat;
+};
+
+Writer::Writer(const std::string& file_name, const HeaderBlock& header, const Compression compression):
+  file_name_(file_name), header_(header), compression_(compression),
+  nodes_(new BlockWriter(file_name + ".nodes", compression)), ways_(new BlockWriter(file_name + ".ways", compression)),
+  relations_(new BlockWriter(file_name + ".relations", compression)), closed_(false) {
+  if (!supports(compression))
+    throw std::runtime_error("Unsupported blob compression");
+  //we only write what we need to
+  header_.clear_required_features();
+  header_.add_required_features("OsmSchema-V0.6");
+  header_.add_required_features("DenseNodes");
+  header_.add_optional_features("Sort.Type_then_ID");
 }
 
-// extend the protobuf osmpbf namespace
-namespace OSMPBF {
+Writer::~Writer() {
+  //didnt finish so dont leave a mess behind
+  if (!closed_) {
+    for (const auto* kind : { nodes_.get(), ways_.get(), relations_.get() })
+      remove(kind->file_name.c_str());
+  }
+}
 
-Member::Member(const Relation::MemberType type, const uint64_t id, const std::string& role): member_type(type), member_id(id), role(role) {
+void Writer::node(const uint64_t osmid, const double lng, const double lat, const Tags& tags) {
+  //in the default granularity of 100 nanodegrees
+  int64_t id = osmid, lng_units = std::llround(lng * 10000000), lat_units = std::llround(lat * 10000000);
+  DenseNodes* dense = nodes_->group->mutable_dense();
+  dense->add_id(id - nodes_->last_id);
+  dense->add_lon(lng_units - nodes_->last_lng);
+  dense->add_lat(lat_units - nodes_->last_lat);
+  nodes_->last_id = id;
+  nodes_->last_lng = lng_units;
+  nodes_->last_lat = lat_units;
+  for (const auto& tag : tags) {
+    dense->add_keys_vals(nodes_->string(tag.first));
+    dense->add_keys_vals(nodes_->string(tag.second));
+  }
+  dense->add_keys_vals(0);
+  nodes_->added();
 }
 
-Member::Member(Member&& other): member_type(other.member_type), member_id(other.member_id), role(std::move(other.role)) {
+void Writer::way(const uint64_t osmid, const Tags& tags, const std::vector<uint64_t>& nodes) {
+  Way* way = ways_->group->add_ways();
+  way->set_id(osmid);
+  for (const auto& tag : tags) {
+    way->add_keys(ways_->string(tag.first));
+    way->add_vals(ways_->string(tag.second));
+  }
+  int64_t last = 0;
+  for (const auto node : nodes) {
+    way->add_refs(static_cast<int64_t>(node) - last);
+    last = node;
+  }
+  ways_->added();
 }
 
-void Parser::parse(std::ifstream& file, const Interest interest, Callback& callback) {
-  char* buffer = new char[MAX_UNCOMPRESSED_BLOB_SIZE];
-  char* unpack_buffer = new char[MAX_UNCOMPRESSED_BLOB_SIZE];
-
-  //start from the top
-  file.clear();
-  file.seekg(0, std::ios::beg);
-
-  //while there is more to read
-  while (!file.eof()) {
-    //grab the blob header
-    bool finished = false;
-    BlobHeader header = read_header(buffer, file, finished);
-    //if we didnt hit the end
-    if (!finished) {
-      //grab the blob that goes with the blob header
-      int32_t sz = read_blob(buffer, unpack_buffer, file, header);
-      //if its data parse it
-      if (header.type() == "OSMData")
-        parse_primitiveblock(unpack_buffer, sz, interest, callback);
-      //if its something other than a header
-      else if (header.type() != "OSMHeader")
-        LOG_WARN("Unknown blob type: " + header.type());
-    }
+void Writer::relation(const uint64_t osmid, const Tags& tags, const std::vector<Member>& members) {
+  Relation* relation = relations_->group->add_relations();
+  relation->set_id(osmid);
+  for (const auto& tag : tags) {
+    relation->add_keys(relations_->string(tag.first));
+    relation->add_vals(relations_->string(tag.second));
+  }
+  int64_t last = 0;
+  for (const auto& member : members) {
+    relation->add_roles_sid(relations_->string(member.role));
+    relation->add_memids(static_cast<int64_t>(member.member_id) - last);
+    relation->add_types(member.member_type);
+    last = member.member_id;
+  }
+  relations_->added();
+}
+
+void Writer::close() {
+  if (closed_)
+    return;
+
+  //put it all together in a temporary file so a half written one never shows up
+  std::string temp_name = file_name_ + ".tmp";
+  std::ofstream file(temp_name, std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!file.is_open())
+    throw std::runtime_error("Failed to open: " + temp_name);
+  write_blob(file, "OSMHeader", header_, compression_);
+  for (auto* kind : { nodes_.get(), ways_.get(), relations_.get() }) {
+    kind->flush();
+    kind->file.close();
+    std::ifstream part(kind->file_name, std::ios::in | std::ios::binary);
+    if (part.peek() != std::ifstream::traits_type::eof())
+      file << part.rdbuf();
+    part.close();
+    remove(kind->file_name.c_str());
+  }
+  file.close();
+  if (!file || rename(temp_name.c_str(), file_name_.c_str()) != 0)
+    throw std::runtime_error("Failed to write: " + file_name_);
+  closed_ = true;
+}
+
+bool Writer::supports(const Compression compression) {
+  switch (compression) {
+    case UNCOMPRESSED:
+    case ZLIB:
+      return true;
+#ifdef HAVE_LZ4
+    case LZ4:
+      return true;
+#endif
+#ifdef HAVE_ZSTD
+    case ZSTD:
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+void Writer::recompress(const MappedFile& file, const std::string& file_name, const Compression compression) {
+  if (!supports(compression))
+    throw std::runtime_error("Unsupported blob compression");
+
+  //like the writer we only put it in place once its all there
+  std::string temp_name = file_name + ".tmp";
+  std::ofstream out(temp_name, std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!out.is_open())
+    throw std::runtime_error("Failed to open: " + temp_name);
+
+  std::vector<char> buffer;
+  uint64_t position = 0;
+  while (position < file.size()) {
+    //the header
+    int32_t sz;
+    if (position + 4 > file.size())
+      throw std::runtime_error("unable to read blob-header from file");
+    memcpy(&sz, file.data() + position, 4);
+    sz = ntohl(sz);
+    BlobHeader header;
+    if (sz < 0 || sz > MAX_BLOB_HEADER_SIZE || position + 4 + sz > file.size() ||
+        !header.ParseFromArray(file.data() + position + 4, sz))
+      throw std::runtime_error("unable to parse blob header");
+    position += 4 + sz;
+
+    //the blob, inflated and compressed the new way
+    if (header.datasize() < 0 || position + header.datasize() > file.size())
+      throw std::runtime_error("unable to read blob from file");
+    int32_t size = unpack_blob(file.data() + position, header.datasize(), buffer);
+    write_blob(out, header.type(), pack_blob(std::string(buffer.data(), size), compression));
+    file.done_with(position, header.datasize());
+    position += header.datasize();
+  }
+
+  out.close();
+  if (!out || rename(temp_name.c_str(), file_name.c_str()) != 0)
+    throw std::runtime_error("Failed to write: " + file_name);
+}
+
+TagsAdapter::TagsAdapter(Callback& callback): callback_(callback) {
+}
+
+void TagsAdapter::node_callback(const uint64_t osmid, const double lng, const double lat, const TagView& tags) {
+  callback_.node_callback(osmid, lng, lat, tags.to_tags());
+}
+
+void TagsAdapter::way_callback(const uint64_t osmid, const TagView& tags, const std::vector<uint64_t>& nodes) {
+  callback_.way_callback(osmid, tags.to_tags(), nodes);
+}
+
+void TagsAdapter::relation_callback(const uint64_t osmid, const TagView& tags, const std::vector<Member>& members) {
+  callback_.relation_callback(osmid, tags.to_tags(), members);
+}
+
+bool TagsAdapter::skip_nodes(const uint64_t min_id, const uint64_t max_id) {
+  return callback_.skip_nodes(min_id, max_id);
+}
+
+bool TagsAdapter::done() {
+  return callback_.done();
+}
+
+BlockAdapter::BlockAdapter(ViewCallback& callback): callback_(callback) {
+}
+
+void BlockAdapter::block_callback(const Block& block) {
+  for (size_t i = 0; i < block.node_count(); ++i)
+    callback_.node_callback(block.node_ids[i], block.node_lngs[i], block.node_lats[i], block.node_tags(i));
+  for (size_t i = 0; i < block.way_count(); ++i) {
+    block.refs(i, refs_);
+    callback_.way_callback(block.way_ids[i], block.way_tags(i), refs_);
   }
+  for (size_t i = 0; i < block.relation_count(); ++i) {
+    block.members(i, members_);
+    callback_.relation_callback(block.relation_ids[i], block.relation_tags(i), members_);
+  }
+}
+
+bool BlockAdapter::skip_nodes(const uint64_t min_id, const uint64_t max_id) {
+  return callback_.skip_nodes(min_id, max_id);
+}
+
+bool BlockAdapter::done() {
+  return callback_.done();
+}
 
-  //done with protobuf and buffers
-  delete [] buffer;
-  delete [] unpack_buffer;
+void Parser::parse(std::ifstream& file, const Interest interest, Callback& callback, const size_t threads, const Decoder decoder) {
+  BlobIndex index;
+  TagsAdapter adapter(callback);
+  parse(file, interest, adapter, index, threads, decoder);
+}
+
+void Parser::parse(std::ifstream& file, const Interest interest, Callback& callback, BlobIndex& index, const size_t threads, const Decoder decoder) {
+  TagsAdapter adapter(callback);
+  parse(file, interest, adapter, index, threads, decoder);
+}
+
+void Parser::parse(std::ifstream& file, const Interest interest, ViewCallback& callback, const size_t threads, const Decoder decoder) {
+  BlobIndex index;
+  BlockAdapter adapter(callback);
+  parse(file, interest, adapter, index, threads, decoder);
+}
+
+void Parser::parse(std::ifstream& file, const Interest interest, ViewCallback& callback, BlobIndex& index, const size_t threads, const Decoder decoder) {
+  BlockAdapter adapter(callback);
+  parse(file, interest, adapter, index, threads, decoder);
+}
+
+void Parser::parse(std::ifstream& file, const Interest interest, BlockCallback& callback, const size_t threads, const Decoder decoder) {
+  BlobIndex index;
+  parse(file, interest, callback, index, threads, decoder);
+}
+
+void Parser::parse(std::ifstream& file, const Interest interest, BlockCallback& callback, BlobIndex& index, const size_t threads, const Decoder decoder) {
+  parse_blobs(&file, nullptr, interest, callback, index, threads, decoder);
+}
+
+void Parser::parse(const MappedFile& file, const Interest interest, BlockCallback& callback, const size_t threads, const Decoder decoder) {
+  BlobIndex index;
+  parse(file, interest, callback, index, threads, decoder);
+}
+
+void Parser::parse(const MappedFile& file, const Interest interest, BlockCallback& callback, BlobIndex& index, const size_t threads, const Decoder decoder) {
+  parse_blobs(nullptr, &file, interest, callback, index, threads, decoder);
+}
+
+void Parser::parse(const std::list<MappedFile>& files, const Interest interest, BlockCallback& callback,
+                   std::vector<BlobIndex>& indices, const size_t threads, const Decoder decoder) {
+  if (indices.size() != files.size())
+    throw std::runtime_error("Need one blob index per file");
+  //nothing to merge
+  if (files.size() == 1) {
+    parse(files.front(), interest, callback, indices.front(), threads, decoder);
+    return;
+  }
+  if (!files.empty())
+    parse_merged(files, interest, callback, indices, threads, decoder);
+}
+
+HeaderBlock Parser::header(const MappedFile& file) {
+  //the header is supposed to be the first blob in the file
+  HeaderBlock result;
+  BlobHeader header;
+  int32_t sz;
+  if (file.size() < 4)
+    return result;
+  memcpy(&sz, file.data(), 4);
+  sz = ntohl(sz);
+  if (sz < 0 || sz > MAX_BLOB_HEADER_SIZE || 4 + static_cast<uint64_t>(sz) > file.size() ||
+      !header.ParseFromArray(file.data() + 4, sz))
+    throw std::runtime_error("unable to parse blob header");
+  if (header.type() != "OSMHeader")
+    return result;
+
+  //inflate it and parse it
+  if (header.datasize() < 0 || 4 + static_cast<uint64_t>(sz) + header.datasize() > file.size())
+    throw std::runtime_error("unable to read blob from file");
+  std::vector<char> buffer;
+  int32_t size = unpack_blob(file.data() + 4 + sz, header.datasize(), buffer);
+  if (!result.ParseFromArray(buffer.data(), size))
+    throw std::runtime_error("unable to parse header block");
+  return result;
 }
 
 void Parser::free() {
@@ -724,7 +724,7 @@ std::vector<std::string> OSMWay::GetNames(const std::string& ref,
     if (!ref.empty())
       tokens = GetTagTokens(ref);// use updated refs from relations.
     else
-      tokens = GetTagTokens(ref_offset_map.name(ref_index_));
+      tokens = GetTagTokens(ref_offset_map.view(ref_index_));
 
     names.insert(names.end(), tokens.begin(), tokens.end());
   }
@@ -742,7 +742,7 @@ std::vector<std::string> OSMWay::GetNames(const std::string& ref,
     if (!ref.empty())
       tokens = GetTagTokens(ref);// use updated refs from relations.
     else
-      tokens = GetTagTokens(ref_offset_map.name(ref_index_));
+      tokens = GetTagTokens(ref_offset_map.view(ref_index_));
     names.insert(names.end(), tokens.begin(), tokens.end());
   }
 
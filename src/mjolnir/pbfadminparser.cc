@@ -21,25 +21,22 @@ using namespace valhalla::baldr;
 using namespace valhalla::mjolnir;
 
 namespace {
-// Will throw an error if this is exceeded. Then we can increase.
-constexpr uint64_t kMaxOSMNodeId = 5000000000;
-
 // Node equality
 const auto WayNodeEquals = [](const OSMWayNode& a, const OSMWayNode& b) {
   return a.node.osmid == b.node.osmid;
 };
 
-struct admin_callback : public OSMPBF::Callback {
+struct admin_callback : public OSMPBF::BlockCallback {
  public:
   admin_callback() = delete;
   admin_callback(const admin_callback&) = delete;
   virtual ~admin_callback() {}
   // Construct PBFAdminParser based on properties file and input PBF extract
   admin_callback(const boost::property_tree::ptree& pt, OSMData& osmdata)
-  : shape_(kMaxOSMNodeId), members_(kMaxOSMNodeId), osmdata_(osmdata), lua_(std::string(lua_admin_lua, lua_admin_lua + lua_admin_lua_len)) {
+  : osmdata_(osmdata), lua_(std::string(lua_admin_lua, lua_admin_lua + lua_admin_lua_len)) {
   }
 
-  void node_callback(uint64_t osmid, double lng, double lat, const OSMPBF::Tags &tags) {
+  void node_callback(uint64_t osmid, double lng, double lat, const OSMPBF::TagView &tags) {
     // Check if it is in the list of nodes used by ways
     if (!shape_.IsUsed(osmid)) {
       return;
@@ -54,7 +51,30 @@ struct admin_callback : public OSMPBF::Callback {
     }
   }
 
-  void way_callback(uint64_t osmid, const OSMPBF::Tags &tags, const std::vector<uint64_t> &nodes) {
+  void block_callback(const OSMPBF::Block& block) {
+    for (size_t i = 0; i < block.node_count(); ++i)
+      node_callback(block.node_ids[i], block.node_lngs[i], block.node_lats[i], block.node_tags(i));
+
+    // Only copy the refs of ways used by relations
+    for (size_t i = 0; i < block.way_count(); ++i) {
+      if (!members_.IsUsed(block.way_ids[i]))
+        continue;
+      block.refs(i, refs_);
+      way_callback(block.way_ids[i], block.way_tags(i), refs_);
+    }
+
+    for (size_t i = 0; i < block.relation_count(); ++i) {
+      block.members(i, relation_members_);
+      relation_callback(block.relation_ids[i], block.relation_tags(i), relation_members_);
+    }
+  }
+
+  bool skip_nodes(const uint64_t min_id, const uint64_t max_id) {
+    // Nothing in this range is used by a way
+    return !shape_.IsUsed(min_id, max_id);
+  }
+
+  void way_callback(uint64_t osmid, const OSMPBF::TagView &tags, const std::vector<uint64_t> &nodes) {
 
     // Check if it is in the list of ways used by relations
     if (!members_.IsUsed(osmid)) {
@@ -70,7 +90,7 @@ struct admin_callback : public OSMPBF::Callback {
     osmdata_.way_map.emplace(osmid,std::list<uint64_t>(nodes.begin(), nodes.end()));
   }
 
-  void relation_callback(const uint64_t osmid, const OSMPBF::Tags &tags, const std::vector<OSMPBF::Member> &members) {
+  void relation_callback(const uint64_t osmid, const OSMPBF::TagView &tags, const std::vector<OSMPBF::Member> &members) {
     // Get tags
     auto results = lua_.Transform(OSMType::kRelation, tags);
     if (results.size() == 0)
@@ -120,6 +140,10 @@ struct admin_callback : public OSMPBF::Callback {
   // Pointer to all the OSM data (for use by callbacks)
   OSMData& osmdata_;
 
+  // Reused for each way and relation in a block
+  std::vector<uint64_t> refs_;
+  std::vector<OSMPBF::Member> relation_members_;
+
 };
 
 }
@@ -128,6 +152,10 @@ namespace valhalla {
 namespace mjolnir {
 
 OSMData PBFAdminParser::Parse(const boost::property_tree::ptree& pt, const std::vector<std::string>& input_files) {
+  unsigned int threads = std::max(static_cast<unsigned int>(1), pt.get<unsigned int>("concurrency", std::thread::hardware_concurrency()));
+  //which pbf decoder to use, libprotobuf or walking the wire format directly
+  OSMPBF::Decoder decoder = pt.get<std::string>("pbf_decoder", "libprotobuf") == "wire" ? OSMPBF::WIRE : OSMPBF::LIBPROTOBUF;
+
   // Create OSM data. Set the member pointer so that the parsing callback
   // methods can use it.
   OSMData osmdata{};
@@ -135,32 +163,31 @@ OSMData PBFAdminParser::Parse(const boost::property_tree::ptree& pt, const std::
 
   LOG_INFO("Parsing files: " + boost::algorithm::join(input_files, ", "));
 
-  //hold open all the files so that if something else (like diff application)
+  //hold all the files mapped so that if something else (like diff application)
   //needs to mess with them we wont have troubles with inodes changing underneath us
-  std::list<std::ifstream> file_handles;
-  for (const auto& input_file : input_files) {
-    file_handles.emplace_back(input_file, std::ios::binary);
-    if (!file_handles.back().is_open())
-      throw std::runtime_error("Unable to open: " + input_file);
-  }
+  //the blobs are inflated straight out of the mappings
+  std::list<OSMPBF::MappedFile> file_handles;
+  for (const auto& input_file : input_files)
+    file_handles.emplace_back(input_file);
+
+  //the first pass over each file records where its blobs are and what they have in them
+  //so that the passes after it can skip the blobs that have nothing of interest
+  std::vector<OSMPBF::BlobIndex> blob_indices(file_handles.size());
 
   // Parse each input file for relations
   LOG_INFO("Parsing relations...")
-  for (auto& file_handle : file_handles)
-    OSMPBF::Parser::parse(file_handle, OSMPBF::Interest::RELATIONS, callback);
+  OSMPBF::Parser::parse(file_handles, OSMPBF::Interest::RELATIONS, callback, blob_indices, threads, decoder);
   LOG_INFO("Finished with " + std::to_string(osmdata.admins_.size()) + " admin polygons comprised of " + std::to_string(osmdata.osm_way_count) + " ways");
 
   // Parse the ways.
   LOG_INFO("Parsing ways...");
-  for (auto& file_handle : file_handles)
-    OSMPBF::Parser::parse(file_handle, OSMPBF::Interest::WAYS, callback);
+  OSMPBF::Parser::parse(file_handles, OSMPBF::Interest::WAYS, callback, blob_indices, threads, decoder);
   LOG_INFO("Finished with " + std::to_string(osmdata.way_map.size()) + " ways comprised of " + std::to_string(osmdata.node_count) + " nodes");
 
   // Parse node in all the input files. Skip any that are not marked from
   // being used in a way.
   LOG_INFO("Parsing nodes...");
-  for (auto& file_handle : file_handles)
-    OSMPBF::Parser::parse(file_handle, OSMPBF::Interest::NODES, callback);
+  OSMPBF::Parser::parse(file_handles, OSMPBF::Interest::NODES, callback, blob_indices, threads, decoder);
   LOG_INFO("Finished with " + std::to_string(osmdata.osm_node_count) + " nodes");
 
   //done with pbf
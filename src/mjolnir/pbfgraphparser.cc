@@ -3,14 +3,24 @@
 #include "mjolnir/osmpbfparser.h"
 #include "mjolnir/osmaccess.h"
 #include "mjolnir/luatagtransform.h"
+#include "mjolnir/graphtagtransform.h"
 #include "mjolnir/idtable.h"
+#include "mjolnir/sortfile.h"
+#include "mjolnir/waynodejoin.h"
 #include "graph_lua_proc.h"
 
+#include <algorithm>
+#include <fstream>
+#include <functional>
 #include <future>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <thread>
 #include <boost/format.hpp>
 #include <boost/algorithm/string.hpp>
+#include <sys/stat.h>
 
 #include <valhalla/baldr/tilehierarchy.h>
 #include <valhalla/midgard/sequence.h>
@@ -26,24 +36,36 @@ using namespace valhalla::mjolnir;
 
 namespace {
 
-// Will throw an error if this is exceeded. Then we can increase.
-constexpr uint64_t kMaxOSMNodeId = 5000000000;
+// How many distinct sets of tags each lua state remembers the results of
+constexpr size_t kTagCacheSize = 65536;
+
+// Slot of an object that didnt need its tags transformed
+constexpr size_t kNone = std::numeric_limits<size_t>::max();
 
 // Absurd classification.
 constexpr uint32_t kAbsurdRoadClass = 777777;
 
+// How many nodes to gather up before joining them to the way nodes
+constexpr size_t kJoinNodes = 65536;
+
 // Construct PBFGraphParser based on properties file and input PBF extract
-struct graph_callback : public OSMPBF::Callback {
+struct graph_callback : public OSMPBF::BlockCallback {
  public:
   graph_callback() = delete;
   graph_callback(const graph_callback&) = delete;
   virtual ~graph_callback() {}
 
   graph_callback(const boost::property_tree::ptree& pt, OSMData& osmdata) :
-    shape_(kMaxOSMNodeId), intersection_(kMaxOSMNodeId), tile_hierarchy_(pt.get<std::string>("tile_dir")),
-    osmdata_(osmdata), lua_(get_lua(pt)){
+    tile_hierarchy_(pt.get<std::string>("tile_dir")),
+    osmdata_(osmdata), lua_(get_transform(pt), std::max(static_cast<unsigned int>(1), pt.get<unsigned int>("concurrency", std::thread::hardware_concurrency()))){
 
-    current_way_node_index_ = last_node_ = last_way_ = last_relation_ = 0;
+    last_node_ = last_way_ = last_relation_ = 0;
+    node_target_ = 0;
+    transformed_ = false;
+    locations_ = false;
+    cached_ = use_lua(pt) && pt.get<size_t>("tag_cache_size", kTagCacheSize) > 0;
+    untagged_ = {};
+    keys_[0] = keys_[1] = keys_[2] = nullptr;
 
     highway_cutoff_rc_ = RoadClass::kPrimary;
     for (auto& level : tile_hierarchy_.levels()) {
@@ -67,14 +89,97 @@ struct graph_callback : public OSMPBF::Callback {
     return std::string(lua_graph_lua, lua_graph_lua + lua_graph_lua_len);
   }
 
-  void node_callback(uint64_t osmid, double lng, double lat, const OSMPBF::Tags &tags) {
+  // A custom script has to go through lua but the default one is compiled in, unless
+  // tag_transform says to interpret lua/graph.lua instead
+  static bool use_lua(const boost::property_tree::ptree& pt) {
+    auto tag_transform = pt.get<std::string>("tag_transform", "native");
+    if (tag_transform != "native" && tag_transform != "lua")
+      throw std::runtime_error("Unknown tag_transform: " + tag_transform);
+    return pt.get_optional<std::string>("graph_lua_name") || tag_transform == "lua";
+  }
+
+  // Identifies the transform that will be used, so results from a different one arent reused
+  static std::string transform_key(const boost::property_tree::ptree& pt) {
+    if (use_lua(pt))
+      return "lua=" + std::to_string(std::hash<std::string>()(get_lua(pt)));
+    return "native=" + std::to_string(GraphTagTransform::kVersion);
+  }
+
+  // Makes the tag transforms for the pool
+  static std::function<TagTransform*()> get_transform(const boost::property_tree::ptree& pt) {
+    if (use_lua(pt)) {
+      auto lua = get_lua(pt);
+      auto cache_size = pt.get<size_t>("tag_cache_size", kTagCacheSize);
+      return [lua, cache_size]() { return new LuaTagTransform(lua, cache_size); };
+    }
+    LOG_INFO("Using the compiled graph tag transform");
+    return []() { return new GraphTagTransform(); };
+  }
+
+  // Tags that come out of a routing extract have already been through lua
+  Tags transform(const OSMType type, const OSMPBF::TagView& tags) {
+    return transformed_ ? tags.to_tags() : lua_[0].Transform(type, tags);
+  }
+
+  // Objects with none of the keys the transform looks at come out like ones without any tags
+  // (other than keeping their own tags) so we keep what those come out as and only transform
+  // objects that have some of the keys. The transform has to count the tags we read that it
+  // passes through as keys it looks at. The way and relation callbacks read so many that we
+  // only skip those when having no tags means they are dropped anyway
+  void prefilter() {
+    for (const auto type : { OSMType::kNode, OSMType::kWay, OSMType::kRelation }) {
+      keys_[static_cast<int>(type)] = transformed_ ? nullptr : lua_.Keys(type);
+      none_[static_cast<int>(type)] = transform(type, OSMPBF::TagView(nullptr, nullptr, nullptr, 0));
+      if (type != OSMType::kNode && !none_[static_cast<int>(type)].empty())
+        keys_[static_cast<int>(type)] = nullptr;
+    }
+  }
+
+  // Whether the transform needs to see these tags, which strings of the block are keys it looks
+  // at is worked out the first time we see them and kept until the next block or type
+  bool interesting(const OSMType type, const OSMPBF::Block& block, const OSMPBF::TagView& tags) {
+    const auto* keys = keys_[static_cast<int>(type)];
+    if (keys == nullptr)
+      return true;
+    for (size_t i = 0; i < tags.size(); ++i) {
+      auto& known = interesting_[tags.key_id(i)];
+      if (known < 0) {
+        const auto& key = block.strings[tags.key_id(i)];
+        scratch_.assign(key.data(), key.size());
+        known = keys->find(scratch_) != keys->end();
+      }
+      if (known)
+        return true;
+    }
+    return false;
+  }
+
+  // How often the lua results were already in the cache since the last time we asked
+  void log_cache() {
+    if (transformed_ || !cached_)
+      return;
+    LOG_INFO("Tag transform cache: " + std::to_string(lua_.CacheHits()) + " hits, " + std::to_string(lua_.CacheMisses()) + " misses");
+    lua_.ClearCacheStats();
+  }
+
+  // Same as above but for a bunch of objects at once spread over all the lua states
+  void transform(const OSMType type, const std::vector<OSMPBF::TagView>& tags, std::vector<Tags>& results) {
+    if (transformed_) {
+      results.resize(tags.size());
+      for (size_t i = 0; i < tags.size(); ++i)
+        results[i] = tags[i].to_tags();
+    }
+    else
+      lua_.Transform(type, tags, results);
+  }
+
+  void node_callback(uint64_t osmid, double lng, double lat, const Tags &results) {
     // Check if it is in the list of nodes used by ways
     if (!shape_.IsUsed(osmid)) {
       return;
     }
 
-    // Get tags
-    Tags results = lua_.Transform(OSMType::kNode, tags);
+    // Transformed tags
     if (results.size() == 0)
       return;
 
@@ -83,13 +188,50 @@ struct graph_callback : public OSMPBF::Callback {
       throw std::runtime_error("Detected unsorted input data");
     last_node_ = osmid;
 
+    if (extract_)
+      extract_->node(osmid, lng, lat, results);
+
+    OSMNode n{osmid, static_cast<float>(lng), static_cast<float>(lat)};
+    set_attributes(n, results);
+    add_node(n, results);
+
+    // With the locations on the ways the way nodes already have their coordinates
+    // so we just keep the attributes of the few nodes with tags for later
+    if (locations_) {
+      tagged_nodes_.emplace(osmid, n.attributes_);
+      return;
+    }
+
+    // Set the intersection flag (relies on ways being processed first to set
+    // the intersection Id markers).
+    if (intersection_.IsUsed(osmid)) {
+      n.set_intersection(true);
+      osmdata_.intersection_count++;
+    }
+
+    //the way nodes that use it are updated along with a run of the nodes that come after it
+    run_.push_back(n);
+    if (run_.size() == kJoinNodes)
+      join_nodes();
+
+    if (++osmdata_.osm_node_count % 5000000 == 0) {
+      LOG_DEBUG("Processed " + std::to_string(osmdata_.osm_node_count) + " nodes on ways");
+    }
+  }
+
+  // Update the way nodes of the nodes we have gathered up
+  void join_nodes() {
+    join_->Join(run_);
+    run_.clear();
+  }
+
+  // Set the attributes of a node from its transformed tags, nothing else is touched so
+  // it also gives the attributes of nodes that have no tags
+  static void set_attributes(OSMNode& n, const Tags& results) {
     const auto& highway_junction = results.find("highway");
     bool is_highway_junction = ((highway_junction != results.end())
         && (highway_junction->second == "motorway_junction"));
 
-    // Create a new node and set its attributes
-    OSMNode n{osmid, static_cast<float>(lng), static_cast<float>(lat)};
-
     if (is_highway_junction)
       n.set_type(NodeType::kMotorWayJunction);
 
@@ -105,58 +247,29 @@ struct graph_callback : public OSMPBF::Callback {
         n.set_backward_signal(tag.second == "true" ? true : false);
       }
       else if (is_highway_junction && (tag.first == "exit_to")) {
-        bool hasTag = (tag.second.length() ? true : false);
-        n.set_exit_to(hasTag);
-        if (hasTag)
-          osmdata_.node_exit_to[osmid] = tag.second;
+        n.set_exit_to(tag.second.length() ? true : false);
       }
       else if (is_highway_junction && (tag.first == "ref")) {
-        bool hasTag = (tag.second.length() ? true : false);
-        n.set_ref(hasTag);
-        if (hasTag)
-          osmdata_.node_ref[osmid] = tag.second;
+        n.set_ref(tag.second.length() ? true : false);
       }
       else if (is_highway_junction && (tag.first == "name")) {
-        bool hasTag = (tag.second.length() ? true : false);
-        n.set_name(hasTag);
-        if (hasTag)
-          osmdata_.node_name[osmid] = tag.second;
+        n.set_name(tag.second.length() ? true : false);
       }
       else if (tag.first == "gate") {
-        if (tag.second == "true") {
-          if (!intersection_.IsUsed(osmid)) {
-            intersection_.set(osmid);
-            ++osmdata_.edge_count;
-          }
+        if (tag.second == "true")
           n.set_type(NodeType::kGate);
-        }
       }
       else if (tag.first == "bollard") {
-        if (tag.second == "true") {
-          if (!intersection_.IsUsed(osmid)) {
-            intersection_.set(osmid);
-            ++osmdata_.edge_count;
-          }
+        if (tag.second == "true")
           n.set_type(NodeType::kBollard);
-        }
       }
       else if (tag.first == "toll_booth") {
-        if (tag.second == "true") {
-          if (!intersection_.IsUsed(osmid)) {
-            intersection_.set(osmid);
-            ++osmdata_.edge_count;
-          }
+        if (tag.second == "true")
           n.set_type(NodeType::kTollBooth);
-        }
       }
       else if (tag.first == "border_control") {
-        if (tag.second == "true") {
-          if (!intersection_.IsUsed(osmid)) {
-            intersection_.set(osmid);
-            ++osmdata_.edge_count;
-          }
+        if (tag.second == "true")
           n.set_type(NodeType::kBorderControl);
-        }
       }
       else if (tag.first == "access_mask")
         n.set_access_mask(std::stoi(tag.second));
@@ -166,39 +279,155 @@ struct graph_callback : public OSMPBF::Callback {
         n.set_payment_mask(std::stoi(tag.second));
       */
     }
+  }
 
-    // Set the intersection flag (relies on ways being processed first to set
-    // the intersection Id markers).
-    if (intersection_.IsUsed(osmid)) {
-      n.set_intersection(true);
-      osmdata_.intersection_count++;
+  // Keep the strings of a node that set_attributes flagged and split the edges at barriers
+  void add_node(const OSMNode& n, const Tags& results) {
+    if (n.exit_to())
+      osmdata_.node_exit_to.set(n.osmid, results.find("exit_to")->second);
+    if (n.ref())
+      osmdata_.node_ref.set(n.osmid, results.find("ref")->second);
+    if (n.name())
+      osmdata_.node_name.set(n.osmid, results.find("name")->second);
+    switch (n.type()) {
+      case NodeType::kGate:
+      case NodeType::kBollard:
+      case NodeType::kTollBooth:
+      case NodeType::kBorderControl:
+        if (!intersection_.set(n.osmid))
+          ++osmdata_.edge_count;
+        break;
+      default:
+        break;
     }
+  }
 
-    //find a node we need to update
-    current_way_node_index_ = way_nodes_->find_first_of(OSMWayNode{{osmid}},
-      [](const OSMWayNode& a, const OSMWayNode& b) { return a.node.osmid == b.node.osmid; },
-      current_way_node_index_);
-    //we found the first one
-    if(current_way_node_index_ < way_nodes_->size()) {
-      //update all the nodes that match it
-      OSMWayNode way_node;
-      sequence<OSMWayNode>::iterator element = (*way_nodes_)[current_way_node_index_];
-      while(current_way_node_index_ < way_nodes_->size() && (way_node = element = (*way_nodes_)[current_way_node_index_]).node.osmid == osmid) {
-        way_node.node = n;
-        element = way_node;
-        ++current_way_node_index_;
-      }
-
-      if (++osmdata_.osm_node_count % 5000000 == 0) {
-        LOG_DEBUG("Processed " + std::to_string(osmdata_.osm_node_count) + " nodes on ways");
-      }
-    }//if we hit the end of the nodes and didnt find it that is a problem
-    else {
-      throw std::runtime_error("Didn't find OSMWayNode for node id: " + std::to_string(osmid));
+  // With the locations on the ways the way nodes were written with their coordinates and
+  // the attributes of an untagged node, so one run through them in way order fills in the
+  // attributes of the tagged nodes and the intersection markers without sorting by node id.
+  // An intersection is on more than one way node so each is only counted the first time
+  void finalize_way_nodes() {
+    OSMWayNode way_node;
+    IdTable counted;
+    for (size_t i = 0; i < way_nodes_->size(); ++i) {
+      sequence<OSMWayNode>::iterator element = (*way_nodes_)[i];
+      way_node = element;
+      const auto tagged = tagged_nodes_.find(way_node.node.osmid);
+      const bool intersection = intersection_.IsUsed(way_node.node.osmid);
+      if (tagged == tagged_nodes_.end() && !intersection)
+        continue;
+      if (intersection && !counted.set(way_node.node.osmid))
+        osmdata_.intersection_count++;
+      if (tagged != tagged_nodes_.end())
+        way_node.node.attributes_ = tagged->second;
+      way_node.node.set_intersection(intersection);
+      element = way_node;
+    }
+    tagged_nodes_.clear();
+  }
+
+  // The tags of everything in the block we care about are transformed up front so that lua can
+  // run on all the threads, then the objects are handled one at a time in the order they came in.
+  // Objects without any tags the transform looks at get what an object without tags comes out as
+  void block_callback(const OSMPBF::Block& block) {
+    // Only look at the tags of nodes that are used by ways, with the locations on the ways
+    // only nodes that have tags of interest have anything left to tell us
+    indices_.clear();
+    slots_.clear();
+    views_.clear();
+    interesting_.assign(block.strings.size(), -1);
+    for (size_t i = 0; i < block.node_count(); ++i) {
+      if (locations_ && block.node_tag_offsets[i] == block.node_tag_offsets[i + 1])
+        continue;
+      if (shape_.IsUsed(block.node_ids[i])) {
+        const auto tags = block.node_tags(i);
+        const bool needed = interesting(OSMType::kNode, block, tags);
+        if (!needed && locations_)
+          continue;
+        indices_.push_back(i);
+        slots_.push_back(needed ? views_.size() : kNone);
+        if (needed)
+          views_.push_back(tags);
+      }
+    }
+    transform(OSMType::kNode, views_, results_);
+    for (size_t j = 0; j < indices_.size(); ++j) {
+      const auto i = indices_[j];
+      node_callback(block.node_ids[i], block.node_lngs[i], block.node_lats[i], result(OSMType::kNode, slots_[j]));
+    }
+
+    // Ways with < 2 nodes are skipped before transforming their tags or copying their refs
+    if (locations_ && block.way_count() && block.way_lngs.empty())
+      throw std::runtime_error("Expected the locations of the nodes on the ways");
+    indices_.clear();
+    slots_.clear();
+    views_.clear();
+    interesting_.assign(block.strings.size(), -1);
+    for (size_t i = 0; i < block.way_count(); ++i) {
+      if (block.way_ref_offsets[i + 1] - block.way_ref_offsets[i] < 2)
+        continue;
+      if (!add(OSMType::kWay, block, block.way_tags(i)))
+        continue;
+      indices_.push_back(i);
+    }
+    transform(OSMType::kWay, views_, results_);
+    for (size_t j = 0; j < indices_.size(); ++j) {
+      const auto i = indices_[j];
+      block.refs(i, refs_);
+      if (locations_)
+        way_callback(block.way_ids[i], result(OSMType::kWay, slots_[j]), refs_, &block.way_lngs[block.way_ref_offsets[i]],
+                     &block.way_lats[block.way_ref_offsets[i]]);
+      else
+        way_callback(block.way_ids[i], result(OSMType::kWay, slots_[j]), refs_);
+    }
+
+    indices_.clear();
+    slots_.clear();
+    views_.clear();
+    interesting_.assign(block.strings.size(), -1);
+    for (size_t i = 0; i < block.relation_count(); ++i) {
+      if (add(OSMType::kRelation, block, block.relation_tags(i)))
+        indices_.push_back(i);
+    }
+    transform(OSMType::kRelation, views_, results_);
+    for (size_t j = 0; j < indices_.size(); ++j) {
+      const auto i = indices_[j];
+      block.members(i, members_);
+      relation_callback(block.relation_ids[i], result(OSMType::kRelation, slots_[j]), members_);
     }
   }
 
-  void way_callback(uint64_t osmid, const OSMPBF::Tags &tags, const std::vector<uint64_t> &nodes) {
+  // Lines the tags up to be transformed if they need to be, returns false if there is no
+  // point in looking at the object at all because it comes out with no tags anyway
+  bool add(const OSMType type, const OSMPBF::Block& block, const OSMPBF::TagView& tags) {
+    if (interesting(type, block, tags)) {
+      slots_.push_back(views_.size());
+      views_.push_back(tags);
+    }
+    else if (!none_[static_cast<int>(type)].empty())
+      slots_.push_back(kNone);
+    else
+      return false;
+    return true;
+  }
+
+  // The transformed tags of an object from its slot
+  const Tags& result(const OSMType type, const size_t slot) const {
+    return slot == kNone ? none_[static_cast<int>(type)] : results_[slot];
+  }
+
+  bool skip_nodes(const uint64_t min_id, const uint64_t max_id) {
+    // Nothing in this range is used by a way
+    return !shape_.IsUsed(min_id, max_id);
+  }
+
+  bool done() {
+    // We've found all the nodes the ways need
+    return node_target_ != 0 && osmdata_.osm_node_count >= node_target_;
+  }
+
+  void way_callback(uint64_t osmid, const Tags &results, const std::vector<uint64_t> &nodes,
+                    const double* lngs = nullptr, const double* lats = nullptr) {
 
     // Do not add ways with < 2 nodes. Log error or add to a problem list
     // TODO - find out if we do need these, why they exist...
@@ -206,9 +435,8 @@ struct graph_callback : public OSMPBF::Callback {
       return;
     }
 
-    // Transform tags. If no results that means the way does not have tags
+    // Transformed tags. If no results that means the way does not have tags
     // suitable for use in routing.
-    Tags results = lua_.Transform(OSMType::kWay, tags);
     if (results.size() == 0) {
       return;
     }
@@ -229,19 +457,28 @@ struct graph_callback : public OSMPBF::Callback {
       throw std::runtime_error("Detected unsorted input data");
     last_way_ = osmid;
 
+    if (extract_)
+      extract_->way(osmid, results, nodes);
+
     // Add the refs to the reference list and mark the nodes that care about when processing nodes
     loop_nodes_.clear();
     for (size_t i = 0; i < nodes.size(); ++i) {
       const auto& node = nodes[i];
-      if(shape_.IsUsed(node)) {
+      // Whether another way (or this one) got here first has to be asked and answered at once
+      if(shape_.set(node)) {
         intersection_.set(node);
         ++osmdata_.edge_count;
       }
       else {
         ++osmdata_.node_count;
       }
-      way_nodes_->push_back({{node}, ways_->size(), i});
-      shape_.set(node);
+      if (lngs) {
+        OSMNode n{node, static_cast<float>(lngs[i]), static_cast<float>(lats[i])};
+        n.attributes_ = untagged_;
+        way_nodes_->push_back({n, ways_->size(), i});
+      }
+      else
+        way_nodes_->push_back({{node}, ways_->size(), i});
       // If this way is a loop (node occurs twice) we can make our lives way easier if we simply
       // split it up into multiple edges in the graph. If a problem is hard, avoid the problem!
       auto inserted = loop_nodes_.insert(std::make_pair(node, i));
@@ -725,7 +962,7 @@ struct graph_callback : public OSMPBF::Callback {
     // Delete the name from from name field if it exists in the ref.
     if (!name.empty() && w.ref_index()) {
       std::vector<std::string> names = GetTagTokens(name);
-      std::vector<std::string> refs = GetTagTokens(osmdata_.ref_offset_map.name(w.ref_index()));
+      std::vector<std::string> refs = GetTagTokens(osmdata_.ref_offset_map.view(w.ref_index()));
       bool bFound = false;
 
       std::string tmp;
@@ -762,9 +999,8 @@ struct graph_callback : public OSMPBF::Callback {
     ways_->push_back(w);
   }
 
-  void relation_callback(const uint64_t osmid, const OSMPBF::Tags &tags, const std::vector<OSMPBF::Member> &members) {
-    // Get tags
-    Tags results = lua_.Transform(OSMType::kRelation, tags);
+  void relation_callback(const uint64_t osmid, const Tags &results, const std::vector<OSMPBF::Member> &members) {
+    // Transformed tags
     if (results.size() == 0)
       return;
 
@@ -773,6 +1009,9 @@ struct graph_callback : public OSMPBF::Callback {
       throw std::runtime_error("Detected unsorted input data");
     last_relation_ = osmid;
 
+    if (extract_)
+      extract_->relation(osmid, results, members);
+
     OSMRestriction restriction;
     uint64_t from_way_id = 0;
     bool isRestriction = false;
@@ -920,12 +1159,12 @@ struct graph_callback : public OSMPBF::Callback {
             || boost::starts_with(direction, "West (")) || direction == "North"
             || direction == "South" || direction == "East"
             || direction == "West") {
-          auto iter = osmdata_.way_ref.find(member.member_id);
-          if (iter != osmdata_.way_ref.end())
-            osmdata_.way_ref[member.member_id] = iter->second + ";" + reference + "|"
-                + direction;
+          auto refs = osmdata_.way_ref.get(member.member_id);
+          if (!refs.empty())
+            osmdata_.way_ref.set(member.member_id, refs + ";" + reference + "|"
+                + direction);
           else
-            osmdata_.way_ref[member.member_id] = reference + "|" + direction;
+            osmdata_.way_ref.set(member.member_id, reference + "|" + direction);
         }
       }
     }
@@ -974,8 +1213,8 @@ struct graph_callback : public OSMPBF::Callback {
   //Road class assignment needs to be set to the highway cutoff for ferries and auto trains.
   RoadClass highway_cutoff_rc_;
 
-  // Lua Tag Transformation class
-  LuaTagTransform lua_;
+  // Tag transformation, either lua or compiled
+  TagTransformPool lua_;
 
   // Pointer to all the OSM data (for use by callbacks)
   OSMData& osmdata_;
@@ -983,15 +1222,37 @@ struct graph_callback : public OSMPBF::Callback {
   // Mark the OSM Node Ids used by ways
   // TODO: remove interesection_ as you already know it if you
   // encounter more than one consecutive OSMWayNode with the same id
+  // The way pass runs on one thread so these dont need to be concurrent tables, whose bitmap
+  // chunks take memory for how spread out the ids are rather than how many of them there are
   IdTable shape_, intersection_;
 
   // Ways and nodes written to file, nodes are written in the order they appear in way (shape)
   std::unique_ptr<sequence<OSMWay> > ways_;
   std::unique_ptr<sequence<OSMWayNode> > way_nodes_;
-  // When updating the references with the node information we keep the last index we looked at
-  // this lets us only have to iterate over the whole set once
-  size_t current_way_node_index_;
+  // The way nodes sorted by node id that the nodes are joined to and the nodes that are waiting
+  // to be, we only have to go through the way nodes once because the nodes come in id order
+  std::unique_ptr<WayNodeJoin> join_;
+  std::vector<OSMNode> run_;
   uint64_t last_node_, last_way_, last_relation_;
+  // How many nodes we expect to find in the node pass, 0 if we don't know
+  size_t node_target_;
+  // Reused for each way and relation in a block
+  std::vector<uint64_t> refs_;
+  std::vector<OSMPBF::Member> members_;
+  // Reused for the tags of the objects in a block that are transformed together
+  std::vector<size_t> indices_;
+  std::vector<OSMPBF::TagView> views_;
+  std::vector<Tags> results_;
+  // Where in the results each object is or kNone when it wasnt transformed
+  std::vector<size_t> slots_;
+
+  // The keys the transform looks at for each type of object, nullptr if it doesnt say, and what
+  // an object without any tags comes out as
+  const std::unordered_set<std::string>* keys_[3];
+  Tags none_[3];
+  // Whether each string of the block is a key the transform looks at, -1 until we know
+  std::vector<int8_t> interesting_;
+  std::string scratch_;
   std::unordered_map<uint64_t, size_t> loop_nodes_;
 
   // List of wayids with loops
@@ -999,8 +1260,48 @@ struct graph_callback : public OSMPBF::Callback {
 
   std::unique_ptr<sequence<OSMAccess> > access_;
 
+  // Whether the input is a routing extract whose tags have already been transformed
+  bool transformed_;
+  // Whether the transform is lua with a cache of its results, the native one has none
+  bool cached_;
+  // Where to write what passes the lua filter (already transformed) so the next run can skip lua
+  std::unique_ptr<OSMPBF::Writer> extract_;
+
+  // Whether the ways have the locations of their nodes, then we only look at nodes with tags
+  bool locations_;
+  // The attributes of a node without tags and those of the nodes used by ways that have tags
+  NodeAttributes untagged_;
+  std::unordered_map<uint64_t, NodeAttributes> tagged_nodes_;
 };
 
+// Identifies what went into a routing extract, if the transform or any of the input changes
+// the extract has to be rebuilt
+std::string extract_key(const std::string& transform, const std::vector<std::string>& input_files) {
+  std::string key = transform;
+  for (const auto& input_file : input_files) {
+    struct stat st;
+    if (stat(input_file.c_str(), &st) != 0)
+      throw std::runtime_error("Failed to stat: " + input_file);
+    key += ";" + input_file + "=" + std::to_string(st.st_size) + "@" + std::to_string(st.st_mtime);
+  }
+  return key;
+}
+
+// Whether there is a routing extract that was made from the same things we have now
+bool extract_matches(const std::string& routing_extract, const std::string& key) {
+  struct stat st;
+  if (stat(routing_extract.c_str(), &st) != 0)
+    return false;
+  try {
+    OSMPBF::MappedFile file(routing_extract);
+    return OSMPBF::Parser::header(file).source() == key;
+  }
+  catch (const std::exception& e) {
+    LOG_WARN("Ignoring routing extract " + routing_extract + ": " + e.what());
+  }
+  return false;
+}
+
 }
 
 namespace valhalla {
@@ -1012,6 +1313,10 @@ OSMData PBFGraphParser::Parse(const boost::property_tree::ptree& pt, const std::
   //option 2: synchronize around adding things to a single osmdata. will have to test to see
   //which is the least expensive (memory and speed). leaning towards option 2
   unsigned int threads = std::max(static_cast<unsigned int>(1), pt.get<unsigned int>("concurrency", std::thread::hardware_concurrency()));
+  //how much memory to sort the temporary files in before spilling sorted runs of them to disk
+  size_t sort_memory = pt.get<size_t>("sort_memory", kSortMemory);
+  //which pbf decoder to use, libprotobuf or walking the wire format directly
+  OSMPBF::Decoder decoder = pt.get<std::string>("pbf_decoder", "libprotobuf") == "wire" ? OSMPBF::WIRE : OSMPBF::LIBPROTOBUF;
 
   // Create OSM data. Set the member pointer so that the parsing callback methods can use it.
   OSMData osmdata{};
@@ -1019,91 +1324,146 @@ OSMData PBFGraphParser::Parse(const boost::property_tree::ptree& pt, const std::
   callback.reset(new sequence<OSMWay>(ways_file, true),
     new sequence<OSMWayNode>(way_nodes_file, true),
     new sequence<OSMAccess>(access_file, true));
-  LOG_INFO("Parsing files: " + boost::algorithm::join(input_files, ", "));
 
-  //hold open all the files so that if something else (like diff application)
+  //a routing extract has only the routable ways, the nodes they use and the relations we care about
+  //with their tags already transformed. if one was made from the same input and transform we can use it
+  //instead, otherwise we make one as we go so the next run can
+  std::vector<std::string> files = input_files;
+  auto routing_extract = pt.get_optional<std::string>("routing_extract");
+  if (routing_extract) {
+    OSMPBF::HeaderBlock header;
+    header.set_writingprogram("valhalla");
+    header.set_source(extract_key(graph_callback::transform_key(pt), input_files));
+    if (extract_matches(*routing_extract, header.source())) {
+      LOG_INFO("Using routing extract: " + *routing_extract);
+      files = { *routing_extract };
+      callback.transformed_ = true;
+    }
+    else {
+      LOG_INFO("Writing routing extract: " + *routing_extract);
+      callback.extract_.reset(new OSMPBF::Writer(*routing_extract, header));
+    }
+  }
+  LOG_INFO("Parsing files: " + boost::algorithm::join(files, ", "));
+
+  //hold all the files mapped so that if something else (like diff application)
   //needs to mess with them we wont have troubles with inodes changing underneath us
-  std::list<std::ifstream> file_handles;
-  for (const auto& input_file : input_files) {
-    file_handles.emplace_back(input_file, std::ios::binary);
-    if (!file_handles.back().is_open())
-      throw std::runtime_error("Unable to open: " + input_file);
+  //the blobs are inflated straight out of the mappings
+  std::list<OSMPBF::MappedFile> file_handles;
+  for (const auto& file : files)
+    file_handles.emplace_back(file);
+
+  //the first pass over each file records where its blobs are and what they have in them
+  //so that the passes after it can skip the blobs that have nothing of interest
+  std::vector<OSMPBF::BlobIndex> blob_indices(file_handles.size());
+
+  //what the transform looks at depends on whether the tags have already been through it
+  callback.prefilter();
+
+  //when every file has the node locations on its ways we dont have to join the nodes to the
+  //way nodes by id, only the wire decoder knows how to read them though
+  callback.locations_ = !file_handles.empty();
+  for (const auto& file_handle : file_handles) {
+    const auto features = OSMPBF::Parser::header(file_handle).optional_features();
+    callback.locations_ = callback.locations_ && std::find(features.begin(), features.end(), "LocationsOnWays") != features.end();
+  }
+  if (callback.locations_) {
+    LOG_INFO("Using the node locations on the ways");
+    //the transform still gives nodes without tags some attributes (ie access)
+    OSMNode untagged{};
+    graph_callback::set_attributes(untagged, callback.none_[static_cast<int>(OSMType::kNode)]);
+    callback.untagged_ = untagged.attributes_;
+    if (callback.extract_) {
+      LOG_WARN("Routing extract cannot keep the node locations on the ways, not writing it");
+      callback.extract_.reset();
+    }
   }
 
   // Parse the ways and find all node Ids needed (those that are part of a
   // way's node list. Iterate through each pbf input file.
   LOG_INFO("Parsing ways...")
-  for (auto& file_handle : file_handles) {
-    callback.current_way_node_index_ = callback.last_node_ = callback.last_way_ = callback.last_relation_ = 0;
-    OSMPBF::Parser::parse(file_handle, OSMPBF::Interest::WAYS, callback);
-  }
+  callback.last_node_ = callback.last_way_ = callback.last_relation_ = 0;
+  OSMPBF::Parser::parse(file_handles, OSMPBF::Interest::WAYS, callback, blob_indices, threads,
+    callback.locations_ ? OSMPBF::WIRE : decoder);
   callback.output_loops();
   callback.reset(nullptr, nullptr, nullptr);
   LOG_INFO("Finished with " + std::to_string(osmdata.osm_way_count) + " routable ways containing " + std::to_string(osmdata.osm_way_node_count) + " nodes");
+  callback.log_cache();
 
   // Parse relations.
   LOG_INFO("Parsing relations...")
-  for (auto& file_handle : file_handles) {
-    callback.current_way_node_index_ = callback.last_node_ = callback.last_way_ = callback.last_relation_ = 0;
-    OSMPBF::Parser::parse(file_handle, OSMPBF::Interest::RELATIONS, callback);
-  }
+  callback.last_node_ = callback.last_way_ = callback.last_relation_ = 0;
+  OSMPBF::Parser::parse(file_handles, OSMPBF::Interest::RELATIONS, callback, blob_indices, threads, decoder);
   LOG_INFO("Finished with " + std::to_string(osmdata.restrictions.size()) + " simple restrictions");
+  callback.log_cache();
+
+  // Nothing more is added to these so line them up by way id for looking up
+  osmdata.restrictions.Freeze();
+  osmdata.access_restrictions.Freeze();
+  osmdata.bike_relations.Freeze();
 
   //we need to sort the refs so that we can easily (sequentially) update them
-  //during node processing, we use memory mapping here because otherwise we aren't
-  //using much mem, the scoping makes sure to let it go when done sorting
-  LOG_INFO("Sorting osm way node references by node id...");
-  {
-    sequence<OSMWayNode> way_nodes(way_nodes_file, false);
-    way_nodes.sort(
-      [](const OSMWayNode& a, const OSMWayNode& b){
-        return a.node.osmid < b.node.osmid;
-      }
+  //during node processing. the ids are plain integers so we radix sort them
+  if (!callback.locations_) {
+    LOG_INFO("Sorting osm way node references by node id...");
+    SortFileByKey<OSMWayNode>(way_nodes_file, threads, sort_memory,
+      [](const OSMWayNode& a){ return a.node.osmid; }
     );
   }
   //we need to sort the access tags so that we can easily find them.
   LOG_INFO("Sorting osm access tags by way id...");
-  {
-    sequence<OSMAccess> access(access_file, false);
-    access.sort(
-      [](const OSMAccess& a, const OSMAccess& b){
-        return a.way_id() < b.way_id();
-      }
-    );
-  }
+  SortFileByKey<OSMAccess>(access_file, threads, sort_memory,
+    [](const OSMAccess& a){ return a.way_id(); }
+  );
 
   LOG_INFO("Finished");
 
   // Parse node in all the input files. Skip any that are not marked from
-  // being used in a way.
-  // TODO: we know how many knows we expect, stop early once we have that many
+  // being used in a way. The files are merged in node id order and nodes that
+  // are in more than one file only come through once, so we run through the way
+  // nodes file a single time, a chunk at a time, and can stop as soon as we've
+  // seen all we expect. With the locations on the ways we only collect the tagged
+  // nodes and then run through the way nodes once in way order
   LOG_INFO("Parsing nodes...");
-  for (auto& file_handle : file_handles) {
-    //each time we parse nodes we have to run through the way nodes file from the beginning because
-    //because osm node ids are only sorted at the single pbf file level
+  callback.node_target_ = callback.locations_ ? 0 : osmdata.node_count;
+  if (callback.locations_)
     callback.reset(nullptr, new sequence<OSMWayNode>(way_nodes_file, false), nullptr);
-    callback.current_way_node_index_ = callback.last_node_ = callback.last_way_ = callback.last_relation_ = 0;
-    OSMPBF::Parser::parse(file_handle, OSMPBF::Interest::NODES, callback);
+  else
+    callback.join_.reset(new WayNodeJoin(way_nodes_file, threads));
+  callback.last_node_ = callback.last_way_ = callback.last_relation_ = 0;
+  OSMPBF::Parser::parse(file_handles, OSMPBF::Interest::NODES, callback, blob_indices, threads, decoder);
+  if (callback.locations_) {
+    callback.finalize_way_nodes();
+    osmdata.osm_node_count = osmdata.node_count;
+  }
+  else {
+    callback.join_nodes();
+    callback.join_->Flush();
+    callback.join_.reset();
   }
   callback.reset(nullptr, nullptr, nullptr);
+  callback.node_target_ = 0;
   LOG_INFO("Finished with " + std::to_string(osmdata.osm_node_count) + " nodes contained in routable ways");
+  callback.log_cache();
+
+  //everything the routing extract needs has been seen
+  if (callback.extract_) {
+    callback.extract_->close();
+    callback.extract_.reset();
+    LOG_INFO("Finished writing routing extract");
+  }
 
   //done with pbf
   OSMPBF::Parser::free();
 
   //we need to sort the refs so that we easily iterate over them for building edges
-  //so we line them first by way index then by shape index of the node
-  LOG_INFO("Sorting osm way node references by way index and node shape index...");
-  {
-    sequence<OSMWayNode> way_nodes(way_nodes_file, false);
-    way_nodes.sort(
-      [](const OSMWayNode& a, const OSMWayNode& b){
-        if(a.way_index == b.way_index) {
-          //TODO: if its equal we have screwed something up, should we check and throw here?
-          return a.way_shape_node_index < b.way_shape_node_index;
-        }
-        return a.way_index < b.way_index;
-      }
+  //so we line them first by way index then by shape index of the node. with the
+  //locations on the ways they were never moved out of that order
+  if (!callback.locations_) {
+    LOG_INFO("Sorting osm way node references by way index and node shape index...");
+    SortFileByKey<OSMWayNode>(way_nodes_file, threads, sort_memory,
+      [](const OSMWayNode& a){ return a.way_index; },
+      [](const OSMWayNode& a){ return a.way_shape_node_index; }
     );
   }
   LOG_INFO("Finished");
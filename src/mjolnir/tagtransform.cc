@@ -0,0 +1,131 @@
+#include "mjolnir/tagtransform.h"
+
+#include <algorithm>
+
+using namespace valhalla::mjolnir;
+
+namespace {
+
+//the fewest objects a thread in the pool is given to transform at once
+constexpr size_t kMinTagsPerThread = 256;
+
+}
+
+TagTransformPool::TagTransformPool(const std::function<TagTransform*()>& make, const size_t size)
+  : tags_(nullptr), results_(nullptr), count_(0), remaining_(0), batch_(0), stop_(false) {
+  for (size_t i = 0; i < std::max(size, static_cast<size_t>(1)); ++i)
+    transforms_.emplace_back(make());
+  errors_.resize(transforms_.size());
+  for (size_t i = 1; i < transforms_.size(); ++i)
+    threads_.emplace_back(&TagTransformPool::Worker, this, i);
+}
+
+TagTransformPool::~TagTransformPool() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    stop_ = true;
+  }
+  start_.notify_all();
+  for (auto& thread : threads_)
+    thread.join();
+}
+
+const std::unordered_set<std::string>* TagTransformPool::Keys(OSMType type) const {
+  //theyre all the same
+  return transforms_.front()->Keys(type);
+}
+
+uint64_t TagTransformPool::CacheHits() const {
+  uint64_t hits = 0;
+  for (const auto& transform : transforms_)
+    hits += transform->CacheHits();
+  return hits;
+}
+
+uint64_t TagTransformPool::CacheMisses() const {
+  uint64_t misses = 0;
+  for (const auto& transform : transforms_)
+    misses += transform->CacheMisses();
+  return misses;
+}
+
+void TagTransformPool::ClearCacheStats() {
+  for (auto& transform : transforms_)
+    transform->ClearCacheStats();
+}
+
+size_t TagTransformPool::size() const {
+  return transforms_.size();
+}
+
+TagTransform& TagTransformPool::operator[](const size_t index) {
+  return *transforms_[index];
+}
+
+void TagTransformPool::Transform(OSMType type, const std::vector<OSMPBF::TagView>& tags, std::vector<Tags>& results) {
+  results.resize(tags.size());
+
+  //not worth waking threads for just a few
+  size_t count = std::min(transforms_.size(), (tags.size() + kMinTagsPerThread - 1) / kMinTagsPerThread);
+  if (count <= 1) {
+    for (size_t i = 0; i < tags.size(); ++i)
+      results[i] = transforms_[0]->Transform(type, tags[i]);
+    return;
+  }
+
+  //hand the batch to the threads, the first range is done on this thread
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    type_ = type;
+    tags_ = &tags;
+    results_ = &results;
+    count_ = count;
+    remaining_ = count - 1;
+    std::fill(errors_.begin(), errors_.end(), nullptr);
+    ++batch_;
+  }
+  start_.notify_all();
+  Work(0);
+  std::unique_lock<std::mutex> guard(lock_);
+  finish_.wait(guard, [this]() { return remaining_ == 0; });
+
+  //pass on the first thing that went wrong
+  for (const auto& error : errors_) {
+    if (error)
+      std::rethrow_exception(error);
+  }
+}
+
+void TagTransformPool::Work(const size_t index) {
+  //each transform gets a contiguous range of the objects and puts its results in the same spots
+  try {
+    const size_t size = tags_->size();
+    for (size_t i = index * size / count_; i < (index + 1) * size / count_; ++i)
+      (*results_)[i] = transforms_[index]->Transform(type_, (*tags_)[i]);
+  }
+  catch (...) {
+    errors_[index] = std::current_exception();
+  }
+}
+
+void TagTransformPool::Worker(const size_t index) {
+  uint64_t done = 0;
+  while (true) {
+    //wait for a batch this thread has a part in
+    {
+      std::unique_lock<std::mutex> guard(lock_);
+      start_.wait(guard, [this, done]() { return stop_ || batch_ != done; });
+      if (stop_)
+        return;
+      done = batch_;
+      if (index >= count_)
+        continue;
+    }
+    Work(index);
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      if (--remaining_ == 0)
+        finish_.notify_one();
+    }
+  }
+}
@@ -1,54 +1,106 @@
 #include "mjolnir/uniquenames.h"
 
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
 #include <valhalla/midgard/logging.h>
 
+namespace {
+
+// Slots in the hash table to start with, always a power of 2
+constexpr size_t kInitialSlots = 1024;
+
+// Number of shards the concurrent names are split into, also a power of 2
+constexpr uint32_t kShardBits = 6;
+constexpr uint32_t kShards = 1 << kShardBits;
+constexpr uint32_t kShardMask = kShards - 1;
+
+}
+
 namespace valhalla {
 namespace mjolnir {
 
 // Constructor
 UniqueNames::UniqueNames() {
   // Insert dummy so index 0 is never used
-  index("");
+  Clear();
 }
 
 // Get an index given a name. Add the name if it is not in the current list
 // of unique names
-uint32_t UniqueNames::index(const std::string& name) {
-  // Find the name in the map. If it is there return the index.
-  uint32_t index = 0;
-  auto it = names_.find(name);
-  if (it != names_.end()) {
-     index = it->second;
-  }
-  else {
-     // Not in the map, add index and update
-     it = names_.insert(it, NamesMap::value_type(name, 0));
-     indexes_.push_back(it);
-     index = indexes_.size() - 1;
-     it->second = index;
+uint32_t UniqueNames::index(const boost::string_ref& name) {
+  return index(name, Hash(name));
+}
+
+// Same as above with the hash worked out already
+uint32_t UniqueNames::index(const boost::string_ref& name, const uint64_t hash) {
+  // The blank name is always at 0
+  if (name.empty())
+    return 0;
+  if (spilled_)
+    throw std::runtime_error("UniqueNames - cannot add names once spilled to a file");
+
+  // Look through the slots from where the hash puts us until we find the name or
+  // an empty slot
+  const uint32_t partial = static_cast<uint32_t>(hash >> 32);
+  const size_t mask = table_.size() - 1;
+  size_t slot = hash & mask;
+  for (; table_[slot] != 0; slot = (slot + 1) & mask) {
+    const uint32_t i = table_[slot];
+    if (hashes_[i] == partial && view(i) == name)
+      return i;
   }
+
+  // Not there so add it to the end of the names and into the empty slot
+  if (offsets_.size() > std::numeric_limits<uint32_t>::max())
+    throw std::runtime_error("UniqueNames - too many names");
+  const uint32_t index = hashes_.size();
+  names_.insert(names_.end(), name.begin(), name.end());
+  offsets_.push_back(names_.size());
+  hashes_.push_back(partial);
+  table_[slot] = index;
+
+  // Keep the table at most half full so the runs of full slots stay short
+  if (hashes_.size() * 2 > table_.size())
+    Grow();
   return index;
 }
 
 // Get the name given the index
-const std::string& UniqueNames::name(const uint32_t index) const {
-  if (index < (uint32_t)indexes_.size())
-    return indexes_[index]->first;
+std::string UniqueNames::name(const uint32_t index) const {
+  return view(index).to_string();
+}
+
+// Get the name given the index without copying it
+boost::string_ref UniqueNames::view(const uint32_t index) const {
+  if (spilled_) {
+    if (index >= spilled_count_)
+      return boost::string_ref();
+    return boost::string_ref(spilled_names_ + spilled_offsets_[index], spilled_offsets_[index + 1] - spilled_offsets_[index]);
+  }
 
   // Return the empty string in the index 0 location
-  return indexes_[0]->first;
+  if (index >= hashes_.size())
+    return boost::string_ref();
+  return boost::string_ref(names_.data() + offsets_[index], offsets_[index + 1] - offsets_[index]);
 }
 
 // Clear the unique names list
 void UniqueNames::Clear() {
-  names_.clear();
-  indexes_.clear();
+  spilled_.reset();
+  spilled_count_ = 0;
+  std::vector<char>().swap(names_);
+  offsets_.assign(2, 0);
+  hashes_.assign(1, 0);
+  table_.assign(kInitialSlots, 0);
 }
 
 // Get the number of unique names. Since a blank name is added as the first
 // unique name we return the size of the map - 1.
 size_t UniqueNames::Size() const {
-  return names_.size() - 1;
+  return (spilled_ ? spilled_count_ : hashes_.size()) - 1;
 }
 
 /**
@@ -56,7 +108,122 @@ size_t UniqueNames::Size() const {
  */
 void UniqueNames::Log() const {
   LOG_DEBUG("Number of names: " + std::to_string(Size()));
-  LOG_DEBUG("Number of indexes: " + std::to_string(indexes_.size()));
+  LOG_DEBUG("Number of characters: " + std::to_string(spilled_ ? spilled_offsets_[spilled_count_] : names_.size()));
+  LOG_DEBUG("Number of hash slots: " + std::to_string(table_.size()));
+}
+
+// Write the number of names, their offsets and then their characters to a file
+// and read them out of it from then on
+void UniqueNames::Spill(const std::string& file_name) {
+  if (spilled_)
+    return;
+  const uint64_t count = hashes_.size();
+  {
+    std::ofstream file(file_name, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    file.write(reinterpret_cast<const char*>(offsets_.data()), offsets_.size() * sizeof(uint64_t));
+    file.write(names_.data(), names_.size());
+    if (!file)
+      throw std::runtime_error("UniqueNames - failed to write " + file_name);
+  }
+
+  // The mapping outlives the file so it can be removed right away
+  const size_t header = (count + 2) * sizeof(uint64_t);
+  spilled_.reset(new midgard::mem_map<char>());
+  spilled_->map(file_name, header + names_.size());
+  std::remove(file_name.c_str());
+  spilled_count_ = count;
+  spilled_offsets_ = reinterpret_cast<const uint64_t*>(spilled_->get()) + 1;
+  spilled_names_ = spilled_->get() + header;
+
+  // Nothing is left to look names up with so the table can go too
+  std::vector<char>().swap(names_);
+  std::vector<uint64_t>().swap(offsets_);
+  std::vector<uint32_t>().swap(hashes_);
+  std::vector<uint32_t>().swap(table_);
+}
+
+// FNV-1a with the bits mixed up at the end, since the low bits pick the slot
+uint64_t UniqueNames::Hash(const boost::string_ref& name) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (const char c : name) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ULL;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+// Makes the table twice as big and puts the indexes back in it. Only the
+// partial hash is kept so the low bits have to be worked out again
+void UniqueNames::Grow() {
+  std::vector<uint32_t> table(table_.size() * 2, 0);
+  const size_t mask = table.size() - 1;
+  for (uint32_t i = 1; i < hashes_.size(); ++i) {
+    size_t slot = Hash(view(i)) & mask;
+    while (table[slot] != 0)
+      slot = (slot + 1) & mask;
+    table[slot] = i;
+  }
+  table_.swap(table);
+}
+
+// Constructor
+ConcurrentUniqueNames::ConcurrentUniqueNames() : shards_(new Shard[kShards]) {
+}
+
+// Get an index given a name from whichever shard the name's hash picks. The
+// shard uses the low bits of the hash to pick slots so we use the high ones
+uint32_t ConcurrentUniqueNames::index(const boost::string_ref& name) {
+  if (name.empty())
+    return 0;
+  const uint64_t hash = UniqueNames::Hash(name);
+  const uint32_t shard = (hash >> (64 - kShardBits)) & kShardMask;
+  uint32_t index;
+  {
+    std::lock_guard<std::mutex> lock(shards_[shard].lock);
+    index = shards_[shard].names.index(name, hash);
+  }
+  if (index > (std::numeric_limits<uint32_t>::max() >> kShardBits))
+    throw std::runtime_error("ConcurrentUniqueNames - too many names");
+  return (index << kShardBits) | shard;
+}
+
+// Get the name given the index
+std::string ConcurrentUniqueNames::name(const uint32_t index) const {
+  const auto& shard = shards_[index & kShardMask];
+  std::lock_guard<std::mutex> lock(shard.lock);
+  return shard.names.name(index >> kShardBits);
+}
+
+// Clear the unique names list
+void ConcurrentUniqueNames::Clear() {
+  for (uint32_t i = 0; i < kShards; ++i) {
+    std::lock_guard<std::mutex> lock(shards_[i].lock);
+    shards_[i].names.Clear();
+  }
+}
+
+// Get the number of unique names over all of the shards
+size_t ConcurrentUniqueNames::Size() const {
+  size_t size = 0;
+  for (uint32_t i = 0; i < kShards; ++i) {
+    std::lock_guard<std::mutex> lock(shards_[i].lock);
+    size += shards_[i].names.Size();
+  }
+  return size;
+}
+
+/**
+ * Log information about the number of unique names, size of the vector, etc.
+ */
+void ConcurrentUniqueNames::Log() const {
+  LOG_DEBUG("Number of names: " + std::to_string(Size()));
+  LOG_DEBUG("Number of shards: " + std::to_string(kShards));
 }
 
 }
@@ -9,7 +9,7 @@ namespace mjolnir {
 /**
  * Splits a tag into a vector of strings.  Delim defaults to ;
  */
-std::vector<std::string> GetTagTokens(const std::string& tag_value,
+std::vector<std::string> GetTagTokens(const boost::string_ref& tag_value,
                                       char delim) {
   std::vector<std::string> tokens;
   boost::algorithm::split(tokens, tag_value,
@@ -0,0 +1,120 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "config.h"
+
+#include <boost/program_options.hpp>
+
+#include "mjolnir/densenodes.h"
+
+namespace bpo = boost::program_options;
+using namespace OSMPBF;
+
+size_t node_count = 8000;
+size_t iterations = 2000;
+
+bool ParseArguments(int argc, char *argv[]) {
+  bpo::options_description options(
+      "densenodesbenchmark " VERSION "\n"
+      "\n"
+      " Usage: densenodesbenchmark [options] \n"
+      "\n"
+      "densenodesbenchmark is a program to time the decoding of dense nodes "
+      "\n"
+      "\n");
+
+  options.add_options()
+              ("help,h", "Print this help message.")
+              ("version,v", "Print the version of this software.")
+              ("count,n", bpo::value<size_t>(&node_count), "Number of nodes in each group of dense nodes.")
+              ("iterations,i", bpo::value<size_t>(&iterations), "Number of times to decode the group.");
+
+  bpo::variables_map vm;
+  try {
+    bpo::store(bpo::command_line_parser(argc, argv).options(options).run(), vm);
+    bpo::notify(vm);
+
+  } catch (std::exception &e) {
+    std::cerr << "Unable to parse command line options because: " << e.what()
+              << "\n" << "This is a bug, please report it at " PACKAGE_BUGREPORT
+              << "\n";
+    return false;
+  }
+
+  if (vm.count("help")) {
+    std::cout << options << "\n";
+    return false;
+  }
+
+  if (vm.count("version")) {
+    std::cout << "densenodesbenchmark " << VERSION << "\n";
+    return false;
+  }
+
+  return true;
+}
+
+// times a decoding function and reports how many nodes it got through per second
+template <class decode_t>
+void Time(const std::string& name, const decode_t& decode) {
+  std::vector<uint64_t> ids;
+  std::vector<double> lngs, lats;
+  ids.reserve(node_count);
+  lngs.reserve(node_count);
+  lats.reserve(node_count);
+  double checksum = 0;
+
+  auto t1 = std::chrono::high_resolution_clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    ids.clear();
+    lngs.clear();
+    lats.clear();
+    decode(ids, lngs, lats);
+    checksum += ids.back() + lngs.back() + lats.back();
+  }
+  auto t2 = std::chrono::high_resolution_clock::now();
+
+  double secs = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() * 0.000001;
+  std::cout << name << ": " << static_cast<uint64_t>(node_count * iterations / secs) << " nodes/s"
+            << " (checksum " << checksum << ")" << std::endl;
+}
+
+int main(int argc, char** argv) {
+  if (!ParseArguments(argc, argv))
+    return EXIT_FAILURE;
+  if (node_count == 0 || iterations == 0)
+    return EXIT_FAILURE;
+
+  //a group of dense nodes with deltas like you'd see in a real extract
+  DenseNodes dense;
+  for (size_t i = 0; i < node_count; ++i) {
+    dense.add_id(rand() % 100 + 1);
+    dense.add_lat(rand() % 20001 - 10000);
+    dense.add_lon(rand() % 20001 - 10000);
+  }
+  const int64_t lat_offset = 0, lon_offset = 0;
+  const int32_t granularity = 100;
+
+  //the way the parser used to decode them one at a time
+  Time("scalar", [&](std::vector<uint64_t>& ids, std::vector<double>& lngs, std::vector<double>& lats) {
+    uint64_t id = 0;
+    double lon = 0, lat = 0;
+    for (int i = 0; i < dense.id_size(); ++i) {
+      id += dense.id(i);
+      lon += 0.000000001 * (lon_offset + (granularity * dense.lon(i)));
+      lat += 0.000000001 * (lat_offset + (granularity * dense.lat(i)));
+      ids.push_back(id);
+      lngs.push_back(lon);
+      lats.push_back(lat);
+    }
+  });
+
+  //the kernel
+  Time("kernel", [&](std::vector<uint64_t>& ids, std::vector<double>& lngs, std::vector<double>& lats) {
+    decode_dense_nodes(dense, lat_offset, lon_offset, granularity, ids, lngs, lats);
+  });
+
+  return EXIT_SUCCESS;
+}
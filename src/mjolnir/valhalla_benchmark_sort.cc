@@ -0,0 +1,137 @@
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "config.h"
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <valhalla/midgard/sequence.h>
+
+#include "mjolnir/osmdata.h"
+#include "mjolnir/sortfile.h"
+
+namespace bpo = boost::program_options;
+using namespace valhalla::midgard;
+using namespace valhalla::mjolnir;
+
+std::string input_file;
+unsigned int threads = std::max(static_cast<unsigned int>(1), std::thread::hardware_concurrency());
+size_t memory = kSortMemory;
+
+bool ParseArguments(int argc, char *argv[]) {
+  bpo::options_description options(
+      "sortbenchmark " VERSION "\n"
+      "\n"
+      " Usage: sortbenchmark [options] way_nodes.bin\n"
+      "\n"
+      "sortbenchmark is a program to time sorting the way nodes file that "
+      "valhalla_build_tiles leaves behind, the way the parser used to on one "
+      "thread, by comparing them on all the threads and by radix sorting their "
+      "node ids"
+      "\n"
+      "\n");
+
+  options.add_options()
+              ("help,h", "Print this help message.")
+              ("version,v", "Print the version of this software.")
+              ("concurrency,j", bpo::value<unsigned int>(&threads), "Number of threads to sort with.")
+              ("memory,m", bpo::value<size_t>(&memory), "Number of bytes to sort in before using temporary files.")
+              ("input_file", bpo::value<std::string>(&input_file), "Way nodes file to sort, it is not changed.");
+
+  bpo::positional_options_description pos_options;
+  pos_options.add("input_file", 1);
+
+  bpo::variables_map vm;
+  try {
+    bpo::store(bpo::command_line_parser(argc, argv).options(options).positional(pos_options).run(), vm);
+    bpo::notify(vm);
+
+  } catch (std::exception &e) {
+    std::cerr << "Unable to parse command line options because: " << e.what()
+              << "\n" << "This is a bug, please report it at " PACKAGE_BUGREPORT
+              << "\n";
+    return false;
+  }
+
+  if (vm.count("help")) {
+    std::cout << options << "\n";
+    return false;
+  }
+
+  if (vm.count("version")) {
+    std::cout << "sortbenchmark " << VERSION << "\n";
+    return false;
+  }
+
+  if (!vm.count("input_file")) {
+    std::cerr << "Input file is required\n\n" << options << "\n\n";
+    return false;
+  }
+
+  return true;
+}
+
+// sorts a fresh copy of the input and reports how many way nodes it got through per second
+template <class sort_t>
+void Time(const std::string& name, const std::string& file_name, const sort_t& sort) {
+  boost::filesystem::copy_file(input_file, file_name, boost::filesystem::copy_option::overwrite_if_exists);
+  const size_t count = boost::filesystem::file_size(file_name) / sizeof(OSMWayNode);
+
+  auto t1 = std::chrono::high_resolution_clock::now();
+  sort(file_name);
+  auto t2 = std::chrono::high_resolution_clock::now();
+
+  double secs = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() * 0.000001;
+  std::cout << name << ": " << secs << " s, " << static_cast<uint64_t>(count / secs) << " way nodes/s" << std::endl;
+}
+
+int main(int argc, char** argv) {
+  if (!ParseArguments(argc, argv))
+    return EXIT_FAILURE;
+  threads = std::max(static_cast<unsigned int>(1), threads);
+
+  //the way the parser used to sort them
+  const std::string sequenced = input_file + ".sequenced";
+  Time("sequence", sequenced, [](const std::string& file_name) {
+    sequence<OSMWayNode> way_nodes(file_name, false);
+    way_nodes.sort([](const OSMWayNode& a, const OSMWayNode& b) {
+      return a.node.osmid < b.node.osmid;
+    });
+  });
+
+  //by comparing them on all the threads
+  const std::string compared = input_file + ".compared";
+  Time("compare", compared, [](const std::string& file_name) {
+    SortFile<OSMWayNode>(file_name, [](const OSMWayNode& a, const OSMWayNode& b) {
+      return a.node.osmid < b.node.osmid;
+    }, threads, memory);
+  });
+
+  //by the node id alone
+  const std::string radixed = input_file + ".radixed";
+  Time("radix", radixed, [](const std::string& file_name) {
+    SortFileByKey<OSMWayNode>(file_name, threads, memory, [](const OSMWayNode& a) { return a.node.osmid; });
+  });
+
+  //all of them should have the ids in the same order
+  std::ifstream a(compared, std::ios::binary), b(radixed, std::ios::binary), c(sequenced, std::ios::binary);
+  OSMWayNode x, y, z;
+  bool same = true;
+  while (same && a.read(reinterpret_cast<char*>(&x), sizeof(x)) && b.read(reinterpret_cast<char*>(&y), sizeof(y)) &&
+         c.read(reinterpret_cast<char*>(&z), sizeof(z)))
+    same = x.node.osmid == y.node.osmid && x.node.osmid == z.node.osmid;
+  boost::filesystem::remove(sequenced);
+  boost::filesystem::remove(compared);
+  boost::filesystem::remove(radixed);
+  if (!same) {
+    std::cerr << "The sorts disagree" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,161 @@
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "config.h"
+
+#include <boost/program_options.hpp>
+
+#include "mjolnir/graphtagtransform.h"
+#include "mjolnir/luatagtransform.h"
+#include "mjolnir/osmpbfparser.h"
+#include "graph_lua_proc.h"
+
+#ifdef HAVE_LUAJIT
+#include <luajit.h>
+#endif
+
+namespace bpo = boost::program_options;
+using namespace valhalla::mjolnir;
+
+std::string input_file;
+std::string lua_file;
+size_t iterations = 1;
+size_t cache_size = 65536;
+
+bool ParseArguments(int argc, char *argv[]) {
+  bpo::options_description options(
+      "tagtransformbenchmark " VERSION "\n"
+      "\n"
+      " Usage: tagtransformbenchmark [options] <input_file>\n"
+      "\n"
+      "tagtransformbenchmark is a program to time transforming the tags of "
+      "every object in an osm pbf extract with lua and with the compiled "
+      "graph tag transform. Build with and without --with-luajit to compare "
+      "interpreters"
+      "\n"
+      "\n");
+
+  options.add_options()
+              ("help,h", "Print this help message.")
+              ("version,v", "Print the version of this software.")
+              ("lua,l", bpo::value<std::string>(&lua_file), "Lua script to time instead of the built in lua/graph.lua.")
+              ("iterations,i", bpo::value<size_t>(&iterations), "Number of times to transform each block.")
+              ("cache-size,c", bpo::value<size_t>(&cache_size), "Size of the cache to time lua with.")
+              ("input_file", bpo::value<std::string>(&input_file), "OSM pbf extract to read the tags from.");
+
+  bpo::positional_options_description pos_options;
+  pos_options.add("input_file", 1);
+
+  bpo::variables_map vm;
+  try {
+    bpo::store(bpo::command_line_parser(argc, argv).options(options).positional(pos_options).run(), vm);
+    bpo::notify(vm);
+
+  } catch (std::exception &e) {
+    std::cerr << "Unable to parse command line options because: " << e.what()
+              << "\n" << "This is a bug, please report it at " PACKAGE_BUGREPORT
+              << "\n";
+    return false;
+  }
+
+  if (vm.count("help")) {
+    std::cout << options << "\n";
+    return false;
+  }
+
+  if (vm.count("version")) {
+    std::cout << "tagtransformbenchmark " << VERSION << "\n";
+    return false;
+  }
+
+  if (!vm.count("input_file")) {
+    std::cerr << "An input pbf file is required\n\n" << options << "\n";
+    return false;
+  }
+
+  return true;
+}
+
+// a transform and how long its taken so far
+struct timed_t {
+  std::string name;
+  std::unique_ptr<TagTransform> transform;
+  double secs;
+  uint64_t checksum;
+};
+
+// times each transform on the tags of each block as they are parsed
+struct timer : public OSMPBF::BlockCallback {
+  void block_callback(const OSMPBF::Block& block) {
+    std::vector<OSMPBF::TagView> nodes, ways, relations;
+    for (size_t i = 0; i < block.node_count(); ++i)
+      nodes.push_back(block.node_tags(i));
+    for (size_t i = 0; i < block.way_count(); ++i)
+      ways.push_back(block.way_tags(i));
+    for (size_t i = 0; i < block.relation_count(); ++i)
+      relations.push_back(block.relation_tags(i));
+    objects += (nodes.size() + ways.size() + relations.size()) * iterations;
+
+    for (auto& timed : transforms) {
+      auto t1 = std::chrono::high_resolution_clock::now();
+      for (size_t i = 0; i < iterations; ++i) {
+        for (const auto& tags : nodes)
+          timed.checksum += timed.transform->Transform(OSMType::kNode, tags).size();
+        for (const auto& tags : ways)
+          timed.checksum += timed.transform->Transform(OSMType::kWay, tags).size();
+        for (const auto& tags : relations)
+          timed.checksum += timed.transform->Transform(OSMType::kRelation, tags).size();
+      }
+      auto t2 = std::chrono::high_resolution_clock::now();
+      timed.secs += std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() * 0.000001;
+    }
+  }
+  std::vector<timed_t> transforms;
+  uint64_t objects = 0;
+};
+
+int main(int argc, char** argv) {
+  if (!ParseArguments(argc, argv))
+    return EXIT_FAILURE;
+  if (iterations == 0)
+    return EXIT_FAILURE;
+
+  //the script to time
+  std::string lua(lua_graph_lua, lua_graph_lua + lua_graph_lua_len);
+  if (!lua_file.empty()) {
+    std::ifstream file(lua_file);
+    if (!file.is_open()) {
+      std::cerr << "Failed to open: " << lua_file << std::endl;
+      return EXIT_FAILURE;
+    }
+    lua.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  }
+
+#ifdef HAVE_LUAJIT
+  const std::string interpreter = LUAJIT_VERSION;
+#else
+  const std::string interpreter = LUA_RELEASE;
+#endif
+
+  timer callback;
+  callback.transforms.push_back({interpreter, std::unique_ptr<TagTransform>(new LuaTagTransform(lua)), 0, 0});
+  if (cache_size)
+    callback.transforms.push_back({interpreter + " cached", std::unique_ptr<TagTransform>(new LuaTagTransform(lua, cache_size)), 0, 0});
+  //the compiled transform only does what graph.lua does
+  if (lua_file.empty())
+    callback.transforms.push_back({"compiled", std::unique_ptr<TagTransform>(new GraphTagTransform()), 0, 0});
+
+  OSMPBF::MappedFile file(input_file);
+  OSMPBF::Parser::parse(file, OSMPBF::Interest::ALL, callback);
+
+  for (const auto& timed : callback.transforms)
+    std::cout << timed.name << ": " << static_cast<uint64_t>(callback.objects / timed.secs) << " objects/s"
+              << " (checksum " << timed.checksum << ")" << std::endl;
+
+  return EXIT_SUCCESS;
+}
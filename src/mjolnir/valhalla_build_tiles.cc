@@ -130,6 +130,10 @@ int main(int argc, char** argv) {
   auto osm_data = PBFGraphParser::Parse(pt.get_child("mjolnir"), input_files, "ways.bin",
                                         "way_nodes.bin", "access.bin");
 
+  // The names and refs are only read from here on so they can live in the page cache
+  if (pt.get<bool>("mjolnir.spill_strings", false))
+    osm_data.SpillStrings("");
+
   // Build the graph using the OSMNodes and OSMWays from the parser
   GraphBuilder::Build(pt, osm_data, "ways.bin", "way_nodes.bin");
 
@@ -0,0 +1,108 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "config.h"
+
+#include <boost/program_options.hpp>
+
+#include "mjolnir/osmpbfparser.h"
+
+namespace bpo = boost::program_options;
+using namespace OSMPBF;
+
+std::string input_file;
+std::string output_file;
+std::string compression_name = "zstd";
+
+bool ParseArguments(int argc, char *argv[]) {
+  bpo::options_description options(
+      "valhalla_recompress_pbf " VERSION "\n"
+      "\n"
+      " Usage: valhalla_recompress_pbf [options] <input_file> <output_file>\n"
+      "\n"
+      "valhalla_recompress_pbf is a program to rewrite a pbf file with its blobs "
+      "compressed another way. zstd and lz4 take more disk than zlib but inflate "
+      "much faster, which is worth it when building from the same extract over and over"
+      "\n"
+      "\n");
+
+  options.add_options()
+              ("help,h", "Print this help message.")
+              ("version,v", "Print the version of this software.")
+              ("compression,c", bpo::value<std::string>(&compression_name), "How to compress the blobs: zstd (default), lz4, zlib or none.")
+              // positional arguments
+              ("input_file", bpo::value<std::string>(&input_file), "The pbf file to read.")
+              ("output_file", bpo::value<std::string>(&output_file), "The pbf file to write.");
+
+  bpo::positional_options_description pos_options;
+  pos_options.add("input_file", 1);
+  pos_options.add("output_file", 1);
+
+  bpo::variables_map vm;
+  try {
+    bpo::store(bpo::command_line_parser(argc, argv).options(options).positional(pos_options).run(), vm);
+    bpo::notify(vm);
+
+  } catch (std::exception &e) {
+    std::cerr << "Unable to parse command line options because: " << e.what()
+              << "\n" << "This is a bug, please report it at " PACKAGE_BUGREPORT
+              << "\n";
+    return false;
+  }
+
+  if (vm.count("help")) {
+    std::cout << options << "\n";
+    return false;
+  }
+
+  if (vm.count("version")) {
+    std::cout << "valhalla_recompress_pbf " << VERSION << "\n";
+    return false;
+  }
+
+  if (!vm.count("input_file") || !vm.count("output_file")) {
+    std::cerr << "Both an input and an output file are required\n\n" << options << "\n";
+    return false;
+  }
+
+  return true;
+}
+
+int main(int argc, char** argv) {
+  if (!ParseArguments(argc, argv))
+    return EXIT_FAILURE;
+
+  Compression compression;
+  if (compression_name == "zstd")
+    compression = ZSTD;
+  else if (compression_name == "lz4")
+    compression = LZ4;
+  else if (compression_name == "zlib")
+    compression = ZLIB;
+  else if (compression_name == "none")
+    compression = UNCOMPRESSED;
+  else {
+    std::cerr << "Unknown compression: " << compression_name << "\n";
+    return EXIT_FAILURE;
+  }
+  if (!Writer::supports(compression)) {
+    std::cerr << "This build does not support " << compression_name << " compression\n";
+    return EXIT_FAILURE;
+  }
+
+  auto t1 = std::chrono::high_resolution_clock::now();
+  try {
+    MappedFile file(input_file);
+    Writer::recompress(file, output_file, compression);
+  } catch (std::exception& e) {
+    std::cerr << "Failed to recompress " << input_file << ": " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+  auto t2 = std::chrono::high_resolution_clock::now();
+
+  double secs = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count() * 0.001;
+  std::cout << "Wrote " << output_file << " with " << compression_name << " compression in " << secs << " s" << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,427 @@
+#include "mjolnir/wiredecoder.h"
+#include "mjolnir/densenodes.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+using namespace OSMPBF;
+
+namespace {
+
+// protobuf wire types
+constexpr uint32_t kVarint = 0;
+constexpr uint32_t kFixed64 = 1;
+constexpr uint32_t kLengthDelimited = 2;
+constexpr uint32_t kFixed32 = 5;
+
+// a cursor over one protobuf message on the wire
+struct wire_reader {
+  wire_reader(const uint8_t* begin, const uint8_t* end): pos(begin), end(end) { }
+
+  bool more() const {
+    return pos < end;
+  }
+
+  uint64_t varint() {
+    uint64_t result = 0;
+    for (uint32_t shift = 0; shift < 64; shift += 7) {
+      if (pos == end)
+        throw std::runtime_error("Truncated varint in primitive block");
+      uint8_t byte = *pos++;
+      result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0)
+        return result;
+    }
+    throw std::runtime_error("Malformed varint in primitive block");
+  }
+
+  int64_t svarint() {
+    uint64_t value = varint();
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+  }
+
+  //the number and wire type of the next field
+  void field(uint32_t& number, uint32_t& type) {
+    uint64_t key = varint();
+    number = static_cast<uint32_t>(key >> 3);
+    type = static_cast<uint32_t>(key & 7);
+  }
+
+  //a length delimited field, ie an embedded message, bytes or a packed repeated field
+  wire_reader bytes(const uint32_t type) {
+    if (type != kLengthDelimited)
+      throw std::runtime_error("Unexpected wire type in primitive block");
+    uint64_t length = varint();
+    if (length > static_cast<uint64_t>(end - pos))
+      throw std::runtime_error("Truncated field in primitive block");
+    wire_reader result(pos, pos + length);
+    pos += length;
+    return result;
+  }
+
+  void advance(const size_t count) {
+    if (count > static_cast<size_t>(end - pos))
+      throw std::runtime_error("Truncated field in primitive block");
+    pos += count;
+  }
+
+  //skip over a field we dont care about
+  void skip(const uint32_t type) {
+    switch (type) {
+      case kVarint: varint(); break;
+      case kFixed64: advance(8); break;
+      case kLengthDelimited: bytes(type); break;
+      case kFixed32: advance(4); break;
+      default: throw std::runtime_error("Unknown wire type in primitive block");
+    }
+  }
+
+  const uint8_t* pos;
+  const uint8_t* end;
+};
+
+//repeated varint fields are normally packed but we have to accept them either way
+template <class visit_t>
+void each(wire_reader& reader, const uint32_t type, const visit_t& visit) {
+  if (type == kVarint) {
+    visit(reader);
+    return;
+  }
+  wire_reader packed = reader.bytes(type);
+  while (packed.more())
+    visit(packed);
+}
+
+template <class T, class decode_t>
+void repeated(wire_reader& reader, const uint32_t type, std::vector<T>& values, const decode_t& decode) {
+  each(reader, type, [&values, &decode](wire_reader& r) { values.push_back(decode(r)); });
+}
+
+const auto as_uint32 = [](wire_reader& r) { return static_cast<uint32_t>(r.varint()); };
+const auto as_sint64 = [](wire_reader& r) { return r.svarint(); };
+
+void update_range(const uint64_t id, BlobInfo* info) {
+  info->min_node_id = std::min(info->min_node_id, id);
+  info->max_node_id = std::max(info->max_node_id, id);
+}
+
+//all the objects must have one value per key
+void check_tags(const Block& block) {
+  if (block.keys.size() != block.vals.size())
+    throw std::runtime_error("Mismatched keys and values in primitive block");
+}
+
+// the block wide settings needed to decode coordinates
+struct block_settings {
+  int64_t lat_offset;
+  int64_t lon_offset;
+  int32_t granularity;
+};
+
+void decode_node(wire_reader node, const block_settings& settings, const bool wanted, Block& block, BlobInfo* info) {
+  int64_t id = 0, lat = 0, lon = 0;
+  uint32_t number, type;
+  if (wanted && block.node_ids.empty())
+    block.node_tag_offsets.front() = block.keys.size();
+  while (node.more()) {
+    node.field(number, type);
+    switch (number) {
+      case 1: id = node.svarint(); break;
+      case 2: if (wanted) repeated(node, type, block.keys, as_uint32); else node.skip(type); break;
+      case 3: if (wanted) repeated(node, type, block.vals, as_uint32); else node.skip(type); break;
+      case 8: lat = node.svarint(); break;
+      case 9: lon = node.svarint(); break;
+      default: node.skip(type); break;
+    }
+  }
+
+  if (info)
+    update_range(id, info);
+  if (wanted) {
+    check_tags(block);
+    block.node_ids.push_back(id);
+    block.node_lngs.push_back(0.000000001 * (settings.lon_offset + (settings.granularity * lon)));
+    block.node_lats.push_back(0.000000001 * (settings.lat_offset + (settings.granularity * lat)));
+    block.node_tag_offsets.push_back(block.keys.size());
+  }
+}
+
+void decode_way(wire_reader way, const block_settings& settings, std::vector<int64_t>& refs,
+                std::vector<int64_t>& lats, std::vector<int64_t>& lons, Block& block) {
+  uint64_t id = 0;
+  size_t first = block.way_refs.size();
+  uint32_t number, type;
+  //the tags of the first way start after those of any nodes in the block
+  if (block.way_ids.empty())
+    block.way_tag_offsets.front() = block.keys.size();
+  refs.clear();
+  lats.clear();
+  lons.clear();
+  while (way.more()) {
+    way.field(number, type);
+    switch (number) {
+      case 1: id = way.varint(); break;
+      case 2: repeated(way, type, block.keys, as_uint32); break;
+      case 3: repeated(way, type, block.vals, as_uint32); break;
+      case 8: repeated(way, type, refs, as_sint64); break;
+      //the locations of the refs if the file has them
+      case 9: repeated(way, type, lats, as_sint64); break;
+      case 10: repeated(way, type, lons, as_sint64); break;
+      default: way.skip(type); break;
+    }
+  }
+
+  bool locations = !lats.empty() || !lons.empty();
+  if (locations && (lats.size() != refs.size() || lons.size() != refs.size()))
+    throw std::runtime_error("Way has mismatched ref and location counts");
+
+  //refs and locations are delta encoded, skip consecutive duplicates like the libprotobuf path
+  uint64_t node = 0;
+  int64_t lat = 0, lon = 0;
+  for (size_t i = 0; i < refs.size(); ++i) {
+    node += refs[i];
+    if (locations) {
+      lat += lats[i];
+      lon += lons[i];
+    }
+    if (block.way_refs.size() == first || node != block.way_refs.back()) {
+      block.way_refs.push_back(node);
+      if (locations) {
+        block.way_lngs.push_back(0.000000001 * (settings.lon_offset + (settings.granularity * lon)));
+        block.way_lats.push_back(0.000000001 * (settings.lat_offset + (settings.granularity * lat)));
+      }
+    }
+  }
+  //either every way in the block has locations or none of them do
+  if (!block.way_lngs.empty() && block.way_lngs.size() != block.way_refs.size())
+    throw std::runtime_error("Only some of the ways in the block have locations");
+
+  check_tags(block);
+  block.way_ids.push_back(id);
+  block.way_tag_offsets.push_back(block.keys.size());
+  block.way_ref_offsets.push_back(block.way_refs.size());
+}
+
+void decode_relation(wire_reader relation, Block& block) {
+  uint64_t id = 0;
+  size_t first = block.member_ids.size();
+  uint32_t number, type;
+  if (block.relation_ids.empty())
+    block.relation_tag_offsets.front() = block.keys.size();
+  while (relation.more()) {
+    relation.field(number, type);
+    switch (number) {
+      case 1: id = relation.varint(); break;
+      case 2: repeated(relation, type, block.keys, as_uint32); break;
+      case 3: repeated(relation, type, block.vals, as_uint32); break;
+      case 8: repeated(relation, type, block.member_roles, as_uint32); break;
+      case 9: repeated(relation, type, block.member_ids, [](wire_reader& r) { return static_cast<uint64_t>(r.svarint()); }); break;
+      case 10: repeated(relation, type, block.member_types, [](wire_reader& r) {
+          uint64_t member_type = r.varint();
+          if (!Relation::MemberType_IsValid(member_type))
+            throw std::runtime_error("Unknown relation member type in primitive block");
+          return static_cast<Relation::MemberType>(member_type);
+        });
+        break;
+      default: relation.skip(type); break;
+    }
+  }
+
+  //every member needs a role an id and a type
+  if (block.member_ids.size() != block.member_roles.size() || block.member_ids.size() != block.member_types.size())
+    throw std::runtime_error("Mismatched relation members in primitive block");
+  //member ids are delta encoded
+  uint64_t member_id = 0;
+  for (size_t i = first; i < block.member_ids.size(); ++i) {
+    member_id += block.member_ids[i];
+    block.member_ids[i] = member_id;
+  }
+
+  check_tags(block);
+  block.relation_ids.push_back(id);
+  block.relation_tag_offsets.push_back(block.keys.size());
+  block.member_offsets.push_back(block.member_ids.size());
+}
+
+}
+
+// extend the protobuf osmpbf namespace
+namespace OSMPBF {
+
+BlobData decode_blob(const char* buffer, const size_t size) {
+  BlobData blob{BlobData::MISSING, nullptr, 0, -1};
+  const uint8_t* begin = reinterpret_cast<const uint8_t*>(buffer);
+  wire_reader reader(begin, begin + size);
+  uint32_t number, type;
+  while (reader.more()) {
+    reader.field(number, type);
+    //the data fields are all bytes and their numbers line up with the compression enum
+    if ((number >= 3 && number <= 7) || number == 1) {
+      wire_reader data = reader.bytes(type);
+      blob.compression = number == 1 ? BlobData::RAW : static_cast<BlobData::Compression>(number - 2);
+      blob.data = reinterpret_cast<const char*>(data.pos);
+      blob.size = data.end - data.pos;
+    }
+    else if (number == 2 && type == kVarint)
+      blob.raw_size = static_cast<int32_t>(reader.varint());
+    else
+      reader.skip(type);
+  }
+  return blob;
+}
+
+void WireDecoder::decode(const char* buffer, const size_t size, const Interest interest, Block& block, BlobInfo* info) {
+  block.clear();
+  if (info) {
+    info->kinds = NONE;
+    info->min_node_id = std::numeric_limits<uint64_t>::max();
+    info->max_node_id = 0;
+  }
+
+  //the coordinate settings come after the groups on the wire so we have to find everything first
+  const uint8_t* begin = reinterpret_cast<const uint8_t*>(buffer);
+  wire_reader primblock(begin, begin + size);
+  groups_.clear();
+  block_settings settings{0, 0, 100};
+  uint32_t number, type;
+  while (primblock.more()) {
+    primblock.field(number, type);
+    switch (number) {
+      case 1: {
+        wire_reader table = primblock.bytes(type);
+        while (table.more()) {
+          table.field(number, type);
+          if (number == 1) {
+            wire_reader str = table.bytes(type);
+            block.strings.emplace_back(reinterpret_cast<const char*>(str.pos), str.end - str.pos);
+          }
+          else
+            table.skip(type);
+        }
+        break;
+      }
+      case 2: {
+        wire_reader group = primblock.bytes(type);
+        groups_.emplace_back(group.pos, group.end);
+        break;
+      }
+      case 17: settings.granularity = static_cast<int32_t>(primblock.varint()); break;
+      case 19: settings.lat_offset = static_cast<int64_t>(primblock.varint()); break;
+      case 20: settings.lon_offset = static_cast<int64_t>(primblock.varint()); break;
+      default: primblock.skip(type); break;
+    }
+  }
+
+  //for each primitive group
+  const bool nodes = (interest & NODES) == NODES;
+  const bool ways = (interest & WAYS) == WAYS;
+  const bool relations = (interest & RELATIONS) == RELATIONS;
+  for (const auto& span : groups_) {
+    wire_reader group(span.first, span.second);
+    while (group.more()) {
+      group.field(number, type);
+      switch (number) {
+        // Simple Nodes
+        case 1:
+          if (info)
+            info->kinds |= NODES;
+          if (nodes || info)
+            decode_node(group.bytes(type), settings, nodes, block, info);
+          else
+            group.skip(type);
+          break;
+        // Dense Nodes
+        case 2: {
+          if (info)
+            info->kinds |= NODES;
+          if (!nodes && !info) {
+            group.skip(type);
+            break;
+          }
+
+          //pull out the columns
+          ids_.clear();
+          lats_.clear();
+          lons_.clear();
+          keys_vals_.clear();
+          wire_reader dense = group.bytes(type);
+          while (dense.more()) {
+            dense.field(number, type);
+            switch (number) {
+              case 1: repeated(dense, type, ids_, as_sint64); break;
+              case 8: if (nodes) repeated(dense, type, lats_, as_sint64); else dense.skip(type); break;
+              case 9: if (nodes) repeated(dense, type, lons_, as_sint64); else dense.skip(type); break;
+              case 10: if (nodes) repeated(dense, type, keys_vals_, as_uint32); else dense.skip(type); break;
+              default: dense.skip(type); break;
+            }
+          }
+
+          //just the ids for the summary
+          if (!nodes) {
+            uint64_t id = 0;
+            for (const auto delta : ids_) {
+              id += delta;
+              update_range(id, info);
+            }
+            break;
+          }
+
+          //decode the whole thing
+          if (lats_.size() != ids_.size() || lons_.size() != ids_.size())
+            throw std::runtime_error("Dense nodes have mismatched id and coordinate counts");
+          size_t first = block.node_ids.size();
+          decode_dense_nodes(ids_.data(), lats_.data(), lons_.data(), ids_.size(), settings.lat_offset,
+                             settings.lon_offset, settings.granularity, block.node_ids, block.node_lngs,
+                             block.node_lats);
+          if (info) {
+            for (size_t i = first; i < block.node_ids.size(); ++i)
+              update_range(block.node_ids[i], info);
+          }
+
+          //the key/values for each node run until the next 0
+          size_t current_kv = 0;
+          if (first == 0)
+            block.node_tag_offsets.front() = block.keys.size();
+          for (size_t i = 0; i < ids_.size(); ++i) {
+            while (current_kv + 1 < keys_vals_.size() && keys_vals_[current_kv] != 0) {
+              block.keys.push_back(keys_vals_[current_kv]);
+              block.vals.push_back(keys_vals_[current_kv + 1]);
+              current_kv += 2;
+            }
+            ++current_kv;
+            block.node_tag_offsets.push_back(block.keys.size());
+          }
+          break;
+        }
+        // Ways
+        case 3:
+          if (info)
+            info->kinds |= WAYS;
+          if (ways)
+            decode_way(group.bytes(type), settings, ids_, lats_, lons_, block);
+          else
+            group.skip(type);
+          break;
+        // Relations
+        case 4:
+          if (info)
+            info->kinds |= RELATIONS;
+          if (relations)
+            decode_relation(group.bytes(type), block);
+          else
+            group.skip(type);
+          break;
+        default:
+          group.skip(type);
+          break;
+      }
+    }
+  }
+
+  //no nodes no range
+  if (info && info->min_node_id > info->max_node_id)
+    info->min_node_id = info->max_node_id = 0;
+}
+
+}
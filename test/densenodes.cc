@@ -0,0 +1,123 @@
+#include "test.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include "mjolnir/densenodes.h"
+
+using namespace OSMPBF;
+
+namespace {
+
+// fills out a group of dense nodes with random deltas, roughly what a real extract looks like
+DenseNodes make_dense(const size_t count) {
+  DenseNodes dense;
+  srand(1);
+  dense.add_id(1234567);
+  dense.add_lat(520000000);
+  dense.add_lon(50000000);
+  for (size_t i = 1; i < count; ++i) {
+    dense.add_id(rand() % 100 + 1);
+    dense.add_lat(rand() % 20001 - 10000);
+    dense.add_lon(rand() % 20001 - 10000);
+  }
+  return dense;
+}
+
+void TestDeltaDecode() {
+  //try all the sizes around the vector widths and the chunk size
+  for (size_t count : {0, 1, 2, 3, 4, 5, 7, 8, 9, 511, 512, 513, 1025}) {
+    std::vector<int64_t> deltas(count);
+    for (auto& delta : deltas)
+      delta = rand() % 2001 - 1000;
+    std::vector<int64_t> expected(count), values(count);
+    int64_t expected_last = delta_decode_scalar(deltas.data(), count, 42, expected.data());
+    int64_t last = delta_decode(deltas.data(), count, 42, values.data());
+    if (last != expected_last || values != expected)
+      throw std::runtime_error("Delta decode does not match the scalar decode for " + std::to_string(count) + " values");
+
+    //should also work in place
+    delta_decode(deltas.data(), count, 42, deltas.data());
+    if (deltas != expected)
+      throw std::runtime_error("In place delta decode does not match the scalar decode");
+  }
+}
+
+void TestDecodeDenseNodes() {
+  DenseNodes dense = make_dense(8000);
+
+  //one node at a time summing integers, each coordinate is converted to degrees once so
+  //there is only the one rounding and the results should match exactly. the parser used
+  //to sum the converted deltas as doubles instead, which drifts by a few ulps over a group
+  std::vector<uint64_t> expected_ids;
+  std::vector<double> expected_lngs, expected_lats;
+  uint64_t id = 0;
+  int64_t lon = 0, lat = 0;
+  for (int i = 0; i < dense.id_size(); ++i) {
+    id += dense.id(i);
+    lon += dense.lon(i);
+    lat += dense.lat(i);
+    expected_ids.push_back(id);
+    expected_lngs.push_back(0.000000001 * (100 * lon));
+    expected_lats.push_back(0.000000001 * (100 * lat));
+  }
+
+  //appends to whatever is already there
+  std::vector<uint64_t> ids{7};
+  std::vector<double> lngs{7}, lats{7};
+  decode_dense_nodes(dense, 0, 0, 100, ids, lngs, lats);
+  if (ids.size() != expected_ids.size() + 1 || lngs.size() != ids.size() || lats.size() != ids.size())
+    throw std::runtime_error("Wrong number of decoded dense nodes");
+  for (size_t i = 0; i < expected_ids.size(); ++i) {
+    if (ids[i + 1] != expected_ids[i])
+      throw std::runtime_error("Wrong dense node id");
+    if (lngs[i + 1] != expected_lngs[i] || lats[i + 1] != expected_lats[i])
+      throw std::runtime_error("Wrong dense node coordinate");
+  }
+}
+
+void TestOffsets() {
+  DenseNodes dense = make_dense(3);
+  std::vector<uint64_t> ids;
+  std::vector<double> lngs, lats;
+  decode_dense_nodes(dense, 1000, -2000, 100, ids, lngs, lats);
+
+  //the offset applies once to the absolute value, not to every delta
+  int64_t lon = 0, lat = 0;
+  for (int i = 0; i < dense.id_size(); ++i) {
+    lon += dense.lon(i);
+    lat += dense.lat(i);
+    if (lngs[i] != 0.000000001 * (-2000 + 100 * lon) || lats[i] != 0.000000001 * (1000 + 100 * lat))
+      throw std::runtime_error("Block offsets were not applied correctly");
+  }
+}
+
+void TestMismatchedColumns() {
+  DenseNodes dense = make_dense(10);
+  dense.add_id(1);
+  std::vector<uint64_t> ids;
+  std::vector<double> lngs, lats;
+  try {
+    decode_dense_nodes(dense, 0, 0, 100, ids, lngs, lats);
+  }
+  catch (const std::runtime_error&) {
+    return;
+  }
+  throw std::runtime_error("Mismatched dense node columns should throw");
+}
+
+}
+
+int main() {
+  test::suite suite("densenodes");
+
+  suite.test(TEST_CASE(TestDeltaDecode));
+
+  suite.test(TEST_CASE(TestDecodeDenseNodes));
+
+  suite.test(TEST_CASE(TestOffsets));
+
+  suite.test(TEST_CASE(TestMismatchedColumns));
+
+  return suite.tear_down();
+}
@@ -1,9 +1,13 @@
 #include "test.h"
 #include "mjolnir/osmnode.h"
 #include "mjolnir/pbfgraphparser.h"
+#include "mjolnir/osmpbfparser.h"
 #include <valhalla/midgard/sequence.h>
 
+#include <cmath>
 #include <fstream>
+#include <iterator>
+#include <netinet/in.h>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/filesystem.hpp>
@@ -201,20 +205,20 @@ void Exits(const std::string& config_file) {
   auto node = GetNode(33698177, way_nodes);
 
   if (!node.intersection() ||
-      !node.ref() || osmdata.node_ref[33698177] != "51A-B")
+      !node.ref() || osmdata.node_ref.get(33698177) != "51A-B")
     throw std::runtime_error("Ref not set correctly .");
 
 
   node = GetNode(1901353894, way_nodes);
 
   if (!node.intersection() ||
-      !node.ref() || osmdata.node_name[1901353894] != "Harrisburg East")
+      !node.ref() || osmdata.node_name.get(1901353894) != "Harrisburg East")
     throw std::runtime_error("Ref not set correctly .");
 
 
   node = GetNode(462240654, way_nodes);
 
-  if (!node.intersection() || osmdata.node_exit_to[462240654] != "PA441")
+  if (!node.intersection() || osmdata.node_exit_to.get(462240654) != "PA441")
     throw std::runtime_error("Ref not set correctly .");
 
   boost::filesystem::remove(ways_file);
@@ -422,6 +426,242 @@ void BicycleTrafficSignals(const std::string& config_file) {
 
 }
 
+void RoutingExtract(const std::string& config_file) {
+  boost::property_tree::ptree conf;
+  boost::property_tree::json_parser::read_json(config_file, conf);
+  conf.put("mjolnir.routing_extract", "test_routing_extract.osm.pbf");
+
+  //the first time through writes the extract and the second time reads it
+  std::vector<std::string> results;
+  for (const auto& suffix : { "_original", "_extract" }) {
+    std::string ways_file = std::string("test_ways") + suffix + ".bin";
+    std::string way_nodes_file = std::string("test_way_nodes") + suffix + ".bin";
+    std::string access_file = std::string("test_access") + suffix + ".bin";
+    auto osmdata = PBFGraphParser::Parse(conf.get_child("mjolnir"), {"test/data/baltimore.osm.pbf"}, ways_file, way_nodes_file, access_file);
+    if (!boost::filesystem::exists("test_routing_extract.osm.pbf"))
+      throw std::runtime_error("Routing extract was not written");
+
+    //everything that comes out should be the same either way
+    std::string result = std::to_string(osmdata.osm_way_count) + " " + std::to_string(osmdata.osm_way_node_count) + " " +
+      std::to_string(osmdata.osm_node_count) + " " + std::to_string(osmdata.node_count) + " " +
+      std::to_string(osmdata.edge_count) + " " + std::to_string(osmdata.restrictions.size()) + " " +
+      std::to_string(osmdata.bike_relations.size());
+    //names can be numbered in a different order so only the size of the ways has to match
+    result += " " + std::to_string(boost::filesystem::file_size(ways_file));
+    boost::filesystem::remove(ways_file);
+    for (const auto& file : { way_nodes_file, access_file }) {
+      std::ifstream in(file, std::ios::binary);
+      result += std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+      in.close();
+      boost::filesystem::remove(file);
+    }
+    results.push_back(result);
+  }
+
+  //an extract made with the compiled transform shouldnt be used with lua, its made again instead
+  auto source = [](){ return OSMPBF::Parser::header(OSMPBF::MappedFile("test_routing_extract.osm.pbf")).source(); };
+  if (source().find("native=") != 0)
+    throw std::runtime_error("Routing extract should say it was made with the compiled transform");
+  conf.put("mjolnir.tag_transform", "lua");
+  PBFGraphParser::Parse(conf.get_child("mjolnir"), {"test/data/baltimore.osm.pbf"}, "test_ways_lua.bin", "test_way_nodes_lua.bin", "test_access_lua.bin");
+  if (source().find("lua=") != 0)
+    throw std::runtime_error("Routing extract should have been made again with lua");
+  for (const auto& file : { "test_ways_lua.bin", "test_way_nodes_lua.bin", "test_access_lua.bin", "test_routing_extract.osm.pbf" })
+    boost::filesystem::remove(file);
+
+  if (results.front() != results.back())
+    throw std::runtime_error("Parsing the routing extract should give the same results as the original");
+}
+
+void TollBooth(const std::string& config_file) {
+  boost::property_tree::ptree conf;
+  boost::property_tree::json_parser::read_json(config_file, conf);
+
+  //a road through a node whose only tag is one the transform passes along untouched
+  {
+    OSMPBF::HeaderBlock header;
+    OSMPBF::Writer writer("test_toll_booth.osm.pbf", header);
+    writer.node(1, 9.520, 47.140, {});
+    writer.node(2, 9.521, 47.141, {{"toll_booth", "true"}});
+    writer.node(3, 9.522, 47.142, {});
+    writer.way(10, {{"highway", "residential"}}, {1, 2, 3});
+    writer.close();
+  }
+
+  std::string ways_file = "test_ways.bin";
+  std::string way_nodes_file = "test_way_nodes.bin";
+  std::string access_file = "test_access.bin";
+  auto osmdata = PBFGraphParser::Parse(conf.get_child("mjolnir"), {"test_toll_booth.osm.pbf"}, ways_file, way_nodes_file, access_file);
+  sequence<OSMWayNode> way_nodes(way_nodes_file, false);
+  way_nodes.sort(node_predicate);
+
+  auto node = GetNode(2, way_nodes);
+  if (node.type() != NodeType::kTollBooth || !node.intersection())
+    throw std::runtime_error("Toll booth tag was lost");
+  node = GetNode(1, way_nodes);
+  if (node.type() != NodeType::kStreetIntersection)
+    throw std::runtime_error("Untagged node should be a plain node");
+  //both ends of the road and the toll booth
+  if (osmdata.intersection_count != 3)
+    throw std::runtime_error("Wrong intersection count: " + std::to_string(osmdata.intersection_count));
+
+  boost::filesystem::remove("test_toll_booth.osm.pbf");
+  boost::filesystem::remove(ways_file);
+  boost::filesystem::remove(way_nodes_file);
+  boost::filesystem::remove(access_file);
+}
+
+//append a varint to some protobuf wire bytes
+void varint(std::string& bytes, uint64_t value) {
+  for (; value >= 0x80; value >>= 7)
+    bytes.push_back(static_cast<char>(value | 0x80));
+  bytes.push_back(static_cast<char>(value));
+}
+
+uint64_t zigzag(const int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+//append a length delimited field to some protobuf wire bytes
+void field(std::string& bytes, const uint32_t number, const std::string& value) {
+  varint(bytes, (number << 3) | 2);
+  varint(bytes, value.size());
+  bytes += value;
+}
+
+//append an uncompressed blob to the end of a file the writer already closed
+void append_blob(const std::string& file_name, const std::string& bytes) {
+  OSMPBF::Blob blob;
+  blob.set_raw(bytes);
+  blob.set_raw_size(bytes.size());
+  const std::string blob_bytes = blob.SerializeAsString();
+  OSMPBF::BlobHeader header;
+  header.set_type("OSMData");
+  header.set_datasize(blob_bytes.size());
+  const std::string header_bytes = header.SerializeAsString();
+  int32_t size = htonl(header_bytes.size());
+  std::ofstream file(file_name, std::ios::binary | std::ios::app);
+  file.write(reinterpret_cast<const char*>(&size), 4);
+  file << header_bytes << blob_bytes;
+}
+
+void WriteLocations(const std::string& file_name, const bool locations) {
+  struct node_t { uint64_t osmid; double lng, lat; OSMPBF::Tags tags; };
+  const std::vector<node_t> nodes{
+    {1, 9.520, 47.140, {}}, {2, 9.521, 47.141, {}}, {3, 9.522, 47.142, {{"highway", "traffic_signals"}}},
+    {4, 9.523, 47.143, {}}, {5, 9.524, 47.144, {{"toll_booth", "true"}}},
+    {6, 9.525, 47.145, {{"highway", "motorway_junction"}, {"ref", "12"}, {"exit_to", "Vaduz"}}},
+    {7, 9.526, 47.146, {}}, {8, 9.527, 47.147, {{"barrier", "gate"}}},
+  };
+  const std::vector<std::pair<uint64_t, std::vector<uint64_t> > > ways{
+    {10, {1, 2, 3, 4}}, {11, {4, 5, 6}}, {12, {2, 7, 8, 1}},
+  };
+
+  //like osmium add-locations-to-ways the nodes without tags are left out when the ways have locations
+  OSMPBF::HeaderBlock header;
+  if (locations)
+    header.add_optional_features("LocationsOnWays");
+  OSMPBF::Writer writer(file_name, header, OSMPBF::UNCOMPRESSED);
+  for (const auto& n : nodes) {
+    if (!locations || !n.tags.empty())
+      writer.node(n.osmid, n.lng, n.lat, n.tags);
+  }
+  writer.close();
+
+  //the generated way doesnt know about locations so we tack them onto the wire ourselves
+  OSMPBF::PrimitiveBlock primblock;
+  for (const auto* s : { "", "highway", "residential" })
+    primblock.mutable_stringtable()->add_s(s);
+  std::string group_bytes;
+  for (const auto& w : ways) {
+    OSMPBF::Way way;
+    way.set_id(w.first);
+    way.add_keys(1);
+    way.add_vals(2);
+    std::string lats, lngs;
+    int64_t last_ref = 0, last_lat = 0, last_lng = 0;
+    for (const auto ref : w.second) {
+      way.add_refs(ref - last_ref);
+      last_ref = ref;
+      const auto& n = nodes[ref - 1];
+      const int64_t lat = std::llround(n.lat * 10000000), lng = std::llround(n.lng * 10000000);
+      varint(lats, zigzag(lat - last_lat));
+      varint(lngs, zigzag(lng - last_lng));
+      last_lat = lat;
+      last_lng = lng;
+    }
+    std::string way_bytes = way.SerializeAsString();
+    if (locations) {
+      field(way_bytes, 9, lats);
+      field(way_bytes, 10, lngs);
+    }
+    field(group_bytes, 3, way_bytes);
+  }
+  std::string bytes = primblock.SerializeAsString();
+  field(bytes, 2, group_bytes);
+  append_blob(file_name, bytes);
+}
+
+void LocationsOnWays(const std::string& config_file) {
+  boost::property_tree::ptree conf;
+  boost::property_tree::json_parser::read_json(config_file, conf);
+
+  //parse the same ways with their nodes joined by id and with the locations on them
+  std::string ways_file = "test_ways.bin";
+  std::string way_nodes_file = "test_way_nodes.bin";
+  std::string access_file = "test_access.bin";
+  std::vector<OSMData> osmdatas;
+  std::vector<std::string> way_nodes_bytes;
+  for (const bool locations : { false, true }) {
+    WriteLocations("test_locations.osm.pbf", locations);
+    osmdatas.emplace_back(PBFGraphParser::Parse(conf.get_child("mjolnir"), {"test_locations.osm.pbf"}, ways_file, way_nodes_file, access_file));
+    std::ifstream file(way_nodes_file, std::ios::binary);
+    way_nodes_bytes.emplace_back(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  }
+
+  //the way nodes should come out exactly the same, attributes and all
+  if (way_nodes_bytes.front().empty() || way_nodes_bytes.front() != way_nodes_bytes.back())
+    throw std::runtime_error("Way nodes differ when the locations are on the ways");
+  const auto& joined = osmdatas.front();
+  const auto& located = osmdatas.back();
+  if (joined.intersection_count != located.intersection_count || joined.edge_count != located.edge_count)
+    throw std::runtime_error("Intersection or edge counts differ when the locations are on the ways: " +
+      std::to_string(joined.intersection_count) + " vs " + std::to_string(located.intersection_count) + " intersections, " +
+      std::to_string(joined.edge_count) + " vs " + std::to_string(located.edge_count) + " edges");
+  if (joined.osm_way_count != located.osm_way_count || joined.osm_way_node_count != located.osm_way_node_count)
+    throw std::runtime_error("Way counts differ when the locations are on the ways");
+  if (located.node_ref.get(6) != "12" || located.node_exit_to.get(6) != "Vaduz" ||
+      joined.node_ref.get(6) != located.node_ref.get(6) || joined.node_exit_to.get(6) != located.node_exit_to.get(6))
+    throw std::runtime_error("Exit strings differ when the locations are on the ways");
+
+  //and of course they should be right
+  sequence<OSMWayNode> way_nodes(way_nodes_file, false);
+  way_nodes.sort(node_predicate);
+  auto node = GetNode(5, way_nodes);
+  if (node.type() != NodeType::kTollBooth || !node.intersection())
+    throw std::runtime_error("Toll booth lost when the locations are on the ways");
+  node = GetNode(8, way_nodes);
+  if (node.type() != NodeType::kGate || !node.intersection())
+    throw std::runtime_error("Gate lost when the locations are on the ways");
+  node = GetNode(3, way_nodes);
+  if (!node.traffic_signal() || node.intersection())
+    throw std::runtime_error("Traffic signal lost when the locations are on the ways");
+  node = GetNode(6, way_nodes);
+  if (!node.ref() || !node.exit_to())
+    throw std::runtime_error("Exit lost when the locations are on the ways");
+  node = GetNode(7, way_nodes);
+  if (node.type() != NodeType::kStreetIntersection || std::abs(node.lat - 47.146) > 1e-5 || std::abs(node.lng - 9.526) > 1e-5)
+    throw std::runtime_error("Untagged node is wrong when the locations are on the ways");
+  //the ends of the ways, where they meet and the barriers
+  if (located.intersection_count != 6)
+    throw std::runtime_error("Wrong intersection count: " + std::to_string(located.intersection_count));
+
+  boost::filesystem::remove("test_locations.osm.pbf");
+  boost::filesystem::remove(ways_file);
+  boost::filesystem::remove(way_nodes_file);
+  boost::filesystem::remove(access_file);
+}
+
 void DoConfig() {
   std::ofstream file;
   try {
@@ -473,6 +713,21 @@ void TestBus() {
   Bus(config_file);
 }
 
+void TestTollBooth() {
+  //tags that only pass through the transform
+  TollBooth(config_file);
+}
+
+void TestLocationsOnWays() {
+  //locations on the ways instead of joining the nodes
+  LocationsOnWays(config_file);
+}
+
+void TestRoutingExtract() {
+  //parse the extract instead of the original
+  RoutingExtract(config_file);
+}
+
 }
 
 int main() {
@@ -494,6 +749,9 @@ int main() {
   suite.test(TEST_CASE(TestBaltimoreArea));
   suite.test(TEST_CASE(TestBike));
   suite.test(TEST_CASE(TestBus));
+  suite.test(TEST_CASE(TestTollBooth));
+  suite.test(TEST_CASE(TestLocationsOnWays));
+  suite.test(TEST_CASE(TestRoutingExtract));
 
   return suite.tear_down();
 }
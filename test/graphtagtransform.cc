@@ -0,0 +1,172 @@
+#include "test.h"
+
+#include <string>
+#include <vector>
+#include "mjolnir/graphtagtransform.h"
+#include "mjolnir/luatagtransform.h"
+#include "mjolnir/osmpbfparser.h"
+#include "graph_lua_proc.h"
+
+using namespace valhalla::mjolnir;
+
+namespace {
+
+const std::string lua(lua_graph_lua, lua_graph_lua + lua_graph_lua_len);
+
+std::string to_string(const Tags& tags) {
+  std::string str;
+  for (const auto& tag : tags)
+    str += tag.first + "=" + tag.second + " ";
+  return str;
+}
+
+// runs the tags of everything it sees through lua/graph.lua and the compiled version of it
+struct differ : public OSMPBF::BlockCallback {
+  differ(): lua_transform(lua), count(0), skippable(0) {}
+  void block_callback(const OSMPBF::Block& block) {
+    for (size_t i = 0; i < block.node_count(); ++i)
+      compare(OSMType::kNode, block.node_tags(i));
+    for (size_t i = 0; i < block.way_count(); ++i)
+      compare(OSMType::kWay, block.way_tags(i));
+    for (size_t i = 0; i < block.relation_count(); ++i)
+      compare(OSMType::kRelation, block.relation_tags(i));
+  }
+  void compare(const OSMType type, const OSMPBF::TagView& tags) {
+    auto expected = lua_transform.Transform(type, tags);
+    auto actual = graph_transform.Transform(type, tags);
+    if (expected != actual)
+      throw std::runtime_error("Compiled transform of " + to_string(tags.to_tags()) + "gave " + to_string(actual) +
+        "but lua gave " + to_string(expected));
+    //the map version should do the same
+    if (graph_transform.Transform(type, tags.to_tags()) != actual)
+      throw std::runtime_error("Compiled transform of a map doesnt match the one of the block");
+    //without any of the keys it looks at it should be like having no tags, other than keeping them.
+    //the parser just uses the result of no tags for these, so the tags it reads that the transform
+    //can leave alone have to be among the keys (see TestKeys)
+    if (!interesting(type, tags)) {
+      auto none = graph_transform.Transform(type, Tags{});
+      auto kept = tags.to_tags();
+      for (const auto& tag : none)
+        kept[tag.first] = tag.second;
+      if (actual != (none.empty() ? none : kept))
+        throw std::runtime_error("Transform of " + to_string(tags.to_tags()) + "looked at a key it doesnt say it does");
+      ++skippable;
+    }
+    ++count;
+  }
+  bool interesting(const OSMType type, const OSMPBF::TagView& tags) {
+    const auto* keys = graph_transform.Keys(type);
+    for (size_t i = 0; i < tags.size(); ++i)
+      if (keys->find(tags.key(i).to_string()) != keys->end())
+        return true;
+    return false;
+  }
+  LuaTagTransform lua_transform;
+  GraphTagTransform graph_transform;
+  size_t count, skippable;
+};
+
+void TestExtracts() {
+  //every object in every extract we have should come out the same either way
+  for (const auto& extract : { "amsterdam", "baltimore", "bike", "bus", "harrisburg",
+                               "liechtenstein-latest", "nyc", "rome" }) {
+    OSMPBF::MappedFile file(std::string("test/data/") + extract + ".osm.pbf");
+    differ callback;
+    OSMPBF::Parser::parse(file, OSMPBF::Interest::ALL, callback);
+    if (callback.count == 0)
+      throw std::runtime_error(std::string("No objects compared in ") + extract);
+    if (callback.skippable == 0)
+      throw std::runtime_error(std::string("Every object needed transforming in ") + extract);
+  }
+}
+
+void TestKeys() {
+  //the script and the compiled transform should say they look at the same keys
+  LuaTagTransform lua_transform(lua);
+  GraphTagTransform graph_transform;
+  for (const auto type : { OSMType::kNode, OSMType::kWay, OSMType::kRelation }) {
+    if (!lua_transform.Keys(type) || !graph_transform.Keys(type))
+      throw std::runtime_error("Transforms should say which keys they look at");
+    if (*lua_transform.Keys(type) != *graph_transform.Keys(type))
+      throw std::runtime_error("Lua and compiled transforms look at different keys");
+  }
+
+  //tags the parser reads off of nodes that the transform can pass through as they were
+  for (const auto& key : { "highway", "forward_signal", "backward_signal", "exit_to", "ref", "name", "gate",
+                           "bollard", "toll_booth", "border_control", "access_mask" }) {
+    if (!graph_transform.Keys(OSMType::kNode)->count(key))
+      throw std::runtime_error(std::string("Nodes with ") + key + " have to be transformed");
+  }
+
+  //a script that doesnt say cant be filtered
+  LuaTagTransform quiet("function nodes_proc(kv, n) return 0, kv end "
+                        "function ways_proc(kv, n) return 0, kv, 0, 0 end "
+                        "function rels_proc(kv, n) return 0, kv end");
+  if (quiet.Keys(OSMType::kNode) || quiet.Keys(OSMType::kWay) || quiet.Keys(OSMType::kRelation))
+    throw std::runtime_error("Script without keys tables shouldnt have keys");
+}
+
+void TestEdgeCases() {
+  //the number parsing and oneway handling that the extracts might not cover
+  const std::vector<Tags> ways = {
+    {},
+    {{"highway", "residential"}, {"maxheight", "7'6\""}, {"maxwidth", "7ft6"}, {"maxlength", "12.5 m"}},
+    {{"highway", "residential"}, {"maxheight", "3.5"}, {"maxwidth:physical", "100in"}, {"maxlength", "1.2.3"}},
+    {{"highway", "residential"}, {"maxheight", "12'"}, {"maxweight", "3.5 t"}, {"maxaxleload", "4000 lbs"}},
+    {{"highway", "residential"}, {"maxweight", "7500kg"}, {"maxaxleload", "10 tons"}, {"maxspeed", "30 mph"}},
+    {{"highway", "primary"}, {"maxspeed", "200"}, {"maxspeed:forward", "5"}, {"maxspeed:backward", "50"}},
+    {{"highway", "primary"}, {"oneway", "-1"}, {"oneway:bicycle", "no"}, {"lanes", "12"}, {"lanes:forward", "2;3"}},
+    {{"highway", "secondary"}, {"oneway", "yes"}, {"cycleway", "opposite_lane"}, {"oneway:bus", "-1"}},
+    {{"highway", "service"}, {"service", "driveway"}, {"unsigned_ref", "A1"}},
+    {{"highway", "motorway"}, {"unsigned_ref", "A1"}, {"hov:lanes", "2"}, {"seasonal", "winter"}},
+    {{"highway", "track"}, {"tracktype", "grade3"}, {"ncn_ref", "4"}, {"mtb", "yes"}},
+    {{"route", "ferry"}, {"access", "no"}, {"motorcar", "yes"}},
+    {{"route", "ferry"}, {"bicycle", "no"}},
+    {{"highway", "tertiary"}, {"access", "hov"}, {"oneway", "reversible"}, {"bus", "yes"}},
+    {{"highway", "tertiary"}, {"access", "permissive"}, {"oneway", "reversible"}},
+    {{"highway", "footway"}, {"footway", "sidewalk"}, {"area", "yes"}},
+    {{"highway", "construction"}},
+    {{"highway", "bridleway"}},
+  };
+  const std::vector<Tags> nodes = {
+    {},
+    {{"barrier", "bollard"}, {"bollard", "rising"}},
+    {{"barrier", "block"}, {"foot", "no"}, {"highway", "crossing"}, {"bicycle", "no"}},
+    {{"access", "private"}, {"emergency", "yes"}, {"payment:coins", "yes"}, {"payment:notes", "yes"}},
+    {{"barrier", "toll_booth"}, {"payment:e_zpass", "yes"}, {"motor_vehicle", "no"}, {"traffic_signals:direction", "forward"}},
+  };
+  const std::vector<Tags> relations = {
+    {},
+    {{"type", "restriction"}, {"restriction", "no_left_turn"}, {"day_on", "Mon"}, {"day_off", "someday"}},
+    {{"type", "restriction"}, {"restriction", "no_parking"}},
+    {{"type", "route"}, {"route", "bicycle"}, {"network", "rcn"}, {"day_on", "Mon"}},
+    {{"type", "route"}, {"route", "bus"}, {"restriction", "no_u_turn"}},
+    {{"type", "multipolygon"}},
+  };
+  LuaTagTransform lua_transform(lua);
+  GraphTagTransform graph_transform;
+  for (const auto& type : std::vector<std::pair<OSMType, const std::vector<Tags>*> >{
+         {OSMType::kWay, &ways}, {OSMType::kNode, &nodes}, {OSMType::kRelation, &relations} }) {
+    for (const auto& tags : *type.second) {
+      auto expected = lua_transform.Transform(type.first, tags);
+      auto actual = graph_transform.Transform(type.first, tags);
+      if (expected != actual)
+        throw std::runtime_error("Compiled transform of " + to_string(tags) + "gave " + to_string(actual) +
+          "but lua gave " + to_string(expected));
+    }
+  }
+}
+
+}
+
+int main() {
+  test::suite suite("graphtagtransform");
+
+  suite.test(TEST_CASE(TestExtracts));
+
+  suite.test(TEST_CASE(TestEdgeCases));
+
+  suite.test(TEST_CASE(TestKeys));
+
+  return suite.tear_down();
+}
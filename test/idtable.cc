@@ -2,7 +2,10 @@
 
 #include <cstdint>
 #include <unordered_set>
+#include <vector>
 #include <cstdlib>
+#include <atomic>
+#include <thread>
 #include "mjolnir/idtable.h"
 
 using namespace std;
@@ -12,7 +15,7 @@ constexpr uint64_t kTableSize = 40000;
 
 void TestSetGet() {
 
-  IdTable t(kTableSize);
+  IdTable t;
 
   //set them all and check them all
   for(uint64_t i = 0; i < kTableSize; ++i) {
@@ -31,7 +34,7 @@ void TestSetGet() {
 void TestRandom() {
 
   //randomly set and then go get some
-  IdTable t(kTableSize);
+  IdTable t;
   std::unordered_set<uint64_t> ids;
   for(uint64_t i = 0; i < kTableSize; ++i) {
     uint64_t r = rand() % kTableSize;
@@ -50,12 +53,168 @@ void TestRandom() {
 
 }
 
+void TestRange() {
+
+  //set a few scattered bits and check ranges around them
+  IdTable t;
+  std::vector<uint64_t> ids = {0, 63, 64, 1000, 1001, 20000, kTableSize};
+  for(const auto id : ids)
+    t.set(id);
+
+  for(uint64_t i = 0; i < 3000; ++i) {
+    uint64_t min = rand() % kTableSize;
+    uint64_t max = min + rand() % 500;
+    bool expected = false;
+    for(const auto id : ids)
+      expected = expected || (id >= min && id <= max);
+    if(expected != t.IsUsed(min, max))
+      throw std::runtime_error("Range has wrong value");
+  }
+
+  if(!t.IsUsed(0, 0) || t.IsUsed(1, 62) || !t.IsUsed(1, 63) || !t.IsUsed(64, 64) ||
+     t.IsUsed(65, 999) || !t.IsUsed(65, kTableSize * 2) || t.IsUsed(kTableSize + 1, kTableSize * 2))
+    throw std::runtime_error("Range has wrong value");
+}
+
+void TestSparse() {
+
+  //ids far past any dense table and far apart from each other
+  IdTable t;
+  std::vector<uint64_t> ids = {3, 70000, 5000000000, 5000000001, 12000000000, 12000065535, 12000065536};
+  for(const auto id : ids)
+    t.set(id);
+  for(const auto id : ids) {
+    if(!t.IsUsed(id) || t.IsUsed(id + 2))
+      throw std::runtime_error("Bit has wrong value");
+  }
+
+  //ranges that span chunks that were never made
+  if(!t.IsUsed(4, 5000000000) || t.IsUsed(70001, 4999999999) || !t.IsUsed(5000000002, 12000000000) ||
+     t.IsUsed(12000000001, 12000065534) || !t.IsUsed(12000065535, 12000065536) ||
+     t.IsUsed(12000065537, 100000000000) || !t.IsUsed(0, 100000000000))
+    throw std::runtime_error("Range has wrong value");
+
+  //a handful of ids shouldnt take anything like a bit for every id up to them
+  if(t.memory() > 12000065536 / 8 / 100)
+    throw std::runtime_error("Sparse ids used too much memory: " + std::to_string(t.memory()));
+}
+
+void TestScattered() {
+
+  //a city worth of ids spread out over the range of a planet
+  IdTable t;
+  std::unordered_set<uint64_t> ids;
+  for(size_t i = 0; i < 200000; ++i) {
+    uint64_t id = (static_cast<uint64_t>(rand()) << 16 ^ rand()) % 13000000000;
+    if(t.set(id) != !ids.emplace(id).second)
+      throw std::runtime_error("Set should say whether the id was already used");
+  }
+  for(const auto id : ids) {
+    if(!t.IsUsed(id) || t.set(id) != true)
+      throw std::runtime_error("Bit has wrong value");
+  }
+
+  //memory should go with how many ids there are, a few bytes each plus a little for every chunk.
+  //a bitmap chunk for each id would be 512 bytes or more
+  if(t.memory() > ids.size() * 100)
+    throw std::runtime_error("Scattered ids used too much memory: " + std::to_string(t.memory()));
+}
+
+void TestDense() {
+
+  //fill a chunk up so it has to switch to a bitmap part way through
+  IdTable t;
+  std::unordered_set<uint64_t> ids;
+  const uint64_t base = 7 * 65536;
+  for(uint64_t i = 0; i < 20000; ++i) {
+    uint64_t r = base + rand() % 65536;
+    ids.emplace(r);
+    t.set(r);
+  }
+  for(uint64_t i = base - 64; i < base + 65536 + 64; ++i) {
+    bool exists = ids.find(i) != ids.end();
+    if(exists != t.IsUsed(i))
+      throw std::runtime_error("Bit has wrong value");
+  }
+  for(uint64_t i = 0; i < 3000; ++i) {
+    uint64_t min = base - 100 + rand() % 65736;
+    uint64_t max = min + rand() % 100;
+    bool expected = false;
+    for(uint64_t id = min; id <= max; ++id)
+      expected = expected || ids.find(id) != ids.end();
+    if(expected != t.IsUsed(min, max))
+      throw std::runtime_error("Range has wrong value");
+  }
+}
+
+void TestConcurrent() {
+
+  //threads setting overlapping ids should each find out about the ones they were first to set
+  ConcurrentIdTable t;
+  IdTable expected;
+  std::vector<std::vector<uint64_t> > ids(4);
+  for(auto& thread_ids : ids) {
+    for(uint64_t i = 0; i < 50000; ++i) {
+      uint64_t r = rand() % 200000;
+      //some way out and some past the end of a page
+      if(i % 7 == 0) r += 12000000000;
+      if(i % 11 == 0) r += 268435456 - 100000;
+      thread_ids.push_back(r);
+      expected.set(r);
+    }
+  }
+  std::atomic<size_t> firsts(0);
+  std::vector<std::thread> threads;
+  for(const auto& thread_ids : ids) {
+    threads.emplace_back([&t, &firsts, &thread_ids]() {
+      for(const auto id : thread_ids) {
+        if(!t.set(id))
+          ++firsts;
+      }
+    });
+  }
+  for(auto& thread : threads)
+    thread.join();
+
+  //exactly one set of each id said it wasnt there yet
+  std::unordered_set<uint64_t> distinct;
+  for(const auto& thread_ids : ids)
+    distinct.insert(thread_ids.begin(), thread_ids.end());
+  if(firsts != distinct.size())
+    throw std::runtime_error("Wrong number of ids were new");
+  if(!t.set(*distinct.begin()))
+    throw std::runtime_error("Id should already be set");
+
+  //and it should agree with the single threaded table
+  for(uint64_t i = 0; i < 300000; ++i) {
+    if(t.IsUsed(i) != expected.IsUsed(i) || t.IsUsed(i + 268435456 - 100000) != expected.IsUsed(i + 268435456 - 100000))
+      throw std::runtime_error("Bit has wrong value");
+  }
+  for(uint64_t i = 0; i < 3000; ++i) {
+    uint64_t min = rand() % 300000 + (i % 3 ? 0 : 12000000000);
+    uint64_t max = min + rand() % 50;
+    if(t.IsUsed(min, max) != expected.IsUsed(min, max))
+      throw std::runtime_error("Range has wrong value");
+  }
+  if(!t.IsUsed(0, 100000000000) || t.IsUsed(300000, 200000000) || t.IsUsed(12000200000, 12268000000))
+    throw std::runtime_error("Range has wrong value");
+}
+
 int main() {
   test::suite suite("nodetable");
 
   // Test setting and getting on random sizes of bit tables
   suite.test(TEST_CASE(TestSetGet));
   suite.test(TEST_CASE(TestRandom));
+  // Test checking ranges of bits
+  suite.test(TEST_CASE(TestRange));
+  // Test ids that are huge or far apart and chunks that fill up
+  suite.test(TEST_CASE(TestSparse));
+  // Test ids spread out over a large range
+  suite.test(TEST_CASE(TestScattered));
+  suite.test(TEST_CASE(TestDense));
+  // Test setting from many threads at once
+  suite.test(TEST_CASE(TestConcurrent));
 
   return suite.tear_down();
 }
@@ -0,0 +1,123 @@
+#include "test.h"
+
+#include <string>
+#include <vector>
+#include "mjolnir/luatagtransform.h"
+#include "mjolnir/osmpbfparser.h"
+#include "graph_lua_proc.h"
+
+using namespace valhalla::mjolnir;
+
+namespace {
+
+const std::string lua(lua_graph_lua, lua_graph_lua + lua_graph_lua_len);
+
+// transforms the tags of everything it sees with a pool of lua states
+struct transformer : public OSMPBF::BlockCallback {
+  transformer(const size_t size, const size_t cache_size): pool([cache_size]() { return new LuaTagTransform(lua, cache_size); }, size), single(lua) {}
+  void block_callback(const OSMPBF::Block& block) {
+    views.clear();
+    for (size_t i = 0; i < block.node_count(); ++i)
+      views.push_back(block.node_tags(i));
+    add(OSMType::kNode);
+    for (size_t i = 0; i < block.way_count(); ++i)
+      views.push_back(block.way_tags(i));
+    add(OSMType::kWay);
+    for (size_t i = 0; i < block.relation_count(); ++i)
+      views.push_back(block.relation_tags(i));
+    add(OSMType::kRelation);
+  }
+  void add(const OSMType type) {
+    pool.Transform(type, views, results);
+    //the same tags through a single state one at a time
+    for (size_t i = 0; i < views.size(); ++i)
+      if (results[i] != single.Transform(type, views[i]))
+        throw std::runtime_error("Pooled transform doesnt match a single lua state");
+    all.insert(all.end(), results.begin(), results.end());
+    views.clear();
+  }
+  TagTransformPool pool;
+  LuaTagTransform single;
+  std::vector<OSMPBF::TagView> views;
+  std::vector<Tags> results, all;
+};
+
+std::vector<Tags> transform(const size_t size, const size_t cache_size = 0, uint64_t* hits = nullptr) {
+  OSMPBF::MappedFile file("test/data/bike.osm.pbf");
+  transformer callback(size, cache_size);
+  OSMPBF::Parser::parse(file, OSMPBF::Interest::ALL, callback);
+  if (hits)
+    *hits = callback.pool.CacheHits();
+  return callback.all;
+}
+
+void TestPool() {
+  //the results should be the same no matter how many states are doing the work
+  auto one = transform(1);
+  auto four = transform(4);
+  if (one.empty() || one != four)
+    throw std::runtime_error("Transform results depend on the size of the pool");
+}
+
+// fails on the objects with a key named fail
+struct failing : public TagTransform {
+  Tags Transform(OSMType type, const Tags& tags) { return tags; }
+  Tags Transform(OSMType type, const OSMPBF::TagView& tags) {
+    OSMPBF::StringView value;
+    if (tags.find("fail", value))
+      throw std::runtime_error("failed");
+    return tags.to_tags();
+  }
+};
+
+void TestPoolErrors() {
+  //a failure on any of the threads should come back out and the pool should keep working after
+  TagTransformPool pool([]() { return new failing(); }, 4);
+  const std::vector<OSMPBF::StringView> strings = {"fail", "yes", "ok"};
+  const std::vector<uint32_t> fail = {0, 1}, ok = {2, 1};
+  std::vector<Tags> results;
+  for (size_t bad = 0; bad < 4096; bad += 1000) {
+    std::vector<OSMPBF::TagView> views(4096, OSMPBF::TagView(strings.data(), &ok[0], &ok[1], 1));
+    views[bad] = OSMPBF::TagView(strings.data(), &fail[0], &fail[1], 1);
+    bool threw = false;
+    try {
+      pool.Transform(OSMType::kNode, views, results);
+    }
+    catch (const std::runtime_error&) {
+      threw = true;
+    }
+    if (!threw)
+      throw std::runtime_error("Transform failure should have been passed on");
+    views[bad] = views[bad + 1];
+    pool.Transform(OSMType::kNode, views, results);
+    if (results.size() != views.size() || results[bad] != Tags{{"ok", "yes"}})
+      throw std::runtime_error("Pool should keep working after a failure");
+  }
+}
+
+void TestCache() {
+  //most of the nodes have no tags or the same few so a cache, even a tiny one, should get hits
+  auto uncached = transform(2);
+  for (size_t cache_size : {1, 16, 65536}) {
+    uint64_t hits = 0;
+    auto cached = transform(2, cache_size, &hits);
+    if (hits == 0)
+      throw std::runtime_error("Cache should have been used");
+    if (cached != uncached)
+      throw std::runtime_error("Cached transform results should match the uncached ones");
+  }
+}
+
+}
+
+int main() {
+  test::suite suite("luatagtransform");
+
+  suite.test(TEST_CASE(TestPool));
+
+  suite.test(TEST_CASE(TestPoolErrors));
+
+  suite.test(TEST_CASE(TestCache));
+
+  return suite.tear_down();
+}
@@ -0,0 +1,91 @@
+#include "test.h"
+
+#include <string>
+#include "mjolnir/osmdata.h"
+
+using namespace std;
+using namespace valhalla::mjolnir;
+
+namespace {
+
+void TestSpill() {
+  // Strings should come back the same from the file as from the map
+  OSMStringMap map;
+  for (uint64_t id = 1; id < 20000; id += 3)
+    map.set(id * 1000003, "Exit " + std::to_string(id));
+  map.set(5, "");
+  OSMStringMap copy = map;
+  map.Spill("test_osmdata_spill.bin");
+  if (map.size() != copy.size())
+    throw runtime_error("OSMStringMap: spilled map should have the same number of strings");
+  for (uint64_t id = 0; id < 20000; ++id) {
+    if (map.get(id * 1000003) != copy.get(id * 1000003))
+      throw runtime_error("OSMStringMap: spilled string for " + std::to_string(id) + " is wrong");
+  }
+  if (map.get(5) != "" || map.get(6) != "" || map.get(1000003) != "Exit 1")
+    throw runtime_error("OSMStringMap: spilled string is wrong");
+
+  // Theres nowhere to put new strings once spilled
+  bool threw = false;
+  try {
+    map.set(7, "Exit 7");
+  }
+  catch (const std::runtime_error&) {
+    threw = true;
+  }
+  if (!threw || map.get(7) != "")
+    throw runtime_error("OSMStringMap: setting a string once spilled should throw");
+
+  // Nothing to spill still works
+  OSMStringMap empty;
+  empty.Spill("test_osmdata_spill.bin");
+  if (empty.get(0) != "" || empty.get(1) != "")
+    throw runtime_error("OSMStringMap: empty spilled map should have no strings");
+}
+
+}
+
+void TestMultiMap() {
+  // Values for an id should come back together and in the order they were added
+  BikeMap map;
+  for (uint64_t i = 0; i < 1000; ++i) {
+    uint64_t id = (i * 7919) % 1000;
+    for (uint8_t network = 0; network < id % 4; ++network)
+      map.insert(BikeMap::value_type(id * 2, OSMBike{network, i, 0}));
+  }
+  try {
+    map.equal_range(0);
+    throw logic_error("OSMMultiMap: lookups shouldnt work before freezing");
+  }
+  catch (const logic_error& e) {
+    if (string(e.what()).find("frozen") == string::npos)
+      throw;
+  }
+  map.Freeze();
+  for (uint64_t id = 0; id < 1000; ++id) {
+    auto range = map.equal_range(id * 2);
+    uint8_t expected = 0;
+    for (auto b = range.first; b != range.second; ++b, ++expected) {
+      if (b->first != id * 2 || b->second.bike_network != expected)
+        throw runtime_error("OSMMultiMap: wrong value for " + std::to_string(id * 2));
+    }
+    if (expected != id % 4)
+      throw runtime_error("OSMMultiMap: wrong number of values for " + std::to_string(id * 2));
+    // Missing ids are at the end like they would be in an unordered map
+    range = map.equal_range(id * 2 + 1);
+    if (range.first != map.end() || range.second != map.end())
+      throw runtime_error("OSMMultiMap: found values for a missing id");
+  }
+}
+
+int main() {
+  test::suite suite("osmdata");
+
+  // Test reading strings back out of a file
+  suite.test(TEST_CASE(TestSpill));
+
+  // Test looking up values by id once sorted
+  suite.test(TEST_CASE(TestMultiMap));
+
+  return suite.tear_down();
+}
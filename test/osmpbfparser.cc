@@ -0,0 +1,255 @@
+#include "test.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <list>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include "mjolnir/osmpbfparser.h"
+
+using namespace OSMPBF;
+
+namespace {
+
+// remembers the kind and id of everything it sees along with a hash of the rest of it
+struct recorder : public BlockCallback {
+  void block_callback(const Block& block) {
+    for (size_t i = 0; i < block.node_count(); ++i)
+      add(0, block.node_ids[i], block.node_tags(i), block.node_lngs[i] + block.node_lats[i]);
+    for (size_t i = 0; i < block.way_count(); ++i) {
+      double refs = 0;
+      for (uint32_t j = block.way_ref_offsets[i]; j < block.way_ref_offsets[i + 1]; ++j)
+        refs = refs * 31 + block.way_refs[j];
+      add(1, block.way_ids[i], block.way_tags(i), refs);
+    }
+    for (size_t i = 0; i < block.relation_count(); ++i) {
+      double members = 0;
+      for (uint32_t j = block.member_offsets[i]; j < block.member_offsets[i + 1]; ++j)
+        members = members * 31 + block.member_ids[j] + block.strings[block.member_roles[j]].size();
+      add(2, block.relation_ids[i], block.relation_tags(i), members);
+    }
+  }
+  void add(const int kind, const uint64_t id, const TagView& tags, const double extra) {
+    //sorted so that the order they were written in doesnt matter
+    std::set<std::string> tag_set;
+    for (size_t i = 0; i < tags.size(); ++i)
+      tag_set.insert(tags.key(i).to_string() + "=" + tags.value(i).to_string() + ";");
+    std::string tag_string;
+    for (const auto& tag : tag_set)
+      tag_string += tag;
+    objects.emplace_back(std::make_pair(kind, id), std::make_pair(tag_string, extra));
+  }
+  std::vector<std::pair<std::pair<int, uint64_t>, std::pair<std::string, double> > > objects;
+};
+
+recorder parse_one(const std::string& file_name, const Interest interest) {
+  MappedFile file(file_name);
+  recorder result;
+  Parser::parse(file, interest, result);
+  return result;
+}
+
+recorder parse_many(const std::vector<std::string>& file_names, const Interest interest, const size_t threads) {
+  std::list<MappedFile> files;
+  for (const auto& file_name : file_names)
+    files.emplace_back(file_name);
+  std::vector<BlobIndex> indices(files.size());
+  recorder result;
+  Parser::parse(files, interest, result, indices, threads);
+  for (const auto& index : indices)
+    if (index.empty())
+      throw std::runtime_error("Merged parse should have indexed every file");
+  //a second time around with the indices should give the same thing
+  recorder indexed;
+  Parser::parse(files, interest, indexed, indices, threads);
+  if (indexed.objects != result.objects)
+    throw std::runtime_error("Merged parse with indices gave different results");
+  return result;
+}
+
+void TestMergeSame() {
+  //the same file twice should look just like the file once
+  auto one = parse_one("test/data/amsterdam.osm.pbf", ALL);
+  auto two = parse_many({"test/data/amsterdam.osm.pbf", "test/data/amsterdam.osm.pbf"}, ALL, 2);
+  if (one.objects.empty() || one.objects != two.objects)
+    throw std::runtime_error("Merging a file with itself should remove all the duplicates");
+}
+
+void TestMergeDifferent() {
+  //merging only works on sorted extracts, some of the test data has a way or two out of order
+  std::vector<std::string> names{"test/data/amsterdam.osm.pbf", "test/data/bus.osm.pbf", "test/data/bike.osm.pbf"};
+  for (auto interest : {ALL, NODES, WAYS}) {
+    //everything from all the files once each
+    std::set<std::pair<int, uint64_t> > expected;
+    for (const auto& name : names)
+      for (const auto& object : parse_one(name, interest).objects)
+        expected.insert(object.first);
+
+    //should come out sorted with no duplicates
+    auto merged = parse_many(names, interest, 4);
+    if (merged.objects.size() != expected.size())
+      throw std::runtime_error("Merged parse has the wrong number of objects");
+    auto object = merged.objects.begin();
+    for (const auto& key : expected) {
+      if (object->first != key)
+        throw std::runtime_error("Merged parse is out of order");
+      ++object;
+    }
+  }
+}
+
+// how many threads the process has going, 0 if it cant tell
+size_t count_threads() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 8, "Threads:") == 0)
+      return std::stoul(line.substr(8));
+  }
+  return 0;
+}
+
+// keeps track of the most threads the process had going while it was being called back
+struct thread_counter : public recorder {
+  void block_callback(const Block& block) {
+    recorder::block_callback(block);
+    threads = std::max(threads, count_threads());
+  }
+  size_t threads = 0;
+};
+
+void TestMergeMany() {
+  //more files than threads, the same extracts a few times over so it should look like them once
+  std::vector<std::string> names{"test/data/amsterdam.osm.pbf", "test/data/bus.osm.pbf", "test/data/bike.osm.pbf"};
+  std::set<std::pair<int, uint64_t> > expected;
+  for (const auto& name : names)
+    for (const auto& object : parse_one(name, ALL).objects)
+      expected.insert(object.first);
+  std::list<MappedFile> files;
+  for (size_t i = 0; i < 3; ++i)
+    for (const auto& name : names)
+      files.emplace_back(name);
+
+  for (const size_t threads : {1, 2}) {
+    std::vector<BlobIndex> indices(files.size());
+    const size_t before = count_threads();
+    thread_counter merged;
+    Parser::parse(files, ALL, merged, indices, threads);
+    if (merged.objects.size() != expected.size())
+      throw std::runtime_error("Merged parse of many files has the wrong number of objects");
+    auto object = merged.objects.begin();
+    for (const auto& key : expected) {
+      if (object->first != key)
+        throw std::runtime_error("Merged parse of many files is out of order");
+      ++object;
+    }
+
+    //the files share the threads rather than each getting some of their own
+    if (merged.threads > before + threads)
+      throw std::runtime_error("Merged parse used " + std::to_string(merged.threads) + " threads for " +
+                               std::to_string(files.size()) + " files");
+  }
+}
+
+struct stopper : public recorder {
+  bool done() { return objects.size() > 100; }
+};
+
+void TestMergeDone() {
+  std::list<MappedFile> files;
+  files.emplace_back("test/data/liechtenstein-latest.osm.pbf");
+  files.emplace_back("test/data/bus.osm.pbf");
+  std::vector<BlobIndex> indices(files.size());
+  stopper callback;
+  Parser::parse(files, ALL, callback, indices, 2);
+  //stopping early means the indices arent complete so they shouldnt be kept
+  if (callback.objects.size() > 8000 || !indices.front().empty() || !indices.back().empty())
+    throw std::runtime_error("Merged parse should stop when the callback is done");
+}
+
+// writes everything it sees back out
+struct copier : public BlockCallback {
+  copier(Writer& writer): writer(writer) {}
+  void block_callback(const Block& block) {
+    for (size_t i = 0; i < block.node_count(); ++i)
+      writer.node(block.node_ids[i], block.node_lngs[i], block.node_lats[i], block.node_tags(i).to_tags());
+    for (size_t i = 0; i < block.way_count(); ++i) {
+      block.refs(i, refs);
+      writer.way(block.way_ids[i], block.way_tags(i).to_tags(), refs);
+    }
+    for (size_t i = 0; i < block.relation_count(); ++i) {
+      block.members(i, members);
+      writer.relation(block.relation_ids[i], block.relation_tags(i).to_tags(), members);
+    }
+  }
+  Writer& writer;
+  std::vector<uint64_t> refs;
+  std::vector<Member> members;
+};
+
+void TestWriter() {
+  //copy a file out of order, a kind at a time
+  {
+    MappedFile in("test/data/liechtenstein-latest.osm.pbf");
+    HeaderBlock header;
+    header.set_source("test");
+    Writer writer("test/data/written.osm.pbf", header);
+    copier callback(writer);
+    for (auto interest : {RELATIONS, WAYS, NODES})
+      Parser::parse(in, interest, callback);
+    writer.close();
+  }
+
+  //should get back just what we put in and in the same order
+  MappedFile out("test/data/written.osm.pbf");
+  if (Parser::header(out).source() != "test")
+    throw std::runtime_error("Written header doesnt match");
+  if (parse_one("test/data/liechtenstein-latest.osm.pbf", ALL).objects != parse_one("test/data/written.osm.pbf", ALL).objects)
+    throw std::runtime_error("Written file doesnt match the original");
+  remove("test/data/written.osm.pbf");
+}
+
+void TestRecompress() {
+  //whatever it was compressed with we should get the same things back out
+  auto original = parse_one("test/data/liechtenstein-latest.osm.pbf", ALL);
+  for (auto compression : {UNCOMPRESSED, ZLIB, LZ4, ZSTD}) {
+    if (!Writer::supports(compression))
+      continue;
+    {
+      MappedFile in("test/data/liechtenstein-latest.osm.pbf");
+      Writer::recompress(in, "test/data/recompressed.osm.pbf", compression);
+    }
+    for (auto decoder : {LIBPROTOBUF, WIRE}) {
+      MappedFile file("test/data/recompressed.osm.pbf");
+      recorder result;
+      Parser::parse(file, ALL, result, 2, decoder);
+      if (result.objects != original.objects)
+        throw std::runtime_error("Recompressed file doesnt match the original");
+    }
+    remove("test/data/recompressed.osm.pbf");
+  }
+}
+
+}
+
+int main() {
+  test::suite suite("osmpbfparser");
+
+  suite.test(TEST_CASE(TestMergeSame));
+
+  suite.test(TEST_CASE(TestMergeDifferent));
+
+  suite.test(TEST_CASE(TestMergeMany));
+
+  suite.test(TEST_CASE(TestMergeDone));
+
+  suite.test(TEST_CASE(TestWriter));
+
+  suite.test(TEST_CASE(TestRecompress));
+
+  return suite.tear_down();
+}
@@ -0,0 +1,129 @@
+#include "test.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <boost/filesystem/operations.hpp>
+#include "mjolnir/sortfile.h"
+
+using namespace std;
+using namespace valhalla::mjolnir;
+
+namespace {
+
+struct record {
+  uint64_t key;
+  uint32_t value;
+  uint32_t padding;
+};
+
+bool by_key(const record& a, const record& b) {
+  return a.key < b.key;
+}
+
+std::vector<record> write(const std::string& file_name, const size_t count) {
+  std::vector<record> records;
+  for (size_t i = 0; i < count; ++i)
+    records.push_back({static_cast<uint64_t>(rand() % (count / 2 + 1)), static_cast<uint32_t>(i), 0});
+  std::ofstream file(file_name, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(record));
+  return records;
+}
+
+void check(const std::string& file_name, std::vector<record> expected) {
+  std::ifstream file(file_name, std::ios::binary);
+  std::vector<record> sorted(expected.size());
+  file.read(reinterpret_cast<char*>(sorted.data()), sorted.size() * sizeof(record));
+  if (!file || file.peek() != std::char_traits<char>::eof())
+    throw std::runtime_error("Sorted file is the wrong size");
+  if (!std::is_sorted(sorted.begin(), sorted.end(), by_key))
+    throw std::runtime_error("File wasnt sorted");
+
+  // Nothing should have gone missing or been duplicated
+  auto by_both = [](const record& a, const record& b) {
+    return a.key == b.key ? a.value < b.value : a.key < b.key;
+  };
+  std::sort(sorted.begin(), sorted.end(), by_both);
+  std::sort(expected.begin(), expected.end(), by_both);
+  for (size_t i = 0; i < sorted.size(); ++i) {
+    if (sorted[i].key != expected[i].key || sorted[i].value != expected[i].value)
+      throw std::runtime_error("Sorted file has different records");
+  }
+}
+
+void TestInMemory() {
+  // Fits in the budget so its sorted in place, on more threads than records some of the time
+  for (const size_t count : {0, 1, 2, 3, 17, 100000}) {
+    for (const unsigned int threads : {1, 4, 7}) {
+      auto records = write("test_sortfile.bin", count);
+      SortFile<record>("test_sortfile.bin", by_key, threads);
+      check("test_sortfile.bin", records);
+    }
+  }
+  boost::filesystem::remove("test_sortfile.bin");
+}
+
+void TestExternal() {
+  // Too big for the budget so it has to be sorted in runs and merged
+  for (const size_t count : {1000, 100003}) {
+    for (const unsigned int threads : {1, 3}) {
+      auto records = write("test_sortfile.bin", count);
+      SortFile<record>("test_sortfile.bin", by_key, threads, count * sizeof(record) / 10);
+      check("test_sortfile.bin", records);
+      if (boost::filesystem::exists("test_sortfile.bin.run0"))
+        throw std::runtime_error("Sorted runs should have been removed");
+    }
+  }
+  boost::filesystem::remove("test_sortfile.bin");
+}
+
+void TestByKey() {
+  // Sorted by the high bits of the key then the low ones, which should be the
+  // same as a stable comparison sort, whether it fits in the budget or not
+  auto high = [](const record& r) { return r.key >> 4; };
+  auto low = [](const record& r) { return static_cast<uint8_t>(r.key & 15); };
+  auto by_keys = [](const record& a, const record& b) { return a.key < b.key; };
+  for (const size_t count : {0, 1, 2, 300, 100000, 300007}) {
+    for (const unsigned int threads : {1, 4}) {
+      for (const size_t memory : {kSortMemory, count * sizeof(record) / 5}) {
+        auto records = write("test_sortfile.bin", count);
+        for (auto& r : records)
+          r.key = r.key * 1234567 + (static_cast<uint64_t>(1) << 40);
+        {
+          std::ofstream file("test_sortfile.bin", std::ios::binary | std::ios::trunc);
+          file.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(record));
+        }
+        SortFileByKey<record>("test_sortfile.bin", threads, memory, high, low);
+        std::stable_sort(records.begin(), records.end(), by_keys);
+        std::vector<record> sorted(count);
+        std::ifstream file("test_sortfile.bin", std::ios::binary);
+        file.read(reinterpret_cast<char*>(sorted.data()), sorted.size() * sizeof(record));
+        for (size_t i = 0; i < count; ++i) {
+          if (sorted[i].key != records[i].key || sorted[i].value != records[i].value)
+            throw std::runtime_error("Radix sorted file doesnt match a stable sort");
+        }
+      }
+    }
+  }
+  boost::filesystem::remove("test_sortfile.bin");
+}
+
+}
+
+int main() {
+  test::suite suite("sortfile");
+
+  // Test sorting files that fit in memory
+  suite.test(TEST_CASE(TestInMemory));
+
+  // Test sorting files that dont
+  suite.test(TEST_CASE(TestExternal));
+
+  // Test radix sorting by keys
+  suite.test(TEST_CASE(TestByKey));
+
+  return suite.tear_down();
+}
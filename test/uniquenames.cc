@@ -1,5 +1,10 @@
 #include "test.h"
 
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include "mjolnir/uniquenames.h"
 
 using namespace std;
@@ -51,6 +56,94 @@ void TestAddAndIndex() {
       throw runtime_error("UniqueNames: name given an index failed");
 }
 
+void TestMany() {
+  // Enough names to grow the table a number of times, checking they all come
+  // back the same once it has
+  UniqueNames names;
+  std::unordered_map<std::string, uint32_t> indexes;
+  for (size_t i = 0; i < 100000; ++i) {
+    std::string name = "Street " + std::to_string(rand() % 50000);
+    uint32_t index = names.index(name);
+    auto inserted = indexes.emplace(name, index);
+    if (inserted.first->second != index)
+      throw runtime_error("UniqueNames: same name got a different index");
+  }
+  if (names.Size() != indexes.size())
+    throw runtime_error("UniqueNames Size test failed");
+  for (const auto& name : indexes) {
+    if (names.name(name.second) != name.first || names.view(name.second) != name.first ||
+        names.index(name.first) != name.second)
+      throw runtime_error("UniqueNames: name given an index failed");
+  }
+
+  // The blank name and names that arent there
+  if (names.index("") != 0 || names.name(0) != "" || names.name(names.Size() + 1) != "")
+    throw runtime_error("UniqueNames: blank name should be at index 0");
+
+  // Names that are prefixes of each other or only differ by a null
+  UniqueNames prefixes;
+  uint32_t a = prefixes.index("Main");
+  uint32_t b = prefixes.index("Main St");
+  uint32_t c = prefixes.index(std::string("Main\0", 5));
+  if (a == b || a == c || b == c || prefixes.name(c) != std::string("Main\0", 5))
+    throw runtime_error("UniqueNames: similar names should be different");
+  prefixes.Clear();
+  if (prefixes.Size() != 0 || prefixes.index("Main St") != 1)
+    throw runtime_error("UniqueNames: Clear failed");
+}
+
+void TestSpill() {
+  // Names should come back the same out of the file
+  UniqueNames names;
+  std::vector<uint32_t> indexes;
+  for (size_t i = 0; i < 5000; ++i)
+    indexes.push_back(names.index("Road " + std::to_string(i)));
+  names.Spill("test_uniquenames_spill.bin");
+  if (names.Size() != 5000 || names.name(0) != "" || names.name(5001) != "")
+    throw runtime_error("UniqueNames: spilled size is wrong");
+  UniqueNames copy = names;
+  for (size_t i = 0; i < indexes.size(); ++i) {
+    if (names.name(indexes[i]) != "Road " + std::to_string(i) || copy.view(indexes[i]) != "Road " + std::to_string(i))
+      throw runtime_error("UniqueNames: spilled name given an index failed");
+  }
+
+  // No more can be added but the blank one is still there
+  if (names.index("") != 0)
+    throw runtime_error("UniqueNames: blank name should be at index 0");
+  try {
+    names.index("Road 1");
+    throw logic_error("UniqueNames: names shouldnt be added once spilled");
+  }
+  catch (const runtime_error&) {}
+}
+
+void TestConcurrent() {
+  // Threads adding overlapping names should all get the same index for each
+  ConcurrentUniqueNames names;
+  std::vector<std::vector<uint32_t> > indexes(4, std::vector<uint32_t>(20000));
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < indexes.size(); ++t) {
+    threads.emplace_back([&names, &indexes, t]() {
+      for (size_t i = 0; i < indexes[t].size(); ++i)
+        indexes[t][i] = names.index("Avenue " + std::to_string((i * (t + 1)) % 20000));
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+
+  if (names.Size() != 20000)
+    throw runtime_error("ConcurrentUniqueNames Size test failed");
+  for (size_t t = 0; t < indexes.size(); ++t) {
+    for (size_t i = 0; i < indexes[t].size(); ++i) {
+      std::string name = "Avenue " + std::to_string((i * (t + 1)) % 20000);
+      if (indexes[t][i] != names.index(name) || names.name(indexes[t][i]) != name || indexes[t][i] == 0)
+        throw runtime_error("ConcurrentUniqueNames: name given an index failed");
+    }
+  }
+  if (names.index("") != 0 || names.name(0) != "")
+    throw runtime_error("ConcurrentUniqueNames: blank name should be at index 0");
+}
+
 int main() {
   test::suite suite("uniquenames");
 
@@ -60,5 +153,14 @@ int main() {
   // Test Size
   suite.test(TEST_CASE(TestSize));
 
+  // Test lots of names and names that are nearly the same
+  suite.test(TEST_CASE(TestMany));
+
+  // Test reading names back out of a file
+  suite.test(TEST_CASE(TestSpill));
+
+  // Test adding names from many threads at once
+  suite.test(TEST_CASE(TestConcurrent));
+
   return suite.tear_down();
 }
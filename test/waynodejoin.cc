@@ -0,0 +1,122 @@
+#include "test.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <boost/filesystem/operations.hpp>
+#include "mjolnir/waynodejoin.h"
+
+using namespace std;
+using namespace valhalla::mjolnir;
+
+namespace {
+
+const std::string kFile = "test_waynodejoin.bin";
+
+OSMNode node(const uint64_t osmid, const float lat = 0) {
+  OSMNode n{};
+  n.osmid = osmid;
+  n.lat = lat;
+  return n;
+}
+
+// Way nodes of increasing ids, a few of each and lots of one, and the nodes of some of them
+void write(std::vector<OSMWayNode>& way_nodes, std::vector<OSMNode>& nodes) {
+  uint64_t osmid = 10;
+  for (size_t i = 0; i < 20000; ++i) {
+    osmid += 1 + rand() % 3;
+    // a node on so many ways its way nodes wont fit in a small chunk
+    const size_t count = i == 500 ? 3000 : 1 + rand() % 5;
+    for (size_t j = 0; j < count; ++j)
+      way_nodes.push_back({node(osmid), i, j});
+    if (rand() % 4)
+      nodes.push_back(node(osmid, static_cast<float>(i)));
+  }
+  std::ofstream file(kFile, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char*>(way_nodes.data()), way_nodes.size() * sizeof(OSMWayNode));
+}
+
+void TestJoin() {
+  // Tiny chunks so nodes span several of them and more threads than a few nodes would get
+  for (const size_t chunk_size : {static_cast<size_t>(1), static_cast<size_t>(7), static_cast<size_t>(1000), kJoinChunk}) {
+    for (const unsigned int threads : {1, 4}) {
+      std::vector<OSMWayNode> way_nodes;
+      std::vector<OSMNode> nodes;
+      write(way_nodes, nodes);
+      {
+        WayNodeJoin join(kFile, threads, chunk_size, 1);
+        std::vector<OSMNode> run;
+        for (const auto& n : nodes) {
+          run.push_back(n);
+          if (run.size() == 3000) {
+            join.Join(run);
+            run.clear();
+          }
+        }
+        join.Join(run);
+        join.Flush();
+      }
+
+      // Every way node should have its node, if it had one, and still be where it was
+      std::ifstream file(kFile, std::ios::binary);
+      std::vector<OSMWayNode> joined(way_nodes.size());
+      file.read(reinterpret_cast<char*>(joined.data()), joined.size() * sizeof(OSMWayNode));
+      if (!file || file.peek() != std::char_traits<char>::eof())
+        throw std::runtime_error("Joined file is the wrong size");
+      auto n = nodes.cbegin();
+      for (size_t i = 0; i < joined.size(); ++i) {
+        while (n != nodes.cend() && n->osmid < way_nodes[i].node.osmid)
+          ++n;
+        const float lat = n != nodes.cend() && n->osmid == way_nodes[i].node.osmid ? n->lat : 0;
+        if (joined[i].node.osmid != way_nodes[i].node.osmid || joined[i].node.lat != lat ||
+            joined[i].way_index != way_nodes[i].way_index ||
+            joined[i].way_shape_node_index != way_nodes[i].way_shape_node_index)
+          throw std::runtime_error("Way node " + std::to_string(i) + " wasnt joined to its node");
+      }
+    }
+  }
+  boost::filesystem::remove(kFile);
+}
+
+void TestMissing() {
+  // Nodes without any way nodes, between them and after the last of them
+  std::vector<OSMWayNode> way_nodes;
+  std::vector<OSMNode> nodes;
+  write(way_nodes, nodes);
+  std::vector<uint64_t> missing{way_nodes.back().node.osmid + 1};
+  for (size_t i = 1; i < way_nodes.size() && missing.size() == 1; ++i) {
+    if (way_nodes[i].node.osmid > way_nodes[i - 1].node.osmid + 1)
+      missing.push_back(way_nodes[i - 1].node.osmid + 1);
+  }
+  for (const auto osmid : missing) {
+    for (const size_t chunk_size : {static_cast<size_t>(1), kJoinChunk}) {
+      bool threw = false;
+      try {
+        WayNodeJoin join(kFile, 4, chunk_size, 1);
+        join.Join({node(osmid)});
+      }
+      catch (const std::runtime_error&) {
+        threw = true;
+      }
+      if (!threw)
+        throw std::runtime_error("Node " + std::to_string(osmid) + " shouldnt have been joined");
+    }
+  }
+  boost::filesystem::remove(kFile);
+}
+
+}
+
+int main() {
+  test::suite suite("waynodejoin");
+
+  // Test joining runs of nodes in chunks on several threads
+  suite.test(TEST_CASE(TestJoin));
+
+  // Test nodes that arent on any way
+  suite.test(TEST_CASE(TestMissing));
+
+  return suite.tear_down();
+}
@@ -0,0 +1,210 @@
+#include "test.h"
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "mjolnir/osmpbfparser.h"
+#include "mjolnir/wiredecoder.h"
+
+using namespace OSMPBF;
+
+namespace {
+
+// copies out everything in each block so that decoders can be compared
+struct block_recorder : public BlockCallback {
+  void block_callback(const Block& block) {
+    ids.insert(ids.end(), block.node_ids.begin(), block.node_ids.end());
+    ids.insert(ids.end(), block.way_ids.begin(), block.way_ids.end());
+    ids.insert(ids.end(), block.relation_ids.begin(), block.relation_ids.end());
+    ids.insert(ids.end(), block.way_refs.begin(), block.way_refs.end());
+    ids.insert(ids.end(), block.member_ids.begin(), block.member_ids.end());
+    coords.insert(coords.end(), block.node_lngs.begin(), block.node_lngs.end());
+    coords.insert(coords.end(), block.node_lats.begin(), block.node_lats.end());
+    for (size_t i = 0; i < block.node_count(); ++i)
+      record(block.node_tags(i));
+    for (size_t i = 0; i < block.way_count(); ++i)
+      record(block.way_tags(i));
+    for (size_t i = 0; i < block.relation_count(); ++i) {
+      record(block.relation_tags(i));
+      for (uint32_t j = block.member_offsets[i]; j < block.member_offsets[i + 1]; ++j) {
+        strings.push_back(block.strings[block.member_roles[j]].to_string());
+        ids.push_back(block.member_types[j]);
+      }
+    }
+  }
+  void record(const TagView& tags) {
+    strings.push_back(std::to_string(tags.size()));
+    for (size_t i = 0; i < tags.size(); ++i) {
+      strings.push_back(tags.key(i).to_string());
+      strings.push_back(tags.value(i).to_string());
+    }
+  }
+  std::vector<uint64_t> ids;
+  std::vector<double> coords;
+  std::vector<std::string> strings;
+};
+
+void Compare(const std::string& file_name, const Interest interest, const size_t threads) {
+  std::ifstream file(file_name, std::ios::in | std::ios::binary);
+  BlobIndex protobuf_index, wire_index;
+  block_recorder protobuf, wire;
+  Parser::parse(file, interest, protobuf, protobuf_index, threads, LIBPROTOBUF);
+  Parser::parse(file, interest, wire, wire_index, threads, WIRE);
+
+  if (protobuf.ids.empty() || protobuf.ids != wire.ids)
+    throw std::runtime_error("Wire decoder ids do not match libprotobuf for " + file_name);
+  if (protobuf.coords != wire.coords)
+    throw std::runtime_error("Wire decoder coordinates do not match libprotobuf for " + file_name);
+  if (protobuf.strings != wire.strings)
+    throw std::runtime_error("Wire decoder tags do not match libprotobuf for " + file_name);
+
+  //the indices should be the same too
+  if (protobuf_index.size() != wire_index.size())
+    throw std::runtime_error("Wire decoder index does not match libprotobuf for " + file_name);
+  for (size_t i = 0; i < protobuf_index.size(); ++i) {
+    const auto& a = protobuf_index[i];
+    const auto& b = wire_index[i];
+    if (a.offset != b.offset || a.size != b.size || a.kinds != b.kinds ||
+        a.min_node_id != b.min_node_id || a.max_node_id != b.max_node_id)
+      throw std::runtime_error("Wire decoder index does not match libprotobuf for " + file_name);
+  }
+}
+
+void TestAll() {
+  Compare("test/data/liechtenstein-latest.osm.pbf", ALL, 1);
+  Compare("test/data/baltimore.osm.pbf", ALL, 3);
+}
+
+void TestInterest() {
+  Compare("test/data/rome.osm.pbf", WAYS, 1);
+  Compare("test/data/rome.osm.pbf", RELATIONS, 2);
+  Compare("test/data/rome.osm.pbf", NODES, 1);
+}
+
+void TestTruncated() {
+  //a small block with a way in it
+  PrimitiveBlock primblock;
+  primblock.mutable_stringtable()->add_s("");
+  primblock.mutable_stringtable()->add_s("highway");
+  primblock.mutable_stringtable()->add_s("residential");
+  Way* way = primblock.add_primitivegroup()->add_ways();
+  way->set_id(7);
+  way->add_keys(1);
+  way->add_vals(2);
+  for (int i = 0; i < 100; ++i)
+    way->add_refs(i + 1);
+  std::string bytes = primblock.SerializeAsString();
+
+  //the whole thing works
+  WireDecoder decoder;
+  Block block;
+  decoder.decode(bytes.data(), bytes.size(), ALL, block);
+  if (block.way_count() != 1 || block.way_ids[0] != 7 || block.way_refs.size() != 100 ||
+      block.way_refs.back() != 5050 || block.way_tags(0).value(0) != "residential")
+    throw std::runtime_error("Wire decoder did not decode the way");
+
+  //cutting into the group should throw
+  try {
+    decoder.decode(bytes.data(), bytes.size() - 1, ALL, block);
+    throw std::logic_error("Truncated block should throw");
+  }
+  catch (const std::runtime_error&) {
+  }
+
+  //cutting anywhere should either throw or give back a consistent block but never crash
+  for (size_t size = 1; size < bytes.size(); ++size) {
+    try {
+      decoder.decode(bytes.data(), size, ALL, block);
+    }
+    catch (const std::runtime_error&) {
+      continue;
+    }
+    if (block.way_ref_offsets.size() != block.way_count() + 1 || block.keys.size() != block.vals.size())
+      throw std::runtime_error("Truncated block was decoded inconsistently");
+  }
+}
+
+//append a varint to some protobuf wire bytes
+void varint(std::string& bytes, uint64_t value) {
+  do {
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    bytes.push_back(static_cast<char>(value ? byte | 0x80 : byte));
+  } while (value);
+}
+
+//zig zag encode a signed value like sint64 fields are
+uint64_t zigzag(const int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+//append a length delimited field to some protobuf wire bytes
+void field(std::string& bytes, const uint32_t number, const std::string& value) {
+  varint(bytes, (number << 3) | 2);
+  varint(bytes, value.size());
+  bytes += value;
+}
+
+void TestLocationsOnWays() {
+  //the generated way doesnt know about locations so we tack them onto the wire ourselves
+  Way way;
+  way.set_id(7);
+  for (auto ref : { 10, 1, 0, 1 })
+    way.add_refs(ref);
+  std::string lats, lons;
+  for (int64_t delta : { 100, -5, 0, 7 }) {
+    varint(lats, zigzag(delta));
+    varint(lons, zigzag(-delta));
+  }
+  std::string way_bytes = way.SerializeAsString();
+  field(way_bytes, 9, lats);
+  field(way_bytes, 10, lons);
+  std::string group_bytes;
+  field(group_bytes, 3, way_bytes);
+  PrimitiveBlock primblock;
+  primblock.mutable_stringtable()->add_s("");
+  primblock.set_lat_offset(1000);
+  std::string bytes = primblock.SerializeAsString();
+  field(bytes, 2, group_bytes);
+
+  //the locations should line up with the refs, including skipping the duplicate
+  WireDecoder decoder;
+  Block block;
+  decoder.decode(bytes.data(), bytes.size(), ALL, block);
+  std::vector<uint64_t> refs{10, 11, 12};
+  std::vector<double> expected_lats{.000011, .0000105, .0000112}, expected_lngs{-.00001, -.0000095, -.0000102};
+  if (block.way_refs != refs || block.way_lats.size() != 3 || block.way_lngs.size() != 3)
+    throw std::runtime_error("Wire decoder did not decode the locations on the way");
+  for (size_t i = 0; i < refs.size(); ++i) {
+    if (std::abs(block.way_lats[i] - expected_lats[i]) > 1e-12 || std::abs(block.way_lngs[i] - expected_lngs[i]) > 1e-12)
+      throw std::runtime_error("Wire decoder got the wrong locations on the way");
+  }
+
+  //without locations they should stay empty
+  way_bytes = way.SerializeAsString();
+  group_bytes.clear();
+  field(group_bytes, 3, way_bytes);
+  bytes = primblock.SerializeAsString();
+  field(bytes, 2, group_bytes);
+  decoder.decode(bytes.data(), bytes.size(), ALL, block);
+  if (block.way_refs != refs || !block.way_lats.empty() || !block.way_lngs.empty())
+    throw std::runtime_error("Wire decoder made up locations for the way");
+}
+
+}
+
+int main() {
+  test::suite suite("wiredecoder");
+
+  suite.test(TEST_CASE(TestAll));
+
+  suite.test(TEST_CASE(TestInterest));
+
+  suite.test(TEST_CASE(TestTruncated));
+
+  suite.test(TEST_CASE(TestLocationsOnWays));
+
+  return suite.tear_down();
+}
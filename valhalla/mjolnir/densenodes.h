@@ -0,0 +1,60 @@
+#ifndef VALHALLA_MJOLNIR_DENSENODES_H
+#define VALHALLA_MJOLNIR_DENSENODES_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// this describes the high-level OSM objects
+#include "proto/osmformat.pb.h"
+
+// extend the protobuf osmpbf namespace
+namespace OSMPBF {
+
+/**
+ * Turns a run of delta encoded values into absolute values (an inclusive prefix sum).
+ * Uses SSE2 or AVX2 when the build targets them, otherwise a plain loop.
+ * @param  deltas  the delta encoded values
+ * @param  count   how many values there are
+ * @param  start   the value the deltas are relative to, ie the last value of the previous run
+ * @param  values  where to put the absolute values, may be the same as deltas
+ * @return the last absolute value so that the next run can pick up where this one left off
+ */
+int64_t delta_decode(const int64_t* deltas, const size_t count, const int64_t start, int64_t* values);
+
+/**
+ * Same as above but always uses the plain loop, mostly here for testing and benchmarking.
+ */
+int64_t delta_decode_scalar(const int64_t* deltas, const size_t count, const int64_t start, int64_t* values);
+
+/**
+ * Decodes the ids and coordinates of a whole group of dense nodes and appends them
+ * to the output arrays. The deltas are summed as integers and only converted to
+ * degrees once per node: 1e-9 * (offset + granularity * value)
+ * @param  dense        the dense nodes of a primitive group
+ * @param  lat_offset   latitude offset of the primitive block in nanodegrees
+ * @param  lon_offset   longitude offset of the primitive block in nanodegrees
+ * @param  granularity  granularity of the primitive block in nanodegrees
+ * @param  ids          the node ids get appended here
+ * @param  lngs         the node longitudes get appended here
+ * @param  lats         the node latitudes get appended here
+ */
+void decode_dense_nodes(const DenseNodes& dense, const int64_t lat_offset, const int64_t lon_offset,
+                        const int32_t granularity, std::vector<uint64_t>& ids,
+                        std::vector<double>& lngs, std::vector<double>& lats);
+
+/**
+ * Same as above but for dense nodes whose delta encoded columns have already been
+ * pulled out of the wire format into arrays
+ * @param  ids    delta encoded node ids
+ * @param  lats   delta encoded latitudes
+ * @param  lons   delta encoded longitudes
+ * @param  count  the number of nodes, ie the length of each column
+ */
+void decode_dense_nodes(const int64_t* ids, const int64_t* lats, const int64_t* lons, const size_t count,
+                        const int64_t lat_offset, const int64_t lon_offset, const int32_t granularity,
+                        std::vector<uint64_t>& out_ids, std::vector<double>& lngs, std::vector<double>& lats_out);
+
+}
+
+#endif  // VALHALLA_MJOLNIR_DENSENODES_H
@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <boost/property_tree/ptree.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include <valhalla/baldr/signinfo.h>
 
@@ -31,7 +32,7 @@ class GraphBuilder {
   static void Build(const boost::property_tree::ptree& pt, const OSMData& osmdata,
       const std::string& ways_file, const std::string& way_nodes_file);
 
-  static std::string GetRef(const std::string& way_ref, const std::string& relation_ref);
+  static std::string GetRef(const boost::string_ref& way_ref, const std::string& relation_ref);
 
   static std::vector<baldr::SignInfo> CreateExitSignInfoList(const OSMNode& node,
                                                       const OSMWay& way,
@@ -0,0 +1,49 @@
+#ifndef VALHALLA_MJOLNIR_GRAPHTAGTRANSFORM_H
+#define VALHALLA_MJOLNIR_GRAPHTAGTRANSFORM_H
+
+#include <valhalla/mjolnir/osmdata.h>
+#include <valhalla/mjolnir/osmpbfparser.h>
+#include <valhalla/mjolnir/tagtransform.h>
+
+namespace valhalla {
+namespace mjolnir {
+
+/**
+ * The default graph profile (lua/graph.lua) compiled rather than interpreted.
+ * Gives exactly the same tags back as running that script through a
+ * LuaTagTransform, which is only needed for custom profiles
+ */
+class GraphTagTransform : public TagTransform {
+ public:
+
+  /**
+   * Goes up whenever what comes out of the transform changes, so that
+   * results kept from an older version (ie a routing extract) arent reused
+   */
+  static constexpr uint32_t kVersion = 1;
+
+  Tags Transform(OSMType type, const Tags& tags) override;
+
+  /**
+   * Same as above but reads the tags straight out of the pbf block
+   * @param type  the type of osm object the tags belong to
+   * @param tags  view of the tags of the object
+   */
+  Tags Transform(OSMType type, const OSMPBF::TagView& tags) override;
+
+  const std::unordered_set<std::string>* Keys(OSMType type) const override;
+
+ protected:
+
+  /**
+   * Transforms the tags in place, the count is the number of tags that were
+   * handed in (which ways_proc uses to throw out objects without any)
+   */
+  Tags Process(OSMType type, Tags& tags, const size_t count);
+
+};
+
+}
+}
+
+#endif  // VALHALLA_MJOLNIR_GRAPHTAGTRANSFORM_H
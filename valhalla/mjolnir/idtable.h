@@ -1,24 +1,27 @@
 #ifndef VALHALLA_MJOLNIR_IDTABLE_H
 #define VALHALLA_MJOLNIR_IDTABLE_H
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <vector>
-#include <algorithm>
 
 namespace valhalla {
 namespace mjolnir {
 
 /**
  * A method for marking OSM Ids that are used by ways/nodes/relations.
- * Uses a vector where 1 bit is used for each possible Id.
- * So for a maximum OSM Id of 4 billion this uses 500MB memory
+ * The Ids are split into chunks of 65536 which are only made when an Id in
+ * them is set. A chunk keeps a sorted list of the Ids in it until it has so
+ * many that 1 bit for each possible Id (8KB) is smaller. So the memory used
+ * depends on how many Ids are set rather than on how large they are
  */
 class IdTable {
  public:
-   /**
-    * Constructor
-    * @param   maxosmid   Maximum OSM Id to support.
-    */
-  IdTable(const uint64_t maxosmid);
+  /**
+   * Constructor
+   */
+  IdTable();
 
   /**
    * Destructor
@@ -28,8 +31,9 @@ class IdTable {
   /**
    * Sets the OSM Id as used.
    * @param   osmid   OSM Id of the way/node/relation.
+   * @return  Returns true if the OSM Id was already used. False if not.
    */
-  void set(const uint64_t id);
+  bool set(const uint64_t id);
 
   /**
    * Test if the OSM Id is used / set in the bitmarker.
@@ -38,9 +42,93 @@ class IdTable {
    */
   const bool IsUsed(const uint64_t id) const;
 
+  /**
+   * Test if any OSM Id within a range is used / set in the bitmarker.
+   * @param  min_id  Lowest OSM Id of the range
+   * @param  max_id  Highest OSM Id of the range (inclusive)
+   * @return  Returns true if any OSM Id in the range is used. False if not.
+   */
+  const bool IsUsed(const uint64_t min_id, const uint64_t max_id) const;
+
+  /**
+   * How many bytes the chunks are taking up
+   * @return  Returns the memory used by the table.
+   */
+  size_t memory() const;
+
  private:
-  const uint64_t maxosmid_;
-  std::vector<uint64_t> bitmarkers_;
+  // The Ids that share all but their lowest 16 bits
+  struct Chunk {
+    // The low bits of the Ids while there arent many, sorted
+    std::vector<uint16_t> ids;
+    // 1 bit for each Id once there are, 1024 words
+    std::unique_ptr<uint64_t[]> bits;
+
+    bool set(const uint16_t id);
+    bool IsUsed(const uint16_t id) const;
+    bool IsUsed(const uint16_t min_id, const uint16_t max_id) const;
+  };
+
+  std::vector<Chunk> chunks_;
+};
+
+/**
+ * Same as above but Ids can be set and tested from any number of threads at
+ * once. Setting an Id says whether it was already set, and exactly one of the
+ * threads that set the same Id is told it wasnt, so "seen before" checks can
+ * run in parallel. Chunks are 4096 Ids of bits that are made on first use, in
+ * pages of 65536 chunks, so Ids have to be below 2^42
+ */
+class ConcurrentIdTable {
+ public:
+  /**
+   * Constructor
+   */
+  ConcurrentIdTable();
+
+  /**
+   * Destructor
+   */
+  ~ConcurrentIdTable();
+
+  /**
+   * Sets the OSM Id as used.
+   * @param   osmid   OSM Id of the way/node/relation.
+   * @return  Returns true if the OSM Id was already used. False if not.
+   */
+  bool set(const uint64_t id);
+
+  /**
+   * Test if the OSM Id is used / set in the bitmarker.
+   * @param  id  OSM Id
+   * @return  Returns true if the OSM Id is used. False if not.
+   */
+  const bool IsUsed(const uint64_t id) const;
+
+  /**
+   * Test if any OSM Id within a range is used / set in the bitmarker.
+   * @param  min_id  Lowest OSM Id of the range
+   * @param  max_id  Highest OSM Id of the range (inclusive)
+   * @return  Returns true if any OSM Id in the range is used. False if not.
+   */
+  const bool IsUsed(const uint64_t min_id, const uint64_t max_id) const;
+
+  /**
+   * How many bytes the pages and chunks are taking up
+   * @return  Returns the memory used by the table.
+   */
+  size_t memory() const;
+
+ private:
+  using Word = std::atomic<uint64_t>;
+  using ChunkPtr = std::atomic<Word*>;
+
+  // The chunk an Id is in or nullptr if nothing in it was set
+  const Word* chunk(const uint64_t id) const;
+
+  std::unique_ptr<std::atomic<ChunkPtr*>[]> pages_;
+  std::atomic<size_t> page_count_;
+  std::atomic<size_t> chunk_count_;
 };
 }
 }
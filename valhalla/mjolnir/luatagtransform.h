@@ -8,34 +8,114 @@ extern "C" {
 }
 
 #include <valhalla/mjolnir/osmdata.h>
+#include <valhalla/mjolnir/osmpbfparser.h>
+#include <valhalla/mjolnir/tagtransform.h>
 
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace valhalla {
 namespace mjolnir {
 
-using Tags = std::unordered_map<std::string, std::string>;
-
 /**
+ * Transforms tags by handing them to the nodes_proc, ways_proc and rels_proc
+ * functions of a lua script
  */
-class LuaTagTransform {
+class LuaTagTransform : public TagTransform {
  public:
 
   /**
    * Constructor
-   * @param lua   the string containing the lua code
+   * @param lua         the string containing the lua code
+   * @param cache_size  how many distinct sets of tags to remember the results
+   *                    of, so that seeing them again doesnt call into lua. 0 is
+   *                    no cache. tags with names, refs and the like are never
+   *                    cached since they are all but unique
    */
-  LuaTagTransform(const std::string& lua);
+  LuaTagTransform(const std::string& lua, const size_t cache_size = 0);
 
   ~LuaTagTransform();
 
-  Tags Transform(OSMType type, const Tags &tags);
+  Tags Transform(OSMType type, const Tags &tags) override;
+
+  /**
+   * Same as above but reads the tags straight out of the pbf block they came
+   * from so that they never have to be copied into a map first
+   * @param type  the type of osm object the tags belong to
+   * @param tags  view of the tags of the object
+   */
+  Tags Transform(OSMType type, const OSMPBF::TagView& tags) override;
+
+  /**
+   * The keys from the node_keys, way_keys and relation_keys tables of the
+   * script, or nullptr if it doesnt have the one for the type
+   */
+  const std::unordered_set<std::string>* Keys(OSMType type) const override;
+
+  /**
+   * How many times the tags were found in the cache, or not found and
+   * transformed by lua, since the stats were last cleared
+   */
+  uint64_t CacheHits() const override;
+  uint64_t CacheMisses() const override;
+  void ClearCacheStats() override;
 
  protected:
 
+  /**
+   * Builds the cache key for the tags, returns false if they shouldnt be cached
+   */
+  bool CacheKey(OSMType type, const OSMPBF::TagView& tags);
+
+  /**
+   * Pushes the tags onto the stack and calls the lua function for the type
+   */
+  Tags Call(OSMType type, const OSMPBF::TagView& tags);
+
+  /**
+   * Pushes the function for the type and the emptied input table, which is
+   * reused for every call instead of making a new one each time
+   */
+  void Prepare(OSMType type);
+
+  /**
+   * Pushes a key, from the registry if we've pushed the same one before
+   */
+  void PushKey(const char* key, const size_t size);
+
+  /**
+   * Calls the lua function for the type, the function, the table of input tags
+   * and its size must already be on the stack and are consumed
+   */
+  Tags Call(OSMType type);
+
   lua_State* state_;
 
+  // registry references to the function for each type of object and to the input table
+  int funcs_[3];
+  int input_;
+
+  // the keys the script says it looks at for each type of object
+  std::unique_ptr<std::unordered_set<std::string> > read_keys_[3];
+
+  // registry references to the key strings we've pushed before
+  std::unordered_map<std::string, int> keys_;
+  std::string scratch_;
+
+  // the results are read into here before becoming the tags we hand back
+  std::vector<std::pair<std::string, std::string> > output_;
+
+  // the results of tags we've seen before by their key
+  size_t cache_size_;
+  std::unordered_map<std::string, Tags> cache_;
+  uint64_t cache_hits_, cache_misses_;
+  // reused for building keys
+  std::string key_;
+  std::vector<size_t> order_;
+
 };
 
 }
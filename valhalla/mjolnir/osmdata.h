@@ -1,11 +1,14 @@
 #ifndef VALHALLA_MJOLNIR_OSMDATA_H
 #define VALHALLA_MJOLNIR_OSMDATA_H
 
+#include <algorithm>
 #include <cstdint>
+#include <stdexcept>
 #include <string>
 #include <vector>
 #include <map>
 #include <memory>
+#include <unordered_map>
 
 #include <valhalla/mjolnir/osmnode.h>
 #include <valhalla/mjolnir/osmway.h>
@@ -13,6 +16,7 @@
 #include <valhalla/mjolnir/osmrestriction.h>
 #include <valhalla/mjolnir/osmaccessrestriction.h>
 #include <valhalla/mjolnir/uniquenames.h>
+#include <valhalla/midgard/sequence.h>
 
 
 namespace valhalla {
@@ -24,12 +28,116 @@ struct OSMBike {
   size_t ref_index;
 };
 
-using RestrictionsMap = std::unordered_multimap<uint64_t, OSMRestriction>;
-using AccessRestrictionsMap = std::unordered_multimap<uint64_t, OSMAccessRestriction>;
+/**
+ * Any number of values for each OSM Id, kept in one vector. Added to in any
+ * order while parsing and then sorted by Id once, after which the values of
+ * an Id sit next to each other and are found with a binary search
+ */
+template <class T>
+class OSMMultiMap {
+ public:
+  using value_type = std::pair<uint64_t, T>;
+  using const_iterator = typename std::vector<value_type>::const_iterator;
+
+  /**
+   * Add a value for an OSM Id. It can't be found until the map is frozen.
+   * @param  value  OSM Id and value
+   */
+  void insert(const value_type& value) {
+    values_.push_back(value);
+    frozen_ = false;
+  }
+
+  /**
+   * Sorts the values by Id, keeping the order they were added in for each Id,
+   * and gives back any space that was reserved for more.
+   */
+  void Freeze() {
+    std::stable_sort(values_.begin(), values_.end(), by_id());
+    values_.shrink_to_fit();
+    frozen_ = true;
+  }
+
+  /**
+   * Get the values for an OSM Id.
+   * @param  id  OSM Id
+   * @return  Returns the range of values for the Id, or end() twice if none.
+   */
+  std::pair<const_iterator, const_iterator> equal_range(const uint64_t id) const {
+    if (!frozen_)
+      throw std::logic_error("OSMMultiMap - must be frozen before looking up ids");
+    auto range = std::equal_range(values_.begin(), values_.end(), id, by_id());
+    if (range.first == range.second)
+      return {values_.end(), values_.end()};
+    return range;
+  }
+
+  const_iterator begin() const { return values_.begin(); }
+  const_iterator end() const { return values_.end(); }
+  size_t size() const { return values_.size(); }
+  bool empty() const { return values_.empty(); }
+
+ protected:
+  // Orders values by their Id and compares Ids to them
+  struct by_id {
+    bool operator()(const value_type& a, const value_type& b) const { return a.first < b.first; }
+    bool operator()(const value_type& a, const uint64_t b) const { return a.first < b; }
+    bool operator()(const uint64_t a, const value_type& b) const { return a < b.first; }
+  };
+
+  std::vector<value_type> values_;
+  bool frozen_ = true;
+};
+
+using RestrictionsMap = OSMMultiMap<OSMRestriction>;
+using AccessRestrictionsMap = OSMMultiMap<OSMAccessRestriction>;
 
-using BikeMap = std::unordered_multimap<uint64_t, OSMBike>;
+using BikeMap = OSMMultiMap<OSMBike>;
 
-using OSMStringMap = std::unordered_map<uint64_t, std::string>;
+/**
+ * Strings keyed by OSM Id. Kept in a hash map while parsing, after which they
+ * can be moved out to a memory mapped file sorted by Id
+ */
+class OSMStringMap {
+ public:
+  /**
+   * Set the string for an OSM Id, replacing any it already had.
+   * @param  id     OSM Id
+   * @param  value  String for the Id.
+   */
+  void set(const uint64_t id, const std::string& value);
+
+  /**
+   * Get the string for an OSM Id from the map or the file.
+   * @param  id  OSM Id
+   * @return  Returns the string or an empty string if there isnt one.
+   */
+  std::string get(const uint64_t id) const;
+
+  /**
+   * Get the number of Ids that have a string.
+   * @return  Returns the number of strings, whether spilled or not.
+   */
+  size_t size() const;
+
+  /**
+   * Writes the strings to a file sorted by Id, maps it and empties the map.
+   * Strings can still be got but no more can be set.
+   * @param  file_name  File to write the strings to, removed once mapped.
+   */
+  void Spill(const std::string& file_name);
+
+ protected:
+  // The strings until they are spilled
+  std::unordered_map<uint64_t, std::string> strings_;
+
+  // Once spilled the Ids, where their strings start and the strings
+  std::shared_ptr<midgard::mem_map<char> > spilled_;
+  size_t spilled_count_ = 0;
+  const uint64_t* spilled_ids_ = nullptr;
+  const uint64_t* spilled_offsets_ = nullptr;
+  const char* spilled_strings_ = nullptr;
+};
 
 using OSMShapeMap = std::unordered_map<uint64_t, PointLL>;
 using OSMWayMap = std::unordered_map<uint64_t, std::list<uint64_t>>;
@@ -94,6 +202,13 @@ struct OSMData {
   // Vector of admins.
   std::vector<OSMAdmin> admins_;
 
+  /**
+   * Moves the strings, which are only read once parsing is done, out to
+   * memory mapped files so they are kept in the page cache instead of the heap
+   * @param  prefix  What to start the names of the temporary files with.
+   */
+  void SpillStrings(const std::string& prefix);
+
 };
 
 }
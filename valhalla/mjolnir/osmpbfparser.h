@@ -31,7 +31,12 @@
 #define __OSMPBFPARSER__
 
 #include <string>
+#include <vector>
+#include <list>
+#include <memory>
 #include <fstream>
+#include <unordered_map>
+#include <boost/utility/string_ref.hpp>
 
 // this describes the low-level blob storage
 #include "proto/fileformat.pb.h"
@@ -44,9 +49,52 @@ namespace OSMPBF {
 // Which callbacks you want to be called
 enum Interest { NONE = 0x0, NODES = 0x01, WAYS = 0x02, RELATIONS = 0x04, ALL = 0x07 };
 
+// How to decode the blocks, with libprotobuf message objects or by walking the wire format directly
+enum Decoder { LIBPROTOBUF = 0, WIRE = 1 };
+
+// How the blobs of a written file are compressed, lz4 and zstd are only there when built with them
+enum Compression { UNCOMPRESSED = 0, ZLIB = 1, LZ4 = 2, ZSTD = 3 };
+
 // Represents the key/values of an object
 using Tags = std::unordered_map<std::string, std::string>;
 
+// A view of a string in the string table of a block
+using StringView = boost::string_ref;
+
+// Zero copy view of the key/values of an object. Points into the string table of
+// the block the object came from so it is only valid for the duration of a callback
+class TagView {
+ public:
+  TagView(const StringView* strings, const uint32_t* keys, const uint32_t* vals, const size_t size, const size_t stride = 1);
+
+  //number of key/value pairs
+  size_t size() const;
+  bool empty() const;
+
+  //the interned id (index into the string table of the block) of the i'th key or value
+  uint32_t key_id(const size_t i) const;
+  uint32_t value_id(const size_t i) const;
+
+  //the i'th key or value
+  StringView key(const size_t i) const;
+  StringView value(const size_t i) const;
+
+  //find the value of a key by its interned id, returns false if the key isnt there
+  bool find(const uint32_t key_id, StringView& value) const;
+  //find the value of a key, returns false if the key isnt there
+  bool find(const StringView& key, StringView& value) const;
+
+  //copy the key/values out into a map
+  Tags to_tags() const;
+
+ protected:
+  const StringView* strings_;
+  const uint32_t* keys_;
+  const uint32_t* vals_;
+  size_t size_;
+  size_t stride_;
+};
+
 // Member of a relation
 struct Member {
   Relation::MemberType member_type;
@@ -57,20 +105,217 @@ struct Member {
   Member(Member&& other);
 };
 
-//pure virtual interface for consumers to implement
+// The decoded primitives of a block laid out in columns so they can be processed in
+// tight loops. Keys, values and roles are ids into the string table of the block and
+// each object owns the range [offsets[i], offsets[i + 1]) of the key/values, refs or
+// members. Like the TagView, the strings are only valid for the duration of a callback
+struct Block {
+  //views of the strings in the block
+  std::vector<StringView> strings;
+
+  //key/values of every object in the block
+  std::vector<uint32_t> keys;
+  std::vector<uint32_t> vals;
+
+  //nodes
+  std::vector<uint64_t> node_ids;
+  std::vector<double> node_lngs;
+  std::vector<double> node_lats;
+  std::vector<uint32_t> node_tag_offsets;
+
+  //ways
+  std::vector<uint64_t> way_ids;
+  std::vector<uint32_t> way_tag_offsets;
+  std::vector<uint64_t> way_refs;
+  std::vector<uint32_t> way_ref_offsets;
+  //the locations of the refs when the file has them on its ways (LocationsOnWays), otherwise
+  //empty. only the wire decoder lays these out
+  std::vector<double> way_lngs;
+  std::vector<double> way_lats;
+
+  //relations
+  std::vector<uint64_t> relation_ids;
+  std::vector<uint32_t> relation_tag_offsets;
+  std::vector<Relation::MemberType> member_types;
+  std::vector<uint64_t> member_ids;
+  std::vector<uint32_t> member_roles;
+  std::vector<uint32_t> member_offsets;
+
+  //number of each kind of primitive
+  size_t node_count() const;
+  size_t way_count() const;
+  size_t relation_count() const;
+
+  //the tags of the i'th node, way or relation
+  TagView node_tags(const size_t i) const;
+  TagView way_tags(const size_t i) const;
+  TagView relation_tags(const size_t i) const;
+
+  //copy the refs or members of the i'th way or relation into a (reused) vector
+  void refs(const size_t i, std::vector<uint64_t>& refs) const;
+  void members(const size_t i, std::vector<Member>& members) const;
+
+  //lay out the primitives of a parsed block that are of interest, the block must outlive this
+  void fill(const PrimitiveBlock& primblock, const Interest interest);
+  void clear();
+};
+
+// Where a data blob lives in the file, which kinds of primitives (Interest) it holds
+// and the range of node ids it holds (both 0 if it holds none)
+struct BlobInfo {
+  uint64_t offset;
+  uint32_t size;
+  uint8_t kinds;
+  uint64_t min_node_id;
+  uint64_t max_node_id;
+};
+
+// Index of the data blobs in a file, in file order
+using BlobIndex = std::vector<BlobInfo>;
+
+//interface for consumers that want their own copies of the tags
 struct Callback {
   virtual ~Callback(){};
   virtual void node_callback(const uint64_t osmid, const double lng, const double lat, const Tags& tags) = 0;
   virtual void way_callback(const uint64_t osmid, const Tags& tags, const std::vector<uint64_t>& nodes) = 0;
   virtual void relation_callback(const uint64_t osmid, const Tags &tags, const std::vector<Member> &members) = 0;
+  //when parsing with an index, return true to skip a blob of nodes whose ids are all within [min_id, max_id]
+  virtual bool skip_nodes(const uint64_t min_id, const uint64_t max_id) { return false; }
+  //return true to stop parsing, checked after each blob
+  virtual bool done() { return false; }
+};
+
+//zero copy interface for consumers to implement, the tags are only valid during the callback
+struct ViewCallback {
+  virtual ~ViewCallback(){};
+  virtual void node_callback(const uint64_t osmid, const double lng, const double lat, const TagView& tags) = 0;
+  virtual void way_callback(const uint64_t osmid, const TagView& tags, const std::vector<uint64_t>& nodes) = 0;
+  virtual void relation_callback(const uint64_t osmid, const TagView& tags, const std::vector<Member>& members) = 0;
+  //when parsing with an index, return true to skip a blob of nodes whose ids are all within [min_id, max_id]
+  virtual bool skip_nodes(const uint64_t min_id, const uint64_t max_id) { return false; }
+  //return true to stop parsing, checked after each blob
+  virtual bool done() { return false; }
+};
+
+//adapts the zero copy interface to consumers that want copies of the tags
+struct TagsAdapter : public ViewCallback {
+  TagsAdapter(Callback& callback);
+  void node_callback(const uint64_t osmid, const double lng, const double lat, const TagView& tags);
+  void way_callback(const uint64_t osmid, const TagView& tags, const std::vector<uint64_t>& nodes);
+  void relation_callback(const uint64_t osmid, const TagView& tags, const std::vector<Member>& members);
+  bool skip_nodes(const uint64_t min_id, const uint64_t max_id);
+  bool done();
+ protected:
+  Callback& callback_;
+};
+
+//batch interface for consumers that want a whole block of primitives at a time
+struct BlockCallback {
+  virtual ~BlockCallback(){};
+  virtual void block_callback(const Block& block) = 0;
+  //when parsing with an index, return true to skip a blob of nodes whose ids are all within [min_id, max_id]
+  virtual bool skip_nodes(const uint64_t min_id, const uint64_t max_id) { return false; }
+  //return true to stop parsing, checked after each blob
+  virtual bool done() { return false; }
+};
+
+//adapts the batch interface to consumers that want one object at a time
+struct BlockAdapter : public BlockCallback {
+  BlockAdapter(ViewCallback& callback);
+  void block_callback(const Block& block);
+  bool skip_nodes(const uint64_t min_id, const uint64_t max_id);
+  bool done();
+ protected:
+  ViewCallback& callback_;
+  std::vector<uint64_t> refs_;
+  std::vector<Member> members_;
+};
+
+// Read only memory map of a whole pbf file so the parser can inflate blobs straight out of it.
+// Holding one keeps the file around even if it gets moved or deleted underneath us
+class MappedFile {
+ public:
+  MappedFile(const std::string& file_name);
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const;
+  size_t size() const;
+
+  //let the kernel know we will be reading this range soon
+  void will_need(const uint64_t offset, const size_t size) const;
+  //let the kernel drop the pages in this range, we are done with them for now
+  void done_with(const uint64_t offset, const size_t size) const;
+
+ protected:
+  static size_t page_size();
+
+  const char* data_;
+  size_t size_;
+};
+
+// Gathers up the primitives of one kind into blocks and writes them to a file of their own
+struct BlockWriter;
+
+// Writes primitives out to a pbf file. Each kind has to come in id order but the kinds can come
+// in any order (ie ways before nodes), each is kept in a temporary file until close puts them
+// together as a single file sorted by kind then id that the parser can read
+class Writer {
+ public:
+  Writer(const std::string& file_name, const HeaderBlock& header, const Compression compression = ZLIB);
+  ~Writer();
+  Writer(const Writer&) = delete;
+  Writer& operator=(const Writer&) = delete;
+
+  void node(const uint64_t osmid, const double lng, const double lat, const Tags& tags);
+  void way(const uint64_t osmid, const Tags& tags, const std::vector<uint64_t>& nodes);
+  void relation(const uint64_t osmid, const Tags& tags, const std::vector<Member>& members);
+
+  //write out the file, nothing shows up at file_name until this is called
+  void close();
+
+  //whether blobs can be compressed (and inflated) this way
+  static bool supports(const Compression compression);
+  //copy the file blob by blob recompressing each one, everything else about it stays the same
+  static void recompress(const MappedFile& file, const std::string& file_name, const Compression compression);
+
+ protected:
+  std::string file_name_;
+  HeaderBlock header_;
+  Compression compression_;
+  std::unique_ptr<BlockWriter> nodes_, ways_, relations_;
+  bool closed_;
 };
 
 //the parser used to get data out of the osmpbf file
 class Parser {
  public:
   Parser() = delete;
-  //parse the pbf file for the things you are interested in
-  static void parse(std::ifstream& file, const Interest interest, Callback& callback);
+  //parse the pbf file for the things you are interested in. with more than one thread a
+  //reader thread feeds a pool of decoding threads but callbacks still happen in file order
+  //and only ever on the calling thread
+  static void parse(std::ifstream& file, const Interest interest, Callback& callback, const size_t threads = 1, const Decoder decoder = LIBPROTOBUF);
+  //same as above but uses the index to only read the blobs that have something you are interested in.
+  //if the index is empty the whole file is read and the index is filled out for the next time around
+  static void parse(std::ifstream& file, const Interest interest, Callback& callback, BlobIndex& index, const size_t threads = 1, const Decoder decoder = LIBPROTOBUF);
+  //same as the above but the tags are handed out as views into the blocks rather than copies
+  static void parse(std::ifstream& file, const Interest interest, ViewCallback& callback, const size_t threads = 1, const Decoder decoder = LIBPROTOBUF);
+  static void parse(std::ifstream& file, const Interest interest, ViewCallback& callback, BlobIndex& index, const size_t threads = 1, const Decoder decoder = LIBPROTOBUF);
+  //same as the above but the callback gets a whole block at a time. all of them can pick which decoder
+  //lays out the blocks, the results are the same either way
+  static void parse(std::ifstream& file, const Interest interest, BlockCallback& callback, const size_t threads = 1, const Decoder decoder = LIBPROTOBUF);
+  static void parse(std::ifstream& file, const Interest interest, BlockCallback& callback, BlobIndex& index, const size_t threads = 1, const Decoder decoder = LIBPROTOBUF);
+  //same as the above but reads blobs straight out of a memory mapped file rather than copying them
+  static void parse(const MappedFile& file, const Interest interest, BlockCallback& callback, const size_t threads = 1, const Decoder decoder = LIBPROTOBUF);
+  static void parse(const MappedFile& file, const Interest interest, BlockCallback& callback, BlobIndex& index, const size_t threads = 1, const Decoder decoder = LIBPROTOBUF);
+  //parse several files at once, each with an index of its own. the objects from all of them are merged
+  //so the callback sees them in id order (nodes then ways then relations) just as if it were a single
+  //sorted file. objects that are in more than one file (ie at extract borders) only show up once.
+  //like everything else here this expects each of the files to be sorted
+  static void parse(const std::list<MappedFile>& files, const Interest interest, BlockCallback& callback, std::vector<BlobIndex>& indices, const size_t threads = 1, const Decoder decoder = LIBPROTOBUF);
+  //the header block of the file, empty if it doesnt have one
+  static HeaderBlock header(const MappedFile& file);
   //clean up (mainly pbf memory)
   static void free();
 };
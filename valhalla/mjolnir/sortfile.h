@@ -0,0 +1,341 @@
+#ifndef VALHALLA_MJOLNIR_SORTFILE_H
+#define VALHALLA_MJOLNIR_SORTFILE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <valhalla/midgard/sequence.h>
+
+namespace valhalla {
+namespace mjolnir {
+
+// How much memory a file sort uses if it isnt told otherwise
+constexpr size_t kSortMemory = static_cast<size_t>(1024) * 1024 * 1024;
+
+namespace detail {
+
+// Runs the function on a number of threads, passing on the first exception
+inline void run_threads(const unsigned int count, const std::function<void (unsigned int)>& work) {
+  if (count == 1) {
+    work(0);
+    return;
+  }
+  std::vector<std::thread> threads;
+  std::exception_ptr error;
+  std::mutex lock;
+  for (unsigned int i = 0; i < count; ++i) {
+    threads.emplace_back([&work, &error, &lock, i]() {
+      try {
+        work(i);
+      }
+      catch (...) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!error)
+          error = std::current_exception();
+      }
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+  if (error)
+    std::rethrow_exception(error);
+}
+
+// Sorts the memory in slices, one for each thread, and then merges neighbouring
+// slices in parallel until there is only one left
+template <class T, class Compare>
+void sort_in_memory(T* begin, const size_t count, const Compare& compare, const unsigned int threads) {
+  const size_t slice = (count + threads - 1) / threads;
+  run_threads(threads, [&](unsigned int i) {
+    const size_t first = std::min(count, i * slice), last = std::min(count, first + slice);
+    std::sort(begin + first, begin + last, compare);
+  });
+  for (size_t width = slice; width < count; width *= 2) {
+    const size_t pairs = (count + width * 2 - 1) / (width * 2);
+    run_threads(static_cast<unsigned int>(pairs), [&](unsigned int i) {
+      const size_t first = i * width * 2, middle = std::min(count, first + width),
+                   last = std::min(count, first + width * 2);
+      std::inplace_merge(begin + first, begin + middle, begin + last, compare);
+    });
+  }
+}
+
+// Reads one sorted run back a buffer at a time
+template <class T>
+struct run_reader {
+  run_reader(const std::string& file_name, const size_t count, const size_t buffer_size)
+    : file(file_name, std::ios::binary), remaining(count), position(0) {
+    buffer.reserve(std::min(count, buffer_size));
+    if (!file)
+      throw std::runtime_error("SortFile - failed to open " + file_name);
+    fill();
+  }
+  bool fill() {
+    buffer.resize(std::min(remaining, buffer.capacity()));
+    file.read(reinterpret_cast<char*>(buffer.data()), buffer.size() * sizeof(T));
+    if (!file)
+      throw std::runtime_error("SortFile - failed to read a sorted run");
+    remaining -= buffer.size();
+    position = 0;
+    return !buffer.empty();
+  }
+  const T& front() const { return buffer[position]; }
+  bool next() { return ++position < buffer.size() || fill(); }
+  std::ifstream file;
+  std::vector<T> buffer;
+  size_t remaining, position;
+};
+
+// Sorts the file with sort_all if it fits in memory, otherwise has the threads
+// sort chunks of it with sort_chunk and merges those. Either can need extra
+// memory as much as the records they are sorting times the overhead
+template <class T, class Compare>
+void sort_file(const std::string& file_name, const Compare& compare, const unsigned int threads,
+               const size_t memory, const size_t overhead, const std::function<void (T*, size_t)>& sort_all,
+               const std::function<void (std::vector<T>&)>& sort_chunk) {
+  std::ifstream in(file_name, std::ios::binary | std::ios::ate);
+  if (!in)
+    throw std::runtime_error("SortFile - failed to open " + file_name);
+  const size_t count = static_cast<size_t>(in.tellg()) / sizeof(T);
+  in.close();
+  if (count < 2)
+    return;
+
+  // It all fits so sort it where it is
+  if (count * sizeof(T) * (1 + overhead) <= memory) {
+    midgard::mem_map<T> mapped;
+    mapped.map(file_name, count);
+    sort_all(mapped.get(), count);
+    return;
+  }
+
+  // Each thread sorts a chunk at a time until there are none left
+  const size_t chunk = std::max(static_cast<size_t>(1), memory / threads / (sizeof(T) * (1 + overhead)));
+  const size_t runs = (count + chunk - 1) / chunk;
+  auto run_name = [&file_name](size_t run) { return file_name + ".run" + std::to_string(run); };
+  std::atomic<size_t> next_run(0);
+  run_threads(threads, [&](unsigned int) {
+    std::ifstream file(file_name, std::ios::binary);
+    std::vector<T> buffer;
+    for (size_t run = next_run++; run < runs; run = next_run++) {
+      buffer.resize(std::min(chunk, count - run * chunk));
+      file.seekg(run * chunk * sizeof(T));
+      file.read(reinterpret_cast<char*>(buffer.data()), buffer.size() * sizeof(T));
+      if (!file)
+        throw std::runtime_error("SortFile - failed to read " + file_name);
+      sort_chunk(buffer);
+      std::ofstream out(run_name(run), std::ios::binary | std::ios::trunc);
+      out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(T));
+      if (!out)
+        throw std::runtime_error("SortFile - failed to write " + run_name(run));
+    }
+  });
+
+  // Merge the runs back over the original, splitting the memory between
+  // reading each of them and writing the output. Ties go to the earlier run
+  const size_t buffer_size = std::max(static_cast<size_t>(1024), memory / (runs + 1) / sizeof(T));
+  std::vector<std::unique_ptr<run_reader<T> > > readers;
+  for (size_t run = 0; run < runs; ++run)
+    readers.emplace_back(new run_reader<T>(run_name(run), std::min(chunk, count - run * chunk), buffer_size));
+  auto later = [&readers, &compare](const size_t a, const size_t b) {
+    if (compare(readers[b]->front(), readers[a]->front()))
+      return true;
+    return !compare(readers[a]->front(), readers[b]->front()) && b < a;
+  };
+  std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heap(later);
+  for (size_t run = 0; run < runs; ++run)
+    heap.push(run);
+
+  std::fstream out(file_name, std::ios::binary | std::ios::in | std::ios::out);
+  std::vector<T> output;
+  output.reserve(buffer_size);
+  while (!heap.empty()) {
+    const size_t run = heap.top();
+    heap.pop();
+    output.push_back(readers[run]->front());
+    if (readers[run]->next())
+      heap.push(run);
+    if (output.size() == output.capacity() || heap.empty()) {
+      out.write(reinterpret_cast<const char*>(output.data()), output.size() * sizeof(T));
+      output.clear();
+    }
+  }
+  if (!out)
+    throw std::runtime_error("SortFile - failed to write " + file_name);
+
+  // Clean up the runs
+  readers.clear();
+  for (size_t run = 0; run < runs; ++run)
+    std::remove(run_name(run).c_str());
+}
+
+// Stable LSD radix sort of the records by one unsigned integer key, up to 11
+// bits at a time. Each thread counts and then moves the records of its own
+// slice so the order of equal keys is kept. Only the bits that differ between
+// some of the keys are sorted on (ids tend to fit in far less than 64 bits) and
+// they are split evenly over the fewest passes. Ends with the records in data
+template <class T, class Key>
+void radix_sort(T* data, T* scratch, const size_t count, const Key& key, unsigned int threads) {
+  constexpr size_t kMaxBits = 11;
+  threads = static_cast<unsigned int>(std::max(static_cast<size_t>(1),
+                                      std::min(static_cast<size_t>(threads), count / 65536)));
+  const size_t slice = (count + threads - 1) / threads;
+  auto first = [slice, count](unsigned int t) { return std::min(count, t * slice); };
+  auto last = [slice, count](unsigned int t) { return std::min(count, (t + 1) * slice); };
+
+  // Which bits differ between any of the keys
+  std::vector<uint64_t> ors(threads, 0), ands(threads, ~static_cast<uint64_t>(0));
+  run_threads(threads, [&](unsigned int t) {
+    for (size_t i = first(t); i < last(t); ++i) {
+      const uint64_t k = key(data[i]);
+      ors[t] |= k;
+      ands[t] &= k;
+    }
+  });
+  uint64_t all_or = 0, all_and = ~static_cast<uint64_t>(0);
+  for (unsigned int t = 0; t < threads; ++t) {
+    all_or |= ors[t];
+    all_and &= ands[t];
+  }
+  const uint64_t differ = all_or ^ all_and;
+  if (differ == 0)
+    return;
+  size_t low = 0, high = 64;
+  while (!((differ >> low) & 1))
+    ++low;
+  while (!((differ >> (high - 1)) & 1))
+    --high;
+  const size_t passes = (high - low + kMaxBits - 1) / kMaxBits;
+  const size_t bits = (high - low + passes - 1) / passes;
+  const size_t digits = static_cast<size_t>(1) << bits;
+  const uint64_t mask = digits - 1;
+
+  T* from = data;
+  T* to = scratch;
+  std::vector<size_t> offsets(threads * digits);
+  for (size_t pass = 0; pass < passes; ++pass) {
+    const size_t shift = low + pass * bits;
+
+    // Count each digit in each slice, then work out where each slice's share of
+    // each digit starts: after all smaller digits and the same digit in earlier slices
+    std::fill(offsets.begin(), offsets.end(), 0);
+    run_threads(threads, [&](unsigned int t) {
+      size_t* counts = &offsets[t * digits];
+      for (size_t i = first(t); i < last(t); ++i)
+        ++counts[(static_cast<uint64_t>(key(from[i])) >> shift) & mask];
+    });
+    size_t total = 0;
+    for (size_t digit = 0; digit < digits; ++digit) {
+      for (unsigned int t = 0; t < threads; ++t) {
+        const size_t digit_count = offsets[t * digits + digit];
+        offsets[t * digits + digit] = total;
+        total += digit_count;
+      }
+    }
+
+    // Move the records
+    run_threads(threads, [&](unsigned int t) {
+      size_t* positions = &offsets[t * digits];
+      for (size_t i = first(t); i < last(t); ++i)
+        to[positions[(static_cast<uint64_t>(key(from[i])) >> shift) & mask]++] = from[i];
+    });
+    std::swap(from, to);
+  }
+
+  // An odd number of passes leaves them in the scratch space
+  if (from != data) {
+    run_threads(threads, [&](unsigned int t) {
+      std::copy(from + first(t), from + last(t), data + first(t));
+    });
+  }
+}
+
+// Sorts by the least significant key first so the stable passes for the more
+// significant keys keep that order within their ties
+template <class T>
+void radix_sort_keys(T*, T*, const size_t, const unsigned int) {
+}
+template <class T, class Key, class... Keys>
+void radix_sort_keys(T* data, T* scratch, const size_t count, const unsigned int threads,
+                     const Key& key, const Keys&... keys) {
+  radix_sort_keys(data, scratch, count, threads, keys...);
+  radix_sort(data, scratch, count, key, threads);
+}
+
+// Orders records by their keys, most significant first
+template <class T>
+bool less_by_keys(const T&, const T&) {
+  return false;
+}
+template <class T, class Key, class... Keys>
+bool less_by_keys(const T& a, const T& b, const Key& key, const Keys&... keys) {
+  const auto ka = key(a), kb = key(b);
+  return ka < kb || (!(kb < ka) && less_by_keys(a, b, keys...));
+}
+
+}
+
+/**
+ * Sorts a file of T, such as one a midgard::sequence wrote, using a number of
+ * threads and about as much memory as it is given. If the file fits it is
+ * memory mapped and sorted in place, counting the buffer merging the sorted
+ * slices can take, which may be as big as the file. Otherwise each thread
+ * sorts chunks of it into files of their own and those are merged back into
+ * the original file
+ * @param  file_name  File to sort
+ * @param  compare    Returns true if the first T goes before the second
+ * @param  threads    How many threads to sort with
+ * @param  memory     Roughly how many bytes to use
+ */
+template <class T, class Compare>
+void SortFile(const std::string& file_name, const Compare& compare, unsigned int threads,
+              const size_t memory = kSortMemory) {
+  threads = std::max(1u, threads);
+  detail::sort_file<T>(file_name, compare, threads, memory, 1,
+    [&compare, threads](T* begin, size_t count) { detail::sort_in_memory(begin, count, compare, threads); },
+    [&compare](std::vector<T>& chunk) { std::sort(chunk.begin(), chunk.end(), compare); });
+}
+
+/**
+ * Same as above but sorts by unsigned integer keys of the records with a
+ * radix sort instead of comparing them, which also needs scratch space as
+ * big as what it is sorting. Unlike the above it is stable, records with
+ * equal keys keep the order they had in the file
+ * @param  file_name  File to sort
+ * @param  threads    How many threads to sort with
+ * @param  memory     Roughly how many bytes to use
+ * @param  keys       Functions that give the unsigned integer keys of a T,
+ *                    most significant first
+ */
+template <class T, class... Keys>
+void SortFileByKey(const std::string& file_name, unsigned int threads, const size_t memory,
+                   const Keys&... keys) {
+  threads = std::max(1u, threads);
+  auto compare = [&](const T& a, const T& b) { return detail::less_by_keys(a, b, keys...); };
+  detail::sort_file<T>(file_name, compare, threads, memory, 1,
+    [&](T* begin, size_t count) {
+      std::unique_ptr<T[]> scratch(new T[count]);
+      detail::radix_sort_keys(begin, scratch.get(), count, threads, keys...);
+    },
+    [&](std::vector<T>& chunk) {
+      std::unique_ptr<T[]> scratch(new T[chunk.size()]);
+      detail::radix_sort_keys(chunk.data(), scratch.get(), chunk.size(), 1, keys...);
+    });
+}
+
+}
+}
+
+#endif  // VALHALLA_MJOLNIR_SORTFILE_H
@@ -0,0 +1,156 @@
+#ifndef VALHALLA_MJOLNIR_TAGTRANSFORM_H
+#define VALHALLA_MJOLNIR_TAGTRANSFORM_H
+
+#include <valhalla/mjolnir/osmdata.h>
+#include <valhalla/mjolnir/osmpbfparser.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace valhalla {
+namespace mjolnir {
+
+using Tags = std::unordered_map<std::string, std::string>;
+
+/**
+ * Turns the tags of an osm object into the tags the graph builder uses, or
+ * into nothing at all if the object isnt of any use to it
+ */
+class TagTransform {
+ public:
+
+  virtual ~TagTransform() {}
+
+  /**
+   * Transform the tags of an object
+   * @param type  the type of osm object the tags belong to
+   * @param tags  the tags of the object
+   * @return the transformed tags, empty if the object should be ignored
+   */
+  virtual Tags Transform(OSMType type, const Tags& tags) = 0;
+
+  /**
+   * Same as above but reads the tags straight out of the pbf block they came
+   * from so that they never have to be copied into a map first
+   * @param type  the type of osm object the tags belong to
+   * @param tags  view of the tags of the object
+   */
+  virtual Tags Transform(OSMType type, const OSMPBF::TagView& tags) = 0;
+
+  /**
+   * The keys the transform looks at for a type of object. An object with none
+   * of them comes out the same as an object without any tags, other than that
+   * it keeps the tags it had, so there is no need to transform it at all
+   * @param type  the type of osm object
+   * @return the keys or nullptr if the transform cant say which it looks at,
+   *         in which case every object has to be transformed
+   */
+  virtual const std::unordered_set<std::string>* Keys(OSMType type) const { return nullptr; }
+
+  /**
+   * How many times the tags were found in a cache of earlier results, or not
+   * found, since the stats were last cleared. Always 0 without a cache
+   */
+  virtual uint64_t CacheHits() const { return 0; }
+  virtual uint64_t CacheMisses() const { return 0; }
+  virtual void ClearCacheStats() { }
+
+};
+
+/**
+ * A number of independent tag transforms so that tags can be transformed on
+ * more than one thread at a time. A transform (ie a lua state) can only be
+ * used by one thread at a time so each thread gets one of its own. The
+ * threads are started with the pool and wait for work between batches
+ */
+class TagTransformPool {
+ public:
+
+  /**
+   * Constructor
+   * @param make  makes one of the transforms in the pool
+   * @param size  the number of transforms, at least one
+   */
+  TagTransformPool(const std::function<TagTransform*()>& make, const size_t size);
+
+  /**
+   * Destructor, stops the threads
+   */
+  ~TagTransformPool();
+
+  TagTransformPool(const TagTransformPool&) = delete;
+  TagTransformPool& operator=(const TagTransformPool&) = delete;
+
+  /**
+   * The number of transforms in the pool
+   */
+  size_t size() const;
+
+  /**
+   * One of the transforms, only to be used by one thread at a time
+   * @param index  which transform, less than size()
+   */
+  TagTransform& operator[](const size_t index);
+
+  /**
+   * Transforms the tags of a number of objects of the same type spread over
+   * all of the transforms. Each result lines up with the tags it came from no
+   * matter which thread did it, so the results are the same with any size pool
+   * @param type     the type of osm object the tags belong to
+   * @param tags     views of the tags of each object
+   * @param results  the transformed tags of each object
+   */
+  void Transform(OSMType type, const std::vector<OSMPBF::TagView>& tags, std::vector<Tags>& results);
+
+  /**
+   * The keys the transforms look at for a type of object, see TagTransform
+   */
+  const std::unordered_set<std::string>* Keys(OSMType type) const;
+
+  /**
+   * The cache stats of all the transforms together
+   */
+  uint64_t CacheHits() const;
+  uint64_t CacheMisses() const;
+  void ClearCacheStats();
+
+ protected:
+
+  // Transforms a range of the current batch with one of the transforms
+  void Work(const size_t index);
+
+  // Waits for batches and does its share of them, for all but the first transform
+  void Worker(const size_t index);
+
+  std::vector<std::unique_ptr<TagTransform> > transforms_;
+
+  // The threads for all but the first transform, which the calling thread uses
+  std::vector<std::thread> threads_;
+  std::mutex lock_;
+  std::condition_variable start_, finish_;
+
+  // The current batch, which transforms are working on it and how many havent finished
+  OSMType type_;
+  const std::vector<OSMPBF::TagView>* tags_;
+  std::vector<Tags>* results_;
+  size_t count_, remaining_;
+  std::vector<std::exception_ptr> errors_;
+  // Goes up with each batch so the threads know theres a new one
+  uint64_t batch_;
+  bool stop_;
+
+};
+
+}
+}
+
+#endif  // VALHALLA_MJOLNIR_TAGTRANSFORM_H
@@ -1,18 +1,23 @@
 #ifndef VALHALLA_MJOLNIR_UNIQUENAMES_H
 #define VALHALLA_MJOLNIR_UNIQUENAMES_H
 
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
-#include <algorithm>
-#include <unordered_map>
+#include <boost/utility/string_ref.hpp>
+
+#include <valhalla/midgard/sequence.h>
 
 namespace valhalla {
 namespace mjolnir {
 
-using NamesMap = std::unordered_map<std::string, uint32_t>;
-
 /**
- * Class to hold a list of unique names and indexes to them.
+ * Class to hold a list of unique names and indexes to them. The names are
+ * kept one after another in a single buffer and found again through an open
+ * addressing hash table of their indexes, rather than each being a string of
+ * its own in a node of a map
  */
 class UniqueNames {
  public:
@@ -27,14 +32,22 @@ class UniqueNames {
    * @param  name  Name.
    * @return  Returns an index into the unique list of names.
    */
-  uint32_t index(const std::string& name);
+  uint32_t index(const boost::string_ref& name);
 
   /**
    * Get a name given an index.
    * @param  index  Index into the unique name list.
    * @return  Returns the name
    */
-  const std::string& name(const uint32_t index) const;
+  std::string name(const uint32_t index) const;
+
+  /**
+   * Get a name given an index without copying it. Only valid until another
+   * name is added.
+   * @param  index  Index into the unique name list.
+   * @return  Returns the name
+   */
+  boost::string_ref view(const uint32_t index) const;
 
   /**
    * Clear the names and indexes.
@@ -52,13 +65,98 @@ class UniqueNames {
    */
   void Log() const;
 
+  /**
+   * Moves the names out to a memory mapped file, for when they are only going
+   * to be read from. Names can still be got but no more can be added.
+   * @param  file_name  File to write the names to, removed once mapped.
+   */
+  void Spill(const std::string& file_name);
+
+  /**
+   * The hash the names are looked up by.
+   * @param  name  Name.
+   * @return  Returns the hash of the name.
+   */
+  static uint64_t Hash(const boost::string_ref& name);
+
  protected:
-  // Map of names to indexes
-  NamesMap names_;
+  friend class ConcurrentUniqueNames;
+
+  // Same as above but with the hash already worked out
+  uint32_t index(const boost::string_ref& name, const uint64_t hash);
 
-  // List of entries into the map
-  using nameiter = NamesMap::iterator;
-  std::vector<nameiter> indexes_;
+  // Makes the table twice as big and puts the indexes back in it
+  void Grow();
+
+  // The characters of all of the names one after another
+  std::vector<char> names_;
+
+  // Where each name starts in the above, with one more for the end of the last
+  std::vector<uint64_t> offsets_;
+
+  // Part of the hash of each name, to skip comparing most names that arent it
+  std::vector<uint32_t> hashes_;
+
+  // The indexes of the names where their hashes put them, 0 if the slot is empty
+  std::vector<uint32_t> table_;
+
+  // Once spilled the offsets and characters are read out of the file instead
+  std::shared_ptr<midgard::mem_map<char> > spilled_;
+  size_t spilled_count_;
+  const uint64_t* spilled_offsets_;
+  const char* spilled_names_;
+};
+
+/**
+ * Same as above but names can be added and got from any number of threads at
+ * once. The names are split by hash into shards that are each locked on their
+ * own, so threads rarely wait on each other. The shard is kept in the low
+ * bits of the index so indexes are not handed out one after another
+ */
+class ConcurrentUniqueNames {
+ public:
+  /**
+   * Constructor.
+   */
+  ConcurrentUniqueNames();
+
+  /**
+   * Get an index for the specified name. If the name is not already used
+   * it is added to the name map.
+   * @param  name  Name.
+   * @return  Returns an index into the unique list of names.
+   */
+  uint32_t index(const boost::string_ref& name);
+
+  /**
+   * Get a name given an index.
+   * @param  index  Index into the unique name list.
+   * @return  Returns the name
+   */
+  std::string name(const uint32_t index) const;
+
+  /**
+   * Clear the names and indexes.
+   */
+  void Clear();
+
+  /**
+   * Get the size - number of names.
+   * @return  Returns the number of unique names.
+   */
+  size_t Size() const;
+
+  /**
+   * Log information about the number of unique names, size of the vector, etc.
+   */
+  void Log() const;
+
+ protected:
+  struct Shard {
+    mutable std::mutex lock;
+    UniqueNames names;
+  };
+  std::unique_ptr<Shard[]> shards_;
 };
 
 }
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <string>
+#include <boost/utility/string_ref.hpp>
 
 namespace valhalla {
 namespace mjolnir {
@@ -14,7 +15,7 @@ namespace mjolnir {
  * @param  delim      defaults to ;
  * @return the vector of strings
 */
-std::vector<std::string> GetTagTokens(const std::string& tag_value,
+std::vector<std::string> GetTagTokens(const boost::string_ref& tag_value,
                                       char delim = ';');
 
 }
@@ -0,0 +1,138 @@
+#ifndef VALHALLA_MJOLNIR_WAYNODEJOIN_H
+#define VALHALLA_MJOLNIR_WAYNODEJOIN_H
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <valhalla/mjolnir/osmdata.h>
+#include <valhalla/mjolnir/sortfile.h>
+
+namespace valhalla {
+namespace mjolnir {
+
+// How many way nodes to read in at a time to join the nodes to and the fewest
+// nodes worth giving a thread
+constexpr size_t kJoinChunk = 1048576;
+constexpr size_t kMinJoinNodes = 4096;
+
+/**
+ * Fills in the nodes of the way nodes file, sorted by node id, from runs of
+ * nodes that are also sorted by id. The file is read and written back a chunk
+ * at a time, each chunk holding all the way nodes of the nodes in it, so the
+ * nodes of a run that land in a chunk can be split up by id range and joined
+ * on all the threads at once
+ */
+class WayNodeJoin {
+ public:
+  /**
+   * Constructor
+   * @param  file_name         Way nodes file, sorted by node id.
+   * @param  threads           How many threads to join with.
+   * @param  chunk_size        How many way nodes to read in at a time, a chunk
+   *                           grows to fit all the way nodes of one node.
+   * @param  min_thread_nodes  Fewest nodes worth giving a thread.
+   */
+  WayNodeJoin(const std::string& file_name, const unsigned int threads,
+              const size_t chunk_size = kJoinChunk, const size_t min_thread_nodes = kMinJoinNodes)
+    : file_(file_name, std::ios::binary | std::ios::in | std::ios::out | std::ios::ate),
+      threads_(std::max(1u, threads)), chunk_size_(std::max(static_cast<size_t>(1), chunk_size)),
+      min_thread_nodes_(std::max(static_cast<size_t>(1), min_thread_nodes)), offset_(0), dirty_(false) {
+    if (!file_)
+      throw std::runtime_error("Failed to open " + file_name);
+    count_ = static_cast<size_t>(file_.tellp()) / sizeof(OSMWayNode);
+  }
+
+  /**
+   * Update all of the way nodes of each node in the run. Runs have to come in
+   * order of node id and every node has to have at least one way node.
+   * @param  run  Nodes sorted by id, all after the ones of earlier runs.
+   */
+  void Join(const std::vector<OSMNode>& run) {
+    auto before = [](const uint64_t osmid, const OSMNode& n) { return osmid < n.osmid; };
+    for (size_t i = 0; i < run.size(); ) {
+      // Skip the chunks that come before the rest of the run
+      while (chunk_.empty() || chunk_.back().node.osmid < run[i].osmid) {
+        if (!Load())
+          throw std::runtime_error("Didn't find OSMWayNode for node id: " + std::to_string(run[i].osmid));
+      }
+
+      // Each thread gets an id range of the nodes in this chunk and the way nodes that go with them
+      const size_t end = std::upper_bound(run.begin() + i, run.end(), chunk_.back().node.osmid, before) - run.begin();
+      const size_t pieces = std::max(static_cast<size_t>(1), std::min(static_cast<size_t>(threads_), (end - i) / min_thread_nodes_));
+      std::vector<size_t> firsts(pieces + 1, end);
+      std::vector<std::vector<OSMWayNode>::iterator> starts(pieces + 1, chunk_.end());
+      for (size_t piece = 0; piece < pieces; ++piece) {
+        firsts[piece] = i + (end - i) * piece / pieces;
+        starts[piece] = std::lower_bound(chunk_.begin(), chunk_.end(), run[firsts[piece]].osmid,
+          [](const OSMWayNode& a, const uint64_t osmid) { return a.node.osmid < osmid; });
+      }
+      detail::run_threads(pieces, [&](unsigned int piece) {
+        auto way_node = starts[piece];
+        for (size_t j = firsts[piece]; j < firsts[piece + 1]; ++j) {
+          while (way_node != starts[piece + 1] && way_node->node.osmid < run[j].osmid)
+            ++way_node;
+          if (way_node == starts[piece + 1] || way_node->node.osmid != run[j].osmid)
+            throw std::runtime_error("Didn't find OSMWayNode for node id: " + std::to_string(run[j].osmid));
+          for (; way_node != starts[piece + 1] && way_node->node.osmid == run[j].osmid; ++way_node)
+            way_node->node = run[j];
+        }
+      });
+      dirty_ = true;
+      i = end;
+    }
+  }
+
+  /**
+   * Write back the chunk we are on, call once the last run is joined.
+   */
+  void Flush() {
+    if (!dirty_)
+      return;
+    file_.seekp(offset_ * sizeof(OSMWayNode));
+    file_.write(reinterpret_cast<const char*>(chunk_.data()), chunk_.size() * sizeof(OSMWayNode));
+    if (!file_)
+      throw std::runtime_error("Failed to write way nodes");
+    dirty_ = false;
+  }
+
+ protected:
+  // Move on to the next chunk, returns false if there are none left
+  bool Load() {
+    Flush();
+    offset_ += chunk_.size();
+    chunk_.clear();
+    for (size_t size = chunk_size_; offset_ < count_; size *= 2) {
+      chunk_.resize(std::min(size, count_ - offset_));
+      file_.seekg(offset_ * sizeof(OSMWayNode));
+      file_.read(reinterpret_cast<char*>(chunk_.data()), chunk_.size() * sizeof(OSMWayNode));
+      if (!file_)
+        throw std::runtime_error("Failed to read way nodes");
+      // The last node might have more way nodes in the next chunk, leave it for then
+      if (offset_ + chunk_.size() == count_)
+        return true;
+      size_t end = chunk_.size();
+      while (end > 0 && chunk_[end - 1].node.osmid == chunk_.back().node.osmid)
+        --end;
+      if (end > 0) {
+        chunk_.resize(end);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::fstream file_;
+  unsigned int threads_;
+  size_t chunk_size_, min_thread_nodes_, count_, offset_;
+  std::vector<OSMWayNode> chunk_;
+  bool dirty_;
+};
+
+}
+}
+
+#endif  // VALHALLA_MJOLNIR_WAYNODEJOIN_H
@@ -0,0 +1,66 @@
+#ifndef VALHALLA_MJOLNIR_WIREDECODER_H
+#define VALHALLA_MJOLNIR_WIREDECODER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <utility>
+
+#include <valhalla/mjolnir/osmpbfparser.h>
+
+// extend the protobuf osmpbf namespace
+namespace OSMPBF {
+
+/**
+ * Where the data of a Blob is and how it is compressed. Points into the buffer the
+ * Blob was decoded from so nothing is copied out of it.
+ */
+struct BlobData {
+  enum Compression { RAW, ZLIB, LZMA, BZIP2, LZ4, ZSTD, MISSING };
+  Compression compression;
+  const char* data;
+  size_t size;
+  //the size once inflated, -1 if it wasnt set
+  int32_t raw_size;
+};
+
+/**
+ * Find the data in a Blob by walking its wire format
+ * @param  buffer  the Blob
+ * @param  size    the size of the Blob in bytes
+ * @return where the data is and how it is compressed
+ */
+BlobData decode_blob(const char* buffer, const size_t size);
+
+/**
+ * Decodes inflated PrimitiveBlocks by walking the protobuf wire format directly
+ * rather than building libprotobuf message objects. The strings of the decoded
+ * block point into the inflated buffer so it has to outlive the block. Keep one
+ * around per thread so that its scratch space gets reused from block to block.
+ */
+class WireDecoder {
+ public:
+  /**
+   * Lay out the primitives of interest in a block
+   * @param  buffer    the inflated PrimitiveBlock
+   * @param  size      the size of the inflated PrimitiveBlock in bytes
+   * @param  interest  which kinds of primitives to decode
+   * @param  block     where to put the decoded primitives
+   * @param  info      if not null, the kinds of primitives and node id range of the
+   *                   whole block regardless of interest are filled out here
+   */
+  void decode(const char* buffer, const size_t size, const Interest interest, Block& block, BlobInfo* info = nullptr);
+
+ protected:
+  // where each primitive group is in the buffer
+  std::vector<std::pair<const uint8_t*, const uint8_t*> > groups_;
+  // columns of the dense nodes before they are delta decoded
+  std::vector<int64_t> ids_;
+  std::vector<int64_t> lats_;
+  std::vector<int64_t> lons_;
+  std::vector<uint32_t> keys_vals_;
+};
+
+}
+
+#endif  // VALHALLA_MJOLNIR_WIREDECODER_H